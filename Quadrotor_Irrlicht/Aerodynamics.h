@@ -0,0 +1,102 @@
+#pragma once
+#include <irrlicht.h>
+#include <cmath>
+
+using namespace irr;
+
+#define _METER *100
+
+// Rotor aerodynamics beyond the propeller tables:
+// - ground effect: a rotor close to the ground pushes against its own wake and gains thrust
+//   (Cheeseman and Bennett: T / T_free = 1 / (1 - (R / 4z)^2)),
+// - vortex ring state: in a steep descent at about the induced velocity the rotor sinks into its
+//   own recirculating wake and loses thrust; some horizontal speed blows the ring away,
+// - induced rotor drag: blades moving through air that crosses the rotor plane tilt their thrust
+//   backwards, a force against the in-plane airspeed proportional to the thrust.
+// The first two are tabulated once over heights in rotor radii and speeds in hover induced velocities,
+// which holds for every rotor size; a vehicle only keeps its radius and induced velocity.
+class Aerodynamics {
+private:
+	enum { HEIGHT_STEPS = 64, DESCENT_STEPS = 32, CROSSFLOW_STEPS = 16 };
+	// Table ranges: heights in rotor radii, speeds in hover induced velocities
+	static constexpr float minHeight = 0.5f, maxHeight = 8.f;
+	static constexpr float maxDescent = 3.f, maxCrossflow = 2.f;
+
+	struct Tables {
+		float groundEffect[HEIGHT_STEPS];
+		float vortexRing[CROSSFLOW_STEPS][DESCENT_STEPS];
+
+		Tables() {
+			for (int i = 0; i < HEIGHT_STEPS; ++i) {
+				float z = minHeight + (maxHeight - minHeight) * i / (HEIGHT_STEPS - 1);
+				float r = 1 / (4 * z);
+				groundEffect[i] = 1 / (1 - r * r);
+			}
+			// Up to 35 % less thrust around 1.2 times the induced velocity, gone at about half of it across the rotor
+			for (int h = 0; h < CROSSFLOW_STEPS; ++h)
+				for (int d = 0; d < DESCENT_STEPS; ++d) {
+					float descent = maxDescent * d / (DESCENT_STEPS - 1);
+					float crossflow = maxCrossflow * h / (CROSSFLOW_STEPS - 1);
+					float ring = (descent - 1.2f) / 0.5f, blowAway = crossflow / 0.6f;
+					vortexRing[h][d] = 1 - 0.35f * expf(-ring * ring) * expf(-blowAway * blowAway);
+				}
+		}
+	};
+
+	static const Tables& getTables() {
+		static const Tables tables;
+		return tables;
+	}
+
+	float rotorRadius = 1.f, invRotorRadius = 1.f;
+	float inducedVelocity = 1.f, invInducedVelocity = 1.f;
+	float rotorDrag = 0.03f / (1 _METER); // thrust fraction per in-plane airspeed
+
+public:
+	Aerodynamics() {}
+
+	// Hover thrust of one rotor; sets the induced velocity of momentum theory, sqrt(T / (2 rho A))
+	void setRotor(float radius, float hoverThrust) {
+		const float airDensity = 1.225f / (1 _METER _METER _METER);
+		rotorRadius = radius;
+		invRotorRadius = 1 / radius;
+		inducedVelocity = sqrtf(hoverThrust / (2 * airDensity * core::PI * radius * radius));
+		invInducedVelocity = 1 / inducedVelocity;
+	}
+
+	float getInducedVelocity() const {
+		return inducedVelocity;
+	}
+
+	// Induced drag per thrust and in-plane airspeed
+	void setRotorDrag(float rotorDrag) {
+		this->rotorDrag = rotorDrag;
+	}
+
+	float getRotorDrag() const {
+		return rotorDrag;
+	}
+
+	// Thrust factor of a rotor at a height above the ground; 1 far from it
+	float getGroundEffect(float height) const {
+		float x = (height * invRotorRadius - minHeight) * ((HEIGHT_STEPS - 1) / (maxHeight - minHeight));
+		if (x >= HEIGHT_STEPS - 1)
+			return 1.f;
+		x = core::max_(x, 0.f);
+		int i = (int)x;
+		const float* table = getTables().groundEffect;
+		return table[i] + (table[i + 1] - table[i]) * (x - i);
+	}
+
+	// Thrust factor in descent; axialAirspeed is negative when descending, crossflow is the in-plane airspeed
+	float getVortexRing(float axialAirspeed, float crossflow) const {
+		float x = core::clamp(-axialAirspeed * invInducedVelocity * ((DESCENT_STEPS - 1) / maxDescent), 0.f, DESCENT_STEPS - 1.001f);
+		float y = core::clamp(crossflow * invInducedVelocity * ((CROSSFLOW_STEPS - 1) / maxCrossflow), 0.f, CROSSFLOW_STEPS - 1.001f);
+		int i = (int)x, j = (int)y;
+		float tx = x - i, ty = y - j;
+		const Tables& tables = getTables();
+		float low = tables.vortexRing[j][i] + (tables.vortexRing[j][i + 1] - tables.vortexRing[j][i]) * tx;
+		float high = tables.vortexRing[j + 1][i] + (tables.vortexRing[j + 1][i + 1] - tables.vortexRing[j + 1][i]) * tx;
+		return low + (high - low) * ty;
+	}
+};
@@ -0,0 +1,128 @@
+#pragma once
+#include <irrlicht.h>
+#include "SmallMatrix.h"
+
+using namespace irr;
+
+#define AIRFRAME_MAX_MOTORS 8
+
+// Hub of one rotor in multiples of the vehicle size: X forward, Y up, Z across.
+// spin is +1 if the rotor turns counterclockwise seen from above, -1 if clockwise.
+struct RotorGeometry {
+	float x, y, z;
+	int spin;
+};
+
+// Runtime copy of an airframe for the vehicle model, which handles every layout with the same code
+struct AirframeGeometry {
+	int motorCount;
+	RotorGeometry rotors[AIRFRAME_MAX_MOTORS];
+};
+
+// An airframe is a type with the motor count as enum MOTORS and a constexpr getRotor(i).
+// Everything else is derived from it at compile time.
+
+// The original four rotor vehicle: arms along the diagonals, motors 0 and 3 turning counterclockwise
+struct QuadX {
+	enum { MOTORS = 4 };
+
+	static constexpr RotorGeometry getRotor(int i) {
+		return RotorGeometry{ 1.f - 2 * (i / 2), 0.55f, 1.f - 2 * (i % 2), i == 0 || i == 3 ? 1 : -1 };
+	}
+};
+
+// sin and cos for constant expressions, |x| <= pi
+constexpr float constexprSin(float x) {
+	float term = x, sum = x;
+	for (int n = 1; n < 12; ++n) {
+		term *= -x * x / ((2 * n) * (2 * n + 1));
+		sum += term;
+	}
+	return sum;
+}
+
+constexpr float constexprCos(float x) {
+	float term = 1, sum = 1;
+	for (int n = 1; n < 12; ++n) {
+		term *= -x * x / ((2 * n - 1) * (2 * n));
+		sum += term;
+	}
+	return sum;
+}
+
+// Arms evenly around the body, as long as the diagonals of QuadX, and neighbouring arms turning
+// the other way. Plus layouts have the first arm pointing forward, cross layouts are turned by half
+// an arm. Coaxial frames carry an upper and a lower rotor on every arm, turning against each other.
+template <int Arms, bool Cross, bool Coaxial = false>
+struct RadialAirframe {
+	static_assert(Arms % 2 == 0, "the spins only cancel with an even number of arms");
+	enum { MOTORS = Coaxial ? 2 * Arms : Arms };
+	static_assert(MOTORS <= AIRFRAME_MAX_MOTORS, "too many motors");
+
+	// The angle of an arm is pi * k / Arms with k in (-Arms, Arms]. Both functions reduce it to the
+	// first quadrant, so mirrored arms get exactly mirrored coordinates and the thrusts cancel exactly.
+	static constexpr float armCos(int k) {
+		int m = k < 0 ? -k : k;
+		return 2 * m == Arms ? 0.f : 2 * m > Arms ? -constexprCos(3.14159265f * (Arms - m) / Arms) : constexprCos(3.14159265f * m / Arms);
+	}
+
+	static constexpr float armSin(int k) {
+		int m = k < 0 ? -k : k;
+		float s = m == Arms ? 0.f : constexprSin(3.14159265f * (2 * m > Arms ? Arms - m : m) / Arms);
+		return k < 0 ? -s : s;
+	}
+
+	static constexpr RotorGeometry getRotor(int i) {
+		int arm = Coaxial ? i / 2 : i;
+		bool lower = Coaxial && i % 2 == 1;
+		int k = 2 * arm + (Cross ? 1 : 0);
+		if (k > Arms)
+			k -= 2 * Arms;
+		int spin = arm % 2 == 0 ? 1 : -1;
+		return RotorGeometry{ 1.41421356f * armCos(k), Coaxial ? (lower ? 0.4f : 0.7f) : 0.55f,
+			1.41421356f * armSin(k), lower ? -spin : spin };
+	}
+};
+
+typedef RadialAirframe<4, false> QuadPlus;
+typedef RadialAirframe<6, true> Hexa;
+typedef RadialAirframe<8, true> Octo;
+typedef RadialAirframe<4, true, true> CoaxialQuad;
+
+template <class Airframe>
+constexpr AirframeGeometry makeAirframeGeometry() {
+	AirframeGeometry geometry = {};
+	geometry.motorCount = Airframe::MOTORS;
+	for (int i = 0; i < Airframe::MOTORS; ++i)
+		geometry.rotors[i] = Airframe::getRotor(i);
+	return geometry;
+}
+
+// Columns thrust, roll, pitch and yaw; a row gives the share of one motor.
+// More thrust on the -Z side rolls positively around X, more thrust in front pitches positively
+// around Z, and slowing the counterclockwise rotors yaws positively. Roll and pitch are scaled so the
+// outermost motors get the full command, which makes QuadX the former hand written mixer.
+template <class Airframe>
+constexpr SMatrix<float, Airframe::MOTORS, 4> makeMixer() {
+	float maxX = 0, maxZ = 0;
+	for (int i = 0; i < Airframe::MOTORS; ++i) {
+		RotorGeometry r = Airframe::getRotor(i);
+		float x = r.x < 0 ? -r.x : r.x, z = r.z < 0 ? -r.z : r.z;
+		maxX = x > maxX ? x : maxX;
+		maxZ = z > maxZ ? z : maxZ;
+	}
+	SMatrix<float, Airframe::MOTORS, 4> mixer = {};
+	for (int i = 0; i < Airframe::MOTORS; ++i) {
+		RotorGeometry r = Airframe::getRotor(i);
+		mixer(i, 0) = 1;
+		mixer(i, 1) = -r.z / maxZ;
+		mixer(i, 2) = r.x / maxX;
+		mixer(i, 3) = (float)-r.spin;
+	}
+	return mixer;
+}
+
+// Hub position in world units
+inline core::vector3df getRotorPosition(const RotorGeometry& rotor, float size) {
+	return core::vector3df(rotor.x * size, rotor.y * size, rotor.z * size);
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <irrlicht.h>
+#include <vector>
+
+using namespace irr;
+
+// Lithium polymer packs of many vehicles as structure of arrays, updated together once per step.
+// A pack is an open-circuit voltage over state of charge in series with its internal resistance,
+// so the terminal voltage sags under load and falls as the pack drains. Vehicles report the current
+// their motors would draw at the nominal voltage; the pack draws the same power at its actual voltage.
+// The loaded voltage limits the motor speed, and an empty pack cuts the motors off.
+// The update loop has no branches and no calls, so the compiler can vectorize it.
+class BatteryBank {
+private:
+	enum { OCV_STEPS = 11 };
+	// Open-circuit voltage of one cell at 0, 10, ..., 100 % charge
+	const float cellVoltage[OCV_STEPS] = { 3.27f, 3.61f, 3.69f, 3.71f, 3.73f, 3.75f, 3.77f, 3.79f, 3.84f, 3.97f, 4.20f };
+	const float nominalCellVoltage = 3.7f;
+
+	std::vector<float> capacity, charge; // A s
+	std::vector<float> cells, resistance;
+	std::vector<float> demand;			 // current at the nominal voltage, A
+	std::vector<float> current, voltage; // last step
+	std::vector<float> energy;			 // drawn, J
+	std::vector<float> peakCurrent;
+	std::vector<float> speedLimit;		 // fraction of the motors' maximum speed
+
+public:
+	BatteryBank() {}
+
+	// capacity in Ah, resistance of the whole pack in ohm; returns the index of the pack
+	int addPack(float capacity, int cells, float resistance) {
+		this->capacity.push_back(capacity * 3600);
+		charge.push_back(capacity * 3600);
+		this->cells.push_back((float)cells);
+		this->resistance.push_back(resistance);
+		demand.push_back(0.f);
+		current.push_back(0.f);
+		voltage.push_back(cells * cellVoltage[OCV_STEPS - 1]);
+		energy.push_back(0.f);
+		peakCurrent.push_back(0.f);
+		speedLimit.push_back(1.f);
+		return (int)charge.size() - 1;
+	}
+
+	int getPackCount() const {
+		return (int)charge.size();
+	}
+
+	// Fully charged, telemetry cleared
+	void recharge(int i) {
+		charge[i] = capacity[i];
+		current[i] = 0.f;
+		voltage[i] = cells[i] * cellVoltage[OCV_STEPS - 1];
+		energy[i] = 0.f;
+		peakCurrent[i] = 0.f;
+		speedLimit[i] = 1.f;
+	}
+
+	void setDemand(int i, float current) {
+		demand[i] = current;
+	}
+
+	void update(float elapsedTime) {
+		int n = (int)charge.size();
+		for (int i = 0; i < n; ++i) {
+			float soc = core::clamp(charge[i] / capacity[i], 0.f, 1.f);
+			float x = soc * (OCV_STEPS - 1);
+			int j = core::min_((int)x, OCV_STEPS - 2);
+			float openVoltage = cells[i] * (cellVoltage[j] + (cellVoltage[j + 1] - cellVoltage[j]) * (x - j));
+			float nominal = cells[i] * nominalCellVoltage;
+			// Same power as at the nominal voltage; the last voltage avoids solving for the current
+			float I = demand[i] * nominal / core::max_(voltage[i], 0.5f * nominal);
+			float V = openVoltage - I * resistance[i];
+			charge[i] = core::max_(charge[i] - I * elapsedTime, 0.f);
+			energy[i] += V * I * elapsedTime;
+			peakCurrent[i] = core::max_(peakCurrent[i], I);
+			current[i] = I;
+			voltage[i] = V;
+			speedLimit[i] = (charge[i] > 0.f) * core::clamp(V / (cells[i] * cellVoltage[OCV_STEPS - 1]), 0.f, 1.f);
+		}
+	}
+
+	// Fraction of the maximum motor speed the pack can drive now
+	float getSpeedLimit(int i) const {
+		return speedLimit[i];
+	}
+
+	float getStateOfCharge(int i) const {
+		return charge[i] / capacity[i];
+	}
+
+	// Terminal voltage under the last load in V
+	float getVoltage(int i) const {
+		return voltage[i];
+	}
+
+	float getCurrent(int i) const {
+		return current[i];
+	}
+
+	float getPeakCurrent(int i) const {
+		return peakCurrent[i];
+	}
+
+	// Energy drawn since the last recharge in Wh
+	float getEnergy(int i) const {
+		return energy[i] / 3600;
+	}
+
+	// Seconds until the pack is empty at the last current, 0 while no current flows
+	float getRemainingTime(int i) const {
+		return current[i] > 0 ? charge[i] / current[i] : 0.f;
+	}
+};
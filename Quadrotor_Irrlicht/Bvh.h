@@ -0,0 +1,241 @@
+#pragma once
+#include <irrlicht.h>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define BVH_SSE
+#include <xmmintrin.h>
+#endif
+
+using namespace irr;
+
+// Rays in structure-of-arrays form, four at a time so a packet fills an SSE register.
+// Directions do not have to be normalized; distances are in multiples of the direction.
+struct RayPacket {
+	float origin[3][4];
+	float invDirection[3][4];
+	float tMax[4];
+	int active; // bit i set if ray i takes part
+};
+
+// 1 / d for slab tests, kept finite: for a ray parallel to a slab that starts on one of its planes,
+// 0 * inf would give NaN and the box test would hit or miss depending on the operand order
+inline float inverseDirection(float d) {
+	const float limit = 1e30f;
+	float inv = 1 / d;
+	return inv > limit ? limit : (inv < -limit ? -limit : inv);
+}
+
+// Bounding volume hierarchy over axis-aligned boxes, for ray queries against many primitives.
+// The tree is built once by splitting at the median of the box centers along their longest extent.
+// refit() recomputes the bounds bottom-up from moved primitives and keeps the tree, which is enough
+// as long as the primitives stay roughly where they were relative to each other.
+// Nodes are 32 bytes and children are stored after their parent, so refitting is one backward pass.
+class Bvh {
+public:
+	struct Node {
+		float min[3];
+		int first; // leaves: first entry in the primitive order, interior nodes: left child (right is first + 1)
+		float max[3];
+		int count; // primitives in a leaf, 0 for interior nodes
+	};
+
+private:
+	std::vector<Node> nodes;
+	std::vector<int> order; // primitive indices grouped by leaf
+	std::vector<core::vector3df> centers;
+	int leafSize = 4;
+	enum { MAX_DEPTH = 64 };
+
+	static void setBounds(Node& node, const core::aabbox3df& box) {
+		node.min[0] = box.MinEdge.X;
+		node.min[1] = box.MinEdge.Y;
+		node.min[2] = box.MinEdge.Z;
+		node.max[0] = box.MaxEdge.X;
+		node.max[1] = box.MaxEdge.Y;
+		node.max[2] = box.MaxEdge.Z;
+	}
+
+	static void mergeBounds(Node& node, const Node& a, const Node& b) {
+		for (int k = 0; k < 3; ++k) {
+			node.min[k] = core::min_(a.min[k], b.min[k]);
+			node.max[k] = core::max_(a.max[k], b.max[k]);
+		}
+	}
+
+	void fitLeaf(Node& node, const core::aabbox3df* bounds) const {
+		core::aabbox3df box = bounds[order[node.first]];
+		for (int i = 1; i < node.count; ++i)
+			box.addInternalBox(bounds[order[node.first + i]]);
+		setBounds(node, box);
+	}
+
+	void split(int index, int begin, int end, const core::aabbox3df* bounds, int depth) {
+		if (end - begin <= leafSize || depth >= MAX_DEPTH - 2) {
+			nodes[index].first = begin;
+			nodes[index].count = end - begin;
+			fitLeaf(nodes[index], bounds);
+			return;
+		}
+		core::aabbox3df centerBox(centers[order[begin]]);
+		for (int i = begin + 1; i < end; ++i)
+			centerBox.addInternalPoint(centers[order[i]]);
+		core::vector3df extent = centerBox.getExtent();
+		int axis = extent.X >= extent.Y && extent.X >= extent.Z ? 0 : extent.Y >= extent.Z ? 1 : 2;
+		int mid = (begin + end) / 2;
+		const std::vector<core::vector3df>& c = centers;
+		std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+			[&](int a, int b) { return (&c[a].X)[axis] < (&c[b].X)[axis]; });
+
+		int left = (int)nodes.size();
+		nodes.resize(nodes.size() + 2);
+		nodes[index].first = left;
+		nodes[index].count = 0;
+		split(left, begin, mid, bounds, depth + 1);
+		split(left + 1, mid, end, bounds, depth + 1);
+		mergeBounds(nodes[index], nodes[left], nodes[left + 1]);
+	}
+
+	static bool hitsNode(const Node& node, const float* origin, const float* invDirection, float tMax, float& tEntry) {
+		float t0 = 0.f, t1 = tMax;
+		for (int k = 0; k < 3; ++k) {
+			float a = (node.min[k] - origin[k]) * invDirection[k];
+			float b = (node.max[k] - origin[k]) * invDirection[k];
+			t0 = core::max_(t0, core::min_(a, b));
+			t1 = core::min_(t1, core::max_(a, b));
+		}
+		tEntry = t0;
+		return t0 <= t1;
+	}
+
+public:
+	void build(const std::vector<core::aabbox3df>& bounds, int leafSize = 4) {
+		this->leafSize = leafSize;
+		int n = (int)bounds.size();
+		nodes.clear();
+		order.resize(n);
+		centers.resize(n);
+		for (int i = 0; i < n; ++i) {
+			order[i] = i;
+			centers[i] = bounds[i].getCenter();
+		}
+		if (n == 0)
+			return;
+		nodes.reserve(2 * n);
+		nodes.resize(1);
+		split(0, 0, n, bounds.data(), 0);
+	}
+
+	// Same primitives as in build(), at their new bounds
+	void refit(const std::vector<core::aabbox3df>& bounds) {
+		for (int i = (int)nodes.size() - 1; i >= 0; --i) {
+			Node& node = nodes[i];
+			if (node.count > 0)
+				fitLeaf(node, bounds.data());
+			else
+				mergeBounds(node, nodes[node.first], nodes[node.first + 1]);
+		}
+	}
+
+	bool isEmpty() const {
+		return nodes.empty();
+	}
+
+	int getNodeCount() const {
+		return (int)nodes.size();
+	}
+
+	// Visits the leaves along a ray, nearer children first. leaf(primitive, tMax) tests one
+	// primitive and lowers tMax on a hit; invDirection is 1 / direction per axis.
+	template <class Leaf>
+	void intersect(const float* origin, const float* invDirection, float& tMax, Leaf& leaf) const {
+		if (nodes.empty())
+			return;
+		int stack[MAX_DEPTH];
+		int top = 0;
+		float tEntry;
+		if (!hitsNode(nodes[0], origin, invDirection, tMax, tEntry))
+			return;
+		stack[top++] = 0;
+		while (top > 0) {
+			const Node& node = nodes[stack[--top]];
+			if (node.count > 0) {
+				for (int i = 0; i < node.count; ++i)
+					leaf(order[node.first + i], tMax);
+				continue;
+			}
+			float tLeft, tRight;
+			bool left = hitsNode(nodes[node.first], origin, invDirection, tMax, tLeft);
+			bool right = hitsNode(nodes[node.first + 1], origin, invDirection, tMax, tRight);
+			if (left && right) {
+				bool leftFirst = tLeft <= tRight;
+				stack[top++] = leftFirst ? node.first + 1 : node.first;
+				stack[top++] = leftFirst ? node.first : node.first + 1;
+			}
+			else if (left)
+				stack[top++] = node.first;
+			else if (right)
+				stack[top++] = node.first + 1;
+		}
+	}
+
+	// Four rays through the tree together: a node is entered if any active ray hits it, which is
+	// one SSE box test for all four. leaf(primitive, ray, tMax) is called for every ray that hits the
+	// leaf's box. Coherent rays, such as neighbouring lidar beams, share most of their nodes.
+	template <class Leaf>
+	void intersect(RayPacket& packet, Leaf& leaf) const {
+		if (nodes.empty() || packet.active == 0)
+			return;
+#ifdef BVH_SSE
+		__m128 ox = _mm_loadu_ps(packet.origin[0]), oy = _mm_loadu_ps(packet.origin[1]), oz = _mm_loadu_ps(packet.origin[2]);
+		__m128 ix = _mm_loadu_ps(packet.invDirection[0]), iy = _mm_loadu_ps(packet.invDirection[1]), iz = _mm_loadu_ps(packet.invDirection[2]);
+		__m128 zero = _mm_setzero_ps();
+		int stack[MAX_DEPTH];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const Node& node = nodes[stack[--top]];
+			__m128 ax = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[0]), ox), ix);
+			__m128 bx = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[0]), ox), ix);
+			__m128 ay = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[1]), oy), iy);
+			__m128 by = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[1]), oy), iy);
+			__m128 az = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[2]), oz), iz);
+			__m128 bz = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[2]), oz), iz);
+			__m128 t0 = _mm_max_ps(_mm_max_ps(_mm_min_ps(ax, bx), _mm_min_ps(ay, by)), _mm_max_ps(_mm_min_ps(az, bz), zero));
+			__m128 t1 = _mm_min_ps(_mm_min_ps(_mm_max_ps(ax, bx), _mm_max_ps(ay, by)), _mm_min_ps(_mm_max_ps(az, bz), _mm_loadu_ps(packet.tMax)));
+			int hits = _mm_movemask_ps(_mm_cmple_ps(t0, t1)) & packet.active;
+			if (hits == 0)
+				continue;
+			if (node.count > 0) {
+				for (int r = 0; r < 4; ++r)
+					if (hits & (1 << r))
+						for (int i = 0; i < node.count; ++i)
+							leaf(order[node.first + i], r, packet.tMax[r]);
+				continue;
+			}
+			// Nearer child first for the first ray that hit the node
+			int r = 0;
+			while (!(hits & (1 << r)))
+				++r;
+			float tLeft, tRight;
+			float origin[3] = { packet.origin[0][r], packet.origin[1][r], packet.origin[2][r] };
+			float invDirection[3] = { packet.invDirection[0][r], packet.invDirection[1][r], packet.invDirection[2][r] };
+			hitsNode(nodes[node.first], origin, invDirection, packet.tMax[r], tLeft);
+			hitsNode(nodes[node.first + 1], origin, invDirection, packet.tMax[r], tRight);
+			bool leftFirst = tLeft <= tRight;
+			stack[top++] = leftFirst ? node.first + 1 : node.first;
+			stack[top++] = leftFirst ? node.first : node.first + 1;
+		}
+#else
+		for (int r = 0; r < 4; ++r) {
+			if (!(packet.active & (1 << r)))
+				continue;
+			float origin[3] = { packet.origin[0][r], packet.origin[1][r], packet.origin[2][r] };
+			float invDirection[3] = { packet.invDirection[0][r], packet.invDirection[1][r], packet.invDirection[2][r] };
+			auto single = [&](int primitive, float& tMax) { leaf(primitive, r, tMax); };
+			intersect(origin, invDirection, packet.tMax[r], single);
+		}
+#endif
+	}
+};
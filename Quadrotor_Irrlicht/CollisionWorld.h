@@ -0,0 +1,341 @@
+#pragma once
+#include <irrlicht.h>
+#include <vector>
+#include <unordered_map>
+#include "Quadrotor.h"
+#include "Profiler.h"
+
+using namespace irr;
+
+enum ObstacleType {
+	OT_SPHERE,
+	OT_BOX
+};
+
+struct Obstacle {
+	ObstacleType type;
+	core::aabbox3df box;	// bounds, the shape itself for OT_BOX
+	core::vector3df center; // OT_SPHERE
+	float radius;
+};
+
+struct Contact {
+	int vehicle;
+	int other;			   // vehicle index, or obstacle index if withObstacle
+	bool withObstacle;
+	core::vector3df normal; // from other towards vehicle
+	float depth;
+};
+
+// Collision detection between vehicles (spheres) and static obstacles (spheres and boxes).
+// Broad phase for vehicles: a uniform spatial hash with cells of at least the largest vehicle
+// diameter, each vehicle is linked into the cell of its center. A vehicle is only relinked when it
+// crossed a cell border since the last step, so a step costs O(moved vehicles) for the hash and
+// O(vehicles * neighbours) for the pair search over the 27 surrounding cells.
+// Obstacles are static and kept in a second, coarser grid that is filled once when they are added.
+class CollisionWorld {
+private:
+	struct Vehicle {
+		Quadrotor* quadrotor;
+		float radius;
+		s64 cell;
+		int prev, next; // list of the vehicles in the same bucket
+		int bucket;
+	};
+
+	float cellSize, invCellSize;
+	std::vector<Vehicle> vehicles;
+	std::vector<int> buckets; // first vehicle of each bucket, -1 if empty
+	u32 bucketMask;
+
+	float staticCellSize, invStaticCellSize;
+	std::vector<Obstacle> obstacles;
+	std::unordered_map<s64, std::vector<int> > staticCells;
+	std::vector<u32> obstacleStamps; // last query an obstacle was tested in, avoids testing it twice
+	u32 stamp = 0;
+
+	std::vector<Contact> contacts;
+	u32 relinked = 0;
+	u32 pairsTested = 0;
+
+	// 21 bits per axis, cells wrap around after about 2 million cells
+	static s64 packCell(int x, int y, int z) {
+		return ((s64)(x & 0x1fffff) << 42) | ((s64)(y & 0x1fffff) << 21) | (s64)(z & 0x1fffff);
+	}
+
+	int toCell(float v) const {
+		return (int)floorf(v * invCellSize);
+	}
+
+	int getBucket(s64 cell) const {
+		u64 h = (u64)cell * 0x9E3779B97F4A7C15ull;
+		return (int)((h >> 32) & bucketMask);
+	}
+
+	void unlink(int i) {
+		Vehicle& v = vehicles[i];
+		if (v.prev >= 0)
+			vehicles[v.prev].next = v.next;
+		else
+			buckets[v.bucket] = v.next;
+		if (v.next >= 0)
+			vehicles[v.next].prev = v.prev;
+	}
+
+	void link(int i, s64 cell) {
+		Vehicle& v = vehicles[i];
+		v.cell = cell;
+		v.bucket = getBucket(cell);
+		v.prev = -1;
+		v.next = buckets[v.bucket];
+		if (v.next >= 0)
+			vehicles[v.next].prev = i;
+		buckets[v.bucket] = i;
+	}
+
+	// Keeps about two buckets per vehicle
+	void resize(u32 numBuckets) {
+		buckets.assign(numBuckets, -1);
+		bucketMask = numBuckets - 1;
+		for (size_t i = 0; i < vehicles.size(); ++i)
+			link((int)i, vehicles[i].cell);
+	}
+
+	s64 getCell(const core::vector3df& pos) const {
+		return packCell(toCell(pos.X), toCell(pos.Y), toCell(pos.Z));
+	}
+
+	void testVehicles(int a, int b) {
+		pairsTested++;
+		core::vector3df d = vehicles[a].quadrotor->getPosition() - vehicles[b].quadrotor->getPosition();
+		float r = vehicles[a].radius + vehicles[b].radius;
+		float distSQ = d.getLengthSQ();
+		if (distSQ >= r * r)
+			return;
+		float dist = sqrtf(distSQ);
+		Contact c;
+		c.vehicle = a;
+		c.other = b;
+		c.withObstacle = false;
+		c.normal = dist > 1e-6f ? d / dist : core::vector3df(0, 1, 0);
+		c.depth = r - dist;
+		contacts.push_back(c);
+	}
+
+	void testObstacle(int v, int o) {
+		pairsTested++;
+		const Obstacle& obstacle = obstacles[o];
+		core::vector3df pos = vehicles[v].quadrotor->getPosition();
+		float radius = vehicles[v].radius;
+		core::vector3df closest;
+		if (obstacle.type == OT_SPHERE)
+			closest = obstacle.center + (pos - obstacle.center).setLength(obstacle.radius);
+		else
+			closest.set(core::clamp(pos.X, obstacle.box.MinEdge.X, obstacle.box.MaxEdge.X),
+				core::clamp(pos.Y, obstacle.box.MinEdge.Y, obstacle.box.MaxEdge.Y),
+				core::clamp(pos.Z, obstacle.box.MinEdge.Z, obstacle.box.MaxEdge.Z));
+		Contact c;
+		c.vehicle = v;
+		c.other = o;
+		c.withObstacle = true;
+		bool inside = obstacle.type == OT_SPHERE ? pos.getDistanceFromSQ(obstacle.center) < obstacle.radius * obstacle.radius
+			: obstacle.box.isPointInside(pos);
+		if (!inside) {
+			core::vector3df d = pos - closest;
+			float distSQ = d.getLengthSQ();
+			if (distSQ >= radius * radius)
+				return;
+			float dist = sqrtf(distSQ);
+			c.normal = dist > 1e-6f ? d / dist : core::vector3df(0, 1, 0);
+			c.depth = radius - dist;
+		}
+		else if (obstacle.type == OT_SPHERE) {
+			core::vector3df d = pos - obstacle.center;
+			c.normal = d.getLengthSQ() > 1e-12f ? d.normalize() : core::vector3df(0, 1, 0);
+			c.depth = radius + obstacle.radius - pos.getDistanceFrom(obstacle.center);
+		}
+		else {
+			// Center inside the box: leave through the nearest face
+			const core::aabbox3df& b = obstacle.box;
+			float faces[6] = { pos.X - b.MinEdge.X, b.MaxEdge.X - pos.X, pos.Y - b.MinEdge.Y,
+				b.MaxEdge.Y - pos.Y, pos.Z - b.MinEdge.Z, b.MaxEdge.Z - pos.Z };
+			int face = 0;
+			for (int f = 1; f < 6; ++f)
+				if (faces[f] < faces[face])
+					face = f;
+			c.normal.set(0, 0, 0);
+			(&c.normal.X)[face / 2] = face % 2 == 0 ? -1.f : 1.f;
+			c.depth = faces[face] + radius;
+		}
+		contacts.push_back(c);
+	}
+
+	void insertObstacle(int o) {
+		const core::aabbox3df& box = obstacles[o].box;
+		int x0 = (int)floorf(box.MinEdge.X * invStaticCellSize), x1 = (int)floorf(box.MaxEdge.X * invStaticCellSize);
+		int y0 = (int)floorf(box.MinEdge.Y * invStaticCellSize), y1 = (int)floorf(box.MaxEdge.Y * invStaticCellSize);
+		int z0 = (int)floorf(box.MinEdge.Z * invStaticCellSize), z1 = (int)floorf(box.MaxEdge.Z * invStaticCellSize);
+		for (int x = x0; x <= x1; ++x)
+			for (int y = y0; y <= y1; ++y)
+				for (int z = z0; z <= z1; ++z)
+					staticCells[packCell(x, y, z)].push_back(o);
+		obstacleStamps.push_back(0);
+	}
+
+public:
+	// cellSize has to be at least the largest vehicle diameter; obstacles use cells of staticCellSize
+	CollisionWorld(float cellSize, float staticCellSize)
+		: cellSize(cellSize), invCellSize(1.f / cellSize), staticCellSize(staticCellSize),
+		invStaticCellSize(1.f / staticCellSize)
+	{
+		resize(64);
+	}
+
+	// radius of the sphere enclosing the vehicle; returns the vehicle index used in contacts
+	int addVehicle(Quadrotor* quadrotor, float radius) {
+		Vehicle v;
+		v.quadrotor = quadrotor;
+		v.radius = radius;
+		vehicles.push_back(v);
+		if (vehicles.size() * 2 > buckets.size()) {
+			vehicles.back().cell = getCell(quadrotor->getPosition());
+			resize((u32)buckets.size() * 2);
+		}
+		else
+			link((int)vehicles.size() - 1, getCell(quadrotor->getPosition()));
+		return (int)vehicles.size() - 1;
+	}
+
+	int addSphere(const core::vector3df& center, float radius) {
+		Obstacle o;
+		o.type = OT_SPHERE;
+		o.center = center;
+		o.radius = radius;
+		o.box = core::aabbox3df(center - core::vector3df(radius, radius, radius), center + core::vector3df(radius, radius, radius));
+		obstacles.push_back(o);
+		insertObstacle((int)obstacles.size() - 1);
+		return (int)obstacles.size() - 1;
+	}
+
+	int addBox(const core::aabbox3df& box) {
+		Obstacle o;
+		o.type = OT_BOX;
+		o.box = box;
+		o.center = box.getCenter();
+		o.radius = box.getExtent().getLength() / 2;
+		obstacles.push_back(o);
+		insertObstacle((int)obstacles.size() - 1);
+		return (int)obstacles.size() - 1;
+	}
+
+	int getNumObstacles() {
+		return (int)obstacles.size();
+	}
+
+	const Obstacle& getObstacle(int i) {
+		return obstacles[i];
+	}
+
+	int getNumVehicles() {
+		return (int)vehicles.size();
+	}
+
+	Quadrotor* getVehicle(int i) {
+		return vehicles[i].quadrotor;
+	}
+
+	// Relinks the vehicles that changed cells and collects all contacts; call after moving the vehicles
+	void update() {
+		PROFILE_SCOPE("collisions");
+		contacts.clear();
+		relinked = 0;
+		pairsTested = 0;
+		for (size_t i = 0; i < vehicles.size(); ++i) {
+			s64 cell = getCell(vehicles[i].quadrotor->getPosition());
+			if (cell != vehicles[i].cell) {
+				unlink((int)i);
+				link((int)i, cell);
+				relinked++;
+			}
+		}
+
+		for (int a = 0; a < (int)vehicles.size(); ++a) {
+			core::vector3df pos = vehicles[a].quadrotor->getPosition();
+			int cx = toCell(pos.X), cy = toCell(pos.Y), cz = toCell(pos.Z);
+			for (int dx = -1; dx <= 1; ++dx)
+				for (int dy = -1; dy <= 1; ++dy)
+					for (int dz = -1; dz <= 1; ++dz) {
+						s64 cell = packCell(cx + dx, cy + dy, cz + dz);
+						// Every pair once, from its lower index; other cells may share the bucket
+						for (int b = buckets[getBucket(cell)]; b >= 0; b = vehicles[b].next)
+							if (b > a && vehicles[b].cell == cell)
+								testVehicles(a, b);
+					}
+
+			if (obstacles.empty())
+				continue;
+			stamp++;
+			float r = vehicles[a].radius;
+			int x0 = (int)floorf((pos.X - r) * invStaticCellSize), x1 = (int)floorf((pos.X + r) * invStaticCellSize);
+			int y0 = (int)floorf((pos.Y - r) * invStaticCellSize), y1 = (int)floorf((pos.Y + r) * invStaticCellSize);
+			int z0 = (int)floorf((pos.Z - r) * invStaticCellSize), z1 = (int)floorf((pos.Z + r) * invStaticCellSize);
+			for (int x = x0; x <= x1; ++x)
+				for (int y = y0; y <= y1; ++y)
+					for (int z = z0; z <= z1; ++z) {
+						std::unordered_map<s64, std::vector<int> >::const_iterator it = staticCells.find(packCell(x, y, z));
+						if (it == staticCells.end())
+							continue;
+						for (size_t k = 0; k < it->second.size(); ++k) {
+							int o = it->second[k];
+							if (obstacleStamps[o] == stamp)
+								continue;
+							obstacleStamps[o] = stamp;
+							testObstacle(a, o);
+						}
+					}
+		}
+	}
+
+	// Pushes the vehicles apart and removes the approaching part of their velocity.
+	// restitution 0 stops the vehicles along the contact normal, 1 bounces them off elastically.
+	void resolve(float restitution = 0.3f) {
+		for (size_t i = 0; i < contacts.size(); ++i) {
+			const Contact& c = contacts[i];
+			Quadrotor* a = vehicles[c.vehicle].quadrotor;
+			if (c.withObstacle) {
+				a->setPosition(a->getPosition() + c.normal * c.depth);
+				core::vector3df speed = a->getSpeed();
+				float approach = speed.dotProduct(c.normal);
+				if (approach < 0)
+					a->setSpeed(speed - c.normal * (approach * (1 + restitution)));
+				a->updateAbsolutePosition();
+				continue;
+			}
+			// Equal masses: both take half of the correction and of the impulse
+			Quadrotor* b = vehicles[c.other].quadrotor;
+			a->setPosition(a->getPosition() + c.normal * (c.depth / 2));
+			b->setPosition(b->getPosition() - c.normal * (c.depth / 2));
+			float approach = (a->getSpeed() - b->getSpeed()).dotProduct(c.normal);
+			if (approach < 0) {
+				core::vector3df impulse = c.normal * (approach * (1 + restitution) / 2);
+				a->setSpeed(a->getSpeed() - impulse);
+				b->setSpeed(b->getSpeed() + impulse);
+			}
+			a->updateAbsolutePosition();
+			b->updateAbsolutePosition();
+		}
+	}
+
+	const std::vector<Contact>& getContacts() {
+		return contacts;
+	}
+
+	// Vehicles that changed their cell in the last update
+	u32 getRelinked() {
+		return relinked;
+	}
+
+	u32 getPairsTested() {
+		return pairsTested;
+	}
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include "Airframe.h"
+
+// Distributes thrust, roll, pitch and yaw commands to the motors of an airframe within the motor
+// range of -1 to 1. If the plain mix fits, it is used as is. Otherwise the commands are given up in
+// order of importance: roll and pitch are scaled down only if they alone exceed the range, yaw is
+// scaled to what the remaining range allows, and the thrust is moved as close to the wanted one as
+// the attitude commands leave room for. Keeping attitude authority at the cost of height is what
+// keeps a saturated vehicle upright.
+// The allocator has no state, no allocations and a fixed number of iterations, so it costs the same
+// for every vehicle and step; the mixing matrix is built at compile time.
+template <class Airframe>
+struct ControlAllocator {
+	enum { MOTORS = Airframe::MOTORS, YAW_ITERATIONS = 10 };
+
+	// Writes MOTORS speeds; returns false if the commands had to be reduced
+	static bool allocate(float thrust, float roll, float pitch, float yaw, float* out) {
+		constexpr SMatrix<float, Airframe::MOTORS, 4> mixer = makeMixer<Airframe>();
+		float attitude[MOTORS], yawShare[MOTORS];
+		bool saturated = false;
+		for (int i = 0; i < MOTORS; ++i) {
+			attitude[i] = mixer(i, 1) * roll + mixer(i, 2) * pitch;
+			yawShare[i] = mixer(i, 3) * yaw;
+			out[i] = mixer(i, 0) * thrust + attitude[i] + yawShare[i];
+			saturated |= out[i] < -1.f || out[i] > 1.f;
+		}
+		if (!saturated)
+			return true;
+
+		// Roll and pitch alone: shrink them until their spread fits into the range
+		float low, high;
+		getSpread(attitude, low, high);
+		float yawScale = 1.f;
+		if (high - low > 2.f) {
+			float scale = 2.f / (high - low);
+			for (int i = 0; i < MOTORS; ++i)
+				attitude[i] *= scale;
+			yawScale = 0.f;
+		}
+		else {
+			// The spread grows monotonically with the yaw share; bisect for the largest one that fits
+			float with[MOTORS];
+			for (int i = 0; i < MOTORS; ++i)
+				with[i] = attitude[i] + yawShare[i];
+			getSpread(with, low, high);
+			if (high - low > 2.f) {
+				float lower = 0.f, upper = 1.f;
+				for (int n = 0; n < YAW_ITERATIONS; ++n) {
+					float mid = (lower + upper) / 2;
+					for (int i = 0; i < MOTORS; ++i)
+						with[i] = attitude[i] + mid * yawShare[i];
+					getSpread(with, low, high);
+					if (high - low > 2.f)
+						upper = mid;
+					else
+						lower = mid;
+				}
+				yawScale = lower;
+			}
+		}
+		for (int i = 0; i < MOTORS; ++i)
+			attitude[i] += yawScale * yawShare[i];
+
+		// Thrust as close to the command as the attitude part allows; the mixer's thrust column is all ones
+		getSpread(attitude, low, high);
+		float fittedThrust = core::clamp(thrust, -1.f - low, 1.f - high);
+		for (int i = 0; i < MOTORS; ++i)
+			out[i] = core::clamp(fittedThrust + attitude[i], -1.f, 1.f);
+		return false;
+	}
+
+private:
+	static void getSpread(const float* values, float& low, float& high) {
+		low = high = values[0];
+		for (int i = 1; i < MOTORS; ++i) {
+			low = core::min_(low, values[i]);
+			high = core::max_(high, values[i]);
+		}
+	}
+};
@@ -0,0 +1,272 @@
+#pragma once
+#include <irrlicht.h>
+#include <cmath>
+#include "SmallMatrix.h"
+#include "StateProvider.h"
+
+using namespace irr;
+
+#define _METER *100
+
+// Error-state extended Kalman filter for position, velocity, attitude and the accelerometer and
+// gyroscope biases. The nominal state is propagated with the IMU; the filter keeps the covariance of
+// a 15 element error [position, velocity, attitude, accelerometer bias, gyroscope bias], where the
+// attitude error is a small rotation in body axes. Position fixes correct the error, which is then
+// folded into the nominal state.
+// Everything is fixed-size and by value, so a filter is a plain 1 KB object that can be kept in
+// arrays for many vehicles and does not allocate. The prediction applies the transition matrix as
+// its 3x3 blocks instead of multiplying 15x15 matrices, and position fixes are processed one axis
+// at a time, which needs neither a gain matrix nor an inversion.
+class ErrorStateEkf {
+public:
+	enum { POSITION = 0, VELOCITY = 3, ATTITUDE = 6, ACCEL_BIAS = 9, GYRO_BIAS = 12, STATES = 15 };
+	typedef SMatrix<float, STATES, STATES> Covariance;
+
+	// Standard deviations of the IMU: noise per sample, bias drift per square root of a second
+	struct Noise {
+		float accel = 0.05f _METER;		  // cm/s^2
+		float gyro = 0.3f * core::DEGTORAD; // rad/s
+		float accelBiasDrift = 0.002f _METER;
+		float gyroBiasDrift = 0.01f * core::DEGTORAD;
+	};
+
+private:
+	SVector3f position = SVector3f::zero();
+	SVector3f velocity = SVector3f::zero();
+	SMatrix3f orientation = SMatrix3f::identity(); // body to world
+	SVector3f accelBias = SVector3f::zero();
+	SVector3f gyroBias = SVector3f::zero();
+	Covariance covariance = Covariance::zero();
+	Noise noise;
+	float gravity = 9.81f _METER;
+
+	// Rows first..first+2 of m become rows of m plus factor times the rows from other..other+2
+	static void addRows(Covariance& m, int first, int other, float factor) {
+		for (int r = 0; r < 3; ++r)
+			for (int c = 0; c < STATES; ++c)
+				m(first + r, c) += factor * m(other + r, c);
+	}
+
+	// Left multiplication by the transition matrix F, exploiting its block structure:
+	//   position  = I dp + dt dv
+	//   velocity  = dv + A dtheta + B dba          A = -R [a]x dt, B = -R dt
+	//   attitude  = C dtheta - dt dbg              C = Exp(-w dt)
+	//   biases unchanged
+	static void applyTransition(Covariance& m, const SMatrix3f& A, const SMatrix3f& B, const SMatrix3f& C, float dt) {
+		addRows(m, POSITION, VELOCITY, dt);
+		for (int c = 0; c < STATES; ++c) {
+			float theta[3], accel[3];
+			for (int k = 0; k < 3; ++k) {
+				theta[k] = m(ATTITUDE + k, c);
+				accel[k] = m(ACCEL_BIAS + k, c);
+			}
+			for (int r = 0; r < 3; ++r) {
+				m(VELOCITY + r, c) += A(r, 0) * theta[0] + A(r, 1) * theta[1] + A(r, 2) * theta[2]
+					+ B(r, 0) * accel[0] + B(r, 1) * accel[1] + B(r, 2) * accel[2];
+				m(ATTITUDE + r, c) = C(r, 0) * theta[0] + C(r, 1) * theta[1] + C(r, 2) * theta[2]
+					- dt * m(GYRO_BIAS + r, c);
+			}
+		}
+	}
+
+	static void transposeInPlace(Covariance& m) {
+		for (int r = 0; r < STATES; ++r)
+			for (int c = r + 1; c < STATES; ++c) {
+				float t = m(r, c);
+				m(r, c) = m(c, r);
+				m(c, r) = t;
+			}
+	}
+
+public:
+	ErrorStateEkf() {}
+
+	// Starts over at a known position and orientation at rest; the standard deviations give the initial
+	// uncertainty, the velocity's is the position's per second
+	void reset(const SVector3f& position, const SMatrix3f& orientation, float positionSigma = 1 _METER,
+		float attitudeSigma = 5 * core::DEGTORAD, float accelBiasSigma = 0.2f _METER, float gyroBiasSigma = 1 * core::DEGTORAD) {
+		this->position = position;
+		this->orientation = orientation;
+		velocity = accelBias = gyroBias = SVector3f::zero();
+		covariance = Covariance::zero();
+		for (int i = 0; i < 3; ++i) {
+			covariance(POSITION + i, POSITION + i) = positionSigma * positionSigma;
+			covariance(VELOCITY + i, VELOCITY + i) = positionSigma * positionSigma;
+			covariance(ATTITUDE + i, ATTITUDE + i) = attitudeSigma * attitudeSigma;
+			covariance(ACCEL_BIAS + i, ACCEL_BIAS + i) = accelBiasSigma * accelBiasSigma;
+			covariance(GYRO_BIAS + i, GYRO_BIAS + i) = gyroBiasSigma * gyroBiasSigma;
+		}
+	}
+
+	void setNoise(const Noise& noise) {
+		this->noise = noise;
+	}
+
+	void setGravity(float gravity) {
+		this->gravity = gravity;
+	}
+
+	// One IMU sample: specific force in cm/s^2 and rotation speed in rad/s, both in body axes
+	void predict(const SVector3f& specificForce, const SVector3f& angularSpeed, float dt) {
+		SVector3f a = specificForce - accelBias;
+		SVector3f w = angularSpeed - gyroBias;
+
+		// Nominal state
+		SVector3f acceleration = orientation * a;
+		acceleration[1] -= gravity;
+		position += velocity * dt + acceleration * (dt * dt / 2);
+		velocity += acceleration * dt;
+		SMatrix3f step = rotationFromVector(w * dt);
+		SMatrix3f R = orientation;
+		orientation = orientation * step;
+
+		// Covariance: F P F^T = F (F P)^T, because the result is symmetric
+		SMatrix3f skew = { { 0, -a[2], a[1], a[2], 0, -a[0], -a[1], a[0], 0 } };
+		SMatrix3f A = R * skew * -dt;
+		SMatrix3f B = R * -dt;
+		SMatrix3f C = step.transposed();
+		applyTransition(covariance, A, B, C, dt);
+		transposeInPlace(covariance);
+		applyTransition(covariance, A, B, C, dt);
+
+		float velocityNoise = noise.accel * dt, attitudeNoise = noise.gyro * dt;
+		for (int i = 0; i < 3; ++i) {
+			covariance(VELOCITY + i, VELOCITY + i) += velocityNoise * velocityNoise;
+			covariance(ATTITUDE + i, ATTITUDE + i) += attitudeNoise * attitudeNoise;
+			covariance(ACCEL_BIAS + i, ACCEL_BIAS + i) += noise.accelBiasDrift * noise.accelBiasDrift * dt;
+			covariance(GYRO_BIAS + i, GYRO_BIAS + i) += noise.gyroBiasDrift * noise.gyroBiasDrift * dt;
+		}
+	}
+
+	// A measurement of one position axis (0 X, 1 Y, 2 Z) with the given variance
+	void updatePosition(int axis, float measured, float variance) {
+		int j = POSITION + axis;
+		float innovation = measured - position[axis];
+		float invS = 1 / (covariance(j, j) + variance);
+
+		// K = P(:, j) / S, error = K * innovation, P -= K P(j, :)
+		float gain[STATES], row[STATES];
+		for (int i = 0; i < STATES; ++i) {
+			row[i] = covariance(j, i);
+			gain[i] = row[i] * invS;
+		}
+		for (int r = 0; r < STATES; ++r)
+			for (int c = 0; c < STATES; ++c)
+				covariance(r, c) -= gain[r] * row[c];
+		inject(gain, innovation);
+	}
+
+	// A full position fix, one axis after the other
+	void updatePosition(const SVector3f& measured, float variance) {
+		for (int axis = 0; axis < 3; ++axis)
+			updatePosition(axis, measured[axis], variance);
+	}
+
+	const SVector3f& getPosition() const {
+		return position;
+	}
+
+	const SVector3f& getVelocity() const {
+		return velocity;
+	}
+
+	const SMatrix3f& getOrientation() const {
+		return orientation;
+	}
+
+	const SVector3f& getAccelBias() const {
+		return accelBias;
+	}
+
+	const SVector3f& getGyroBias() const {
+		return gyroBias;
+	}
+
+	const Covariance& getCovariance() const {
+		return covariance;
+	}
+
+private:
+	// Folds the estimated error into the nominal state; the error is zero again afterwards
+	void inject(const float* gain, float innovation) {
+		for (int i = 0; i < 3; ++i) {
+			position[i] += gain[POSITION + i] * innovation;
+			velocity[i] += gain[VELOCITY + i] * innovation;
+			accelBias[i] += gain[ACCEL_BIAS + i] * innovation;
+			gyroBias[i] += gain[GYRO_BIAS + i] * innovation;
+		}
+		SVector3f theta = makeVector(gain[ATTITUDE], gain[ATTITUDE + 1], gain[ATTITUDE + 2]) * innovation;
+		orientation = orientation * rotationFromVector(theta);
+		orthonormalize(orientation);
+	}
+};
+
+// Runs an ErrorStateEkf on a SensorSuite: a prediction for every new IMU sample, corrections for
+// every new barometer and GPS sample. The delays of the sensors are not compensated, and without a
+// magnetometer the yaw is only observable while the vehicle accelerates.
+class EkfStateProvider : public StateProvider {
+private:
+	const SensorSuite* sensors;
+	ErrorStateEkf filter;
+	s64 lastImuTime = -1, lastBarometerTime = -1, lastGpsTime = -1; // clock ticks of the samples used last
+	core::vector3df rotation;
+	bool initialized = false;
+
+public:
+	EkfStateProvider(const SensorSuite* sensors, float gravity = 9.81f _METER) : sensors(sensors) {
+		filter.setGravity(gravity);
+	}
+
+	const ErrorStateEkf& getFilter() const {
+		return filter;
+	}
+
+	virtual void update(float elapsedTime) {
+		const Sensor& accelerometer = sensors->getAccelerometer();
+		const Sensor& gyroscope = sensors->getGyroscope();
+		const Sensor& barometer = sensors->getBarometer();
+		const Sensor& gps = sensors->getGps();
+		// Starts at the first fix, level and pointing along X
+		if (!initialized) {
+			if (!accelerometer.isValid() || !gyroscope.isValid() || !barometer.isValid() || !gps.isValid())
+				return;
+			core::vector3df start = gps.getValue();
+			start.Y = barometer.getValue().Y;
+			filter.reset(toSVector(start), SMatrix3f::identity());
+			lastImuTime = gyroscope.getTime();
+			lastBarometerTime = barometer.getTime();
+			lastGpsTime = gps.getTime();
+			initialized = true;
+			return;
+		}
+
+		if (gyroscope.getTime() != lastImuTime) {
+			filter.predict(toSVector(accelerometer.getValue()), toSVector(gyroscope.getValue()) * core::DEGTORAD,
+				sensors->toSeconds(gyroscope.getTime() - lastImuTime));
+			lastImuTime = gyroscope.getTime();
+		}
+		if (barometer.getTime() != lastBarometerTime) {
+			float sigma = barometer.getSpec().noise;
+			filter.updatePosition(1, barometer.getValue().Y, sigma * sigma);
+			lastBarometerTime = barometer.getTime();
+		}
+		if (gps.getTime() != lastGpsTime) {
+			float sigma = gps.getSpec().noise;
+			filter.updatePosition(toSVector(gps.getValue()), sigma * sigma);
+			lastGpsTime = gps.getTime();
+		}
+		continueEulerAngles(rotation, filter.getOrientation());
+	}
+
+	virtual core::vector3df getPosition() {
+		return toVector(filter.getPosition());
+	}
+
+	virtual core::vector3df getSpeed() {
+		return toVector(filter.getVelocity());
+	}
+
+	virtual core::vector3df getRotation() {
+		return rotation;
+	}
+};
@@ -0,0 +1,342 @@
+#pragma once
+#include <irrlicht.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "Profiler.h"
+
+using namespace irr;
+
+#ifdef _MSC_VER
+#define popen _popen
+#define pclose _pclose
+#endif
+
+// Writes an RGB24 image as PNG. The image data is stored uncompressed (deflate "stored" blocks),
+// which needs no zlib and costs little more than the file write itself.
+class PngWriter {
+private:
+	u32 crcTable[256];
+	std::vector<u8> raw, idat;
+
+	static void putU32(std::vector<u8>& out, u32 v) {
+		out.push_back((u8)(v >> 24));
+		out.push_back((u8)(v >> 16));
+		out.push_back((u8)(v >> 8));
+		out.push_back((u8)v);
+	}
+
+	u32 crc(const u8* data, size_t len, u32 c = 0xffffffff) {
+		for (size_t i = 0; i < len; ++i)
+			c = crcTable[(c ^ data[i]) & 0xff] ^ (c >> 8);
+		return c;
+	}
+
+	bool writeChunk(FILE* file, const char* type, const std::vector<u8>& data) {
+		std::vector<u8> header;
+		putU32(header, (u32)data.size());
+		header.insert(header.end(), type, type + 4);
+		u32 c = crc(&header[4], 4);
+		if (data.size() > 0)
+			c = crc(data.data(), data.size(), c);
+		std::vector<u8> footer;
+		putU32(footer, c ^ 0xffffffff);
+		return fwrite(header.data(), 1, header.size(), file) == header.size() &&
+			(data.size() == 0 || fwrite(data.data(), 1, data.size(), file) == data.size()) &&
+			fwrite(footer.data(), 1, footer.size(), file) == footer.size();
+	}
+
+public:
+	PngWriter() {
+		for (u32 n = 0; n < 256; ++n) {
+			u32 c = n;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			crcTable[n] = c;
+		}
+	}
+
+	bool write(const char* fileName, const u8* rgb, u32 width, u32 height) {
+		FILE* file = fopen(fileName, "wb");
+		if (file == NULL)
+			return false;
+		static const u8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		bool ok = fwrite(signature, 1, 8, file) == 8;
+
+		std::vector<u8> ihdr;
+		putU32(ihdr, width);
+		putU32(ihdr, height);
+		ihdr.push_back(8); // bit depth
+		ihdr.push_back(2); // color type RGB
+		ihdr.push_back(0); // compression
+		ihdr.push_back(0); // filter
+		ihdr.push_back(0); // no interlace
+		ok = ok && writeChunk(file, "IHDR", ihdr);
+
+		// Rows prefixed with filter type 0
+		u32 rowSize = 3 * width + 1;
+		raw.resize((size_t)rowSize * height);
+		for (u32 y = 0; y < height; ++y) {
+			raw[(size_t)rowSize * y] = 0;
+			memcpy(&raw[(size_t)rowSize * y + 1], rgb + (size_t)3 * width * y, 3 * width);
+		}
+		u32 adlerA = 1, adlerB = 0;
+		for (size_t i = 0; i < raw.size(); ++i) {
+			adlerA += raw[i];
+			adlerB += adlerA;
+			// Reduce well before adlerB can overflow
+			if ((i & 4095) == 4095) {
+				adlerA %= 65521;
+				adlerB %= 65521;
+			}
+		}
+		adlerA %= 65521;
+		adlerB %= 65521;
+
+		// zlib stream made of stored blocks
+		idat.clear();
+		idat.push_back(0x78);
+		idat.push_back(0x01);
+		for (size_t done = 0; done < raw.size();) {
+			u32 blockSize = (u32)core::min_(raw.size() - done, (size_t)65535);
+			idat.push_back(done + blockSize == raw.size() ? 1 : 0);
+			idat.push_back((u8)blockSize);
+			idat.push_back((u8)(blockSize >> 8));
+			idat.push_back((u8)~blockSize);
+			idat.push_back((u8)(~blockSize >> 8));
+			idat.insert(idat.end(), raw.begin() + done, raw.begin() + done + blockSize);
+			done += blockSize;
+		}
+		putU32(idat, (adlerB << 16) | adlerA);
+		ok = ok && writeChunk(file, "IDAT", idat);
+		ok = ok && writeChunk(file, "IEND", std::vector<u8>());
+		return fclose(file) == 0 && ok;
+	}
+};
+
+
+// Converts a locked surface to RGB24 rows of rgbSize from top to bottom; flipY for bottom-up surfaces
+inline void convertToRgb24(const void* data, video::ECOLOR_FORMAT format, u32 pitch, core::dimension2d<u32> srcSize,
+	bool flipY, u8* rgb, core::dimension2d<u32> rgbSize) {
+	u32 w = core::min_(srcSize.Width, rgbSize.Width), h = core::min_(srcSize.Height, rgbSize.Height);
+	for (u32 y = 0; y < h; ++y) {
+		const u8* row = (const u8*)data + pitch * (flipY ? srcSize.Height - 1 - y : y);
+		u8* out = rgb + 3 * rgbSize.Width * y;
+		for (u32 x = 0; x < w; ++x, out += 3) {
+			u32 argb;
+			switch (format) {
+			case video::ECF_A8R8G8B8:
+				argb = ((const u32*)row)[x];
+				break;
+			case video::ECF_A1R5G5B5:
+				argb = video::A1R5G5B5toA8R8G8B8(((const u16*)row)[x]);
+				break;
+			case video::ECF_R5G6B5:
+				argb = video::R5G6B5toA8R8G8B8(((const u16*)row)[x]);
+				break;
+			case video::ECF_R8G8B8:
+				argb = (row[3 * x] << 16) | (row[3 * x + 1] << 8) | row[3 * x + 2];
+				break;
+			default:
+				argb = 0;
+			}
+			out[0] = (u8)(argb >> 16);
+			out[1] = (u8)(argb >> 8);
+			out[2] = (u8)argb;
+		}
+	}
+}
+
+// Renders frames into an offscreen render target and hands them to a worker thread that writes
+// a PNG sequence or pipes raw RGB24 frames into an encoder process.
+// The output is either a file name pattern with one integer conversion ("frames/frame_%05d.png")
+// or a command prefixed with '|' that reads raw frames from stdin, e.g.
+// "|ffmpeg -y -f rawvideo -pix_fmt rgb24 -s 1366x740 -r 25 -i - out.mp4".
+// The simulation thread only copies the pixels; it waits for the writer only when all
+// queueLength frame buffers are still pending, so no frame is ever dropped.
+class FrameCapture {
+private:
+	struct Frame {
+		std::vector<u8> rgb;
+		u32 index;
+	};
+
+	video::ITexture* target = NULL;
+	core::dimension2d<u32> size;
+	bool flipY;
+
+	std::string output;
+	FILE* pipe = NULL;
+	PngWriter png;
+	std::atomic<bool> failed;
+
+	std::vector<Frame*> frames;
+	std::vector<Frame*> freeFrames;
+	std::deque<Frame*> pendingFrames;
+	std::mutex mutex;
+	std::condition_variable frameQueued, frameWritten;
+	bool stopping = false;
+	std::thread worker;
+
+	u32 frameCount = 0;
+	u32 stalls = 0;
+
+	void writeFrame(Frame* frame) {
+		if (failed)
+			return;
+		if (pipe != NULL) {
+			if (fwrite(frame->rgb.data(), 1, frame->rgb.size(), pipe) != frame->rgb.size()) {
+				printf("FrameCapture: encoder pipe closed at frame %u\n", frame->index);
+				failed = true;
+			}
+			return;
+		}
+		char fileName[1024];
+		snprintf(fileName, sizeof(fileName), output.c_str(), frame->index);
+		if (!png.write(fileName, frame->rgb.data(), size.Width, size.Height)) {
+			printf("FrameCapture: could not write %s\n", fileName);
+			failed = true;
+		}
+	}
+
+	void run() {
+		Profiler::get().setThreadName("capture writer");
+		for (;;) {
+			Frame* frame;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				frameQueued.wait(lock, [this] { return stopping || !pendingFrames.empty(); });
+				if (pendingFrames.empty())
+					return;
+				frame = pendingFrames.front();
+				pendingFrames.pop_front();
+			}
+			{
+				PROFILE_SCOPE("write frame");
+				writeFrame(frame);
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				freeFrames.push_back(frame);
+			}
+			frameWritten.notify_one();
+		}
+	}
+
+	void convert(const void* data, video::ECOLOR_FORMAT format, u32 pitch, core::dimension2d<u32> srcSize, u8* rgb) {
+		convertToRgb24(data, format, pitch, srcSize, flipY, rgb, size);
+	}
+
+public:
+	FrameCapture(video::IVideoDriver* driver, core::dimension2d<u32> size, const char* output, int queueLength = 8) {
+		this->size = size;
+		this->output = output;
+		failed = false;
+		// OpenGL render targets are stored bottom-up
+		flipY = driver->getDriverType() == video::EDT_OPENGL;
+		if (driver->queryFeature(video::EVDF_RENDER_TO_TARGET))
+			target = driver->addRenderTargetTexture(size, "FrameCapture", video::ECF_A8R8G8B8);
+		if (target == NULL)
+			printf("FrameCapture: no render target support, capturing the back buffer\n");
+
+		if (output[0] == '|') {
+#ifdef _MSC_VER
+			pipe = popen(output + 1, "wb");
+#else
+			pipe = popen(output + 1, "w");
+#endif
+			if (pipe == NULL) {
+				printf("FrameCapture: could not start %s\n", output + 1);
+				failed = true;
+			}
+		}
+
+		for (int i = 0; i < queueLength; ++i) {
+			frames.push_back(new Frame());
+			frames.back()->rgb.resize(3 * size.Width * size.Height);
+			freeFrames.push_back(frames.back());
+		}
+		worker = std::thread(&FrameCapture::run, this);
+	}
+
+	// Writes all pending frames before returning
+	~FrameCapture() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		frameQueued.notify_one();
+		worker.join();
+		if (pipe != NULL)
+			pclose(pipe);
+		for (size_t i = 0; i < frames.size(); ++i)
+			delete frames[i];
+	}
+
+	// Call after beginScene; everything drawn until end() goes into the captured frame
+	void begin(video::IVideoDriver* driver, video::SColor clearColor = video::SColor(255, 0, 0, 0)) {
+		if (target != NULL)
+			driver->setRenderTarget(target, true, true, clearColor);
+	}
+
+	// Call before endScene; copies the frame and queues it for writing
+	void end(video::IVideoDriver* driver) {
+		Frame* frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (freeFrames.empty()) {
+				++stalls;
+				frameWritten.wait(lock, [this] { return !freeFrames.empty(); });
+			}
+			frame = freeFrames.back();
+			freeFrames.pop_back();
+		}
+
+		if (target != NULL) {
+			driver->setRenderTarget(0, false, false);
+			const void* data = target->lock(video::ETLM_READ_ONLY);
+			if (data != NULL)
+				convert(data, target->getColorFormat(), target->getPitch(), target->getSize(), frame->rgb.data());
+			target->unlock();
+		}
+		else {
+			video::IImage* shot = driver->createScreenShot();
+			if (shot != NULL) {
+				convert(shot->lock(), shot->getColorFormat(), shot->getPitch(), shot->getDimension(), frame->rgb.data());
+				shot->unlock();
+				shot->drop();
+			}
+		}
+
+		frame->index = frameCount++;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pendingFrames.push_back(frame);
+		}
+		frameQueued.notify_one();
+	}
+
+	// The captured image, for showing it on screen when a window exists
+	video::ITexture* getTexture() {
+		return target;
+	}
+
+	u32 getFrameCount() {
+		return frameCount;
+	}
+
+	// Number of frames for which the simulation had to wait for the writer
+	u32 getStalls() {
+		return stalls;
+	}
+
+	bool hasFailed() {
+		return failed;
+	}
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include <irrlicht.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "RingBuffer.h"
+
+using namespace irr;
+
+// Caps the frame rate on std::chrono::steady_clock.
+// The wait sleeps until shortly before the deadline and spins for the rest, because sleeps
+// can overshoot by a scheduler tick. The spin margin follows the measured oversleep.
+// Frames that end after their deadline are counted as overruns; the next deadline is
+// then measured from now instead of trying to catch up.
+class FramePacer {
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::duration period;
+	Clock::time_point deadline, lastFrame;
+	bool started = false;
+
+	double spinMarginMs = 1.0; // running estimate of how much a sleep overshoots
+	const double minSpinMarginMs = 0.2;
+
+	u32 frameCount = 0;
+	u32 overruns = 0;
+	RingBuffer<float> frameTimesMs;
+	std::vector<float> sorted;
+
+	static double toMs(Clock::duration d) {
+		return std::chrono::duration<double, std::milli>(d).count();
+	}
+
+public:
+	// historyLength is the number of frame times the percentiles are computed from
+	FramePacer(float targetFps, int historyLength = 1000) : frameTimesMs(historyLength) {
+		setTargetFps(targetFps);
+		sorted.reserve(historyLength);
+	}
+
+	void setTargetFps(float targetFps) {
+		period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps));
+	}
+
+	// Blocks until the end of the current frame period; call once per frame
+	void wait() {
+		Clock::time_point now = Clock::now();
+		if (!started) {
+			started = true;
+			deadline = now + period;
+			lastFrame = now;
+			return;
+		}
+
+		if (now > deadline) {
+			overruns++;
+			deadline = now;
+		}
+		else {
+			Clock::duration remaining = deadline - now;
+			double sleepMs = toMs(remaining) - spinMarginMs;
+			if (sleepMs > 0) {
+				Clock::time_point sleepEnd = now + std::chrono::duration_cast<Clock::duration>(
+					std::chrono::duration<double, std::milli>(sleepMs));
+				std::this_thread::sleep_for(sleepEnd - now);
+				// Adapt the margin to the oversleep of this platform
+				double overshootMs = toMs(Clock::now() - sleepEnd);
+				spinMarginMs = core::max_(spinMarginMs * 0.9 + overshootMs * 2 * 0.1, minSpinMarginMs);
+			}
+			while (Clock::now() < deadline)
+				std::this_thread::yield();
+		}
+
+		now = Clock::now();
+		frameTimesMs.push((float)toMs(now - lastFrame));
+		frameCount++;
+		lastFrame = now;
+		deadline += period;
+	}
+
+	// Frame time in ms below which the given fraction (0..1) of the recent frames lie
+	float getPercentile(float p) {
+		int n = frameTimesMs.getNumElements();
+		if (n == 0)
+			return 0.f;
+		sorted.clear();
+		for (int i = 0; i < n; ++i)
+			sorted.push_back(frameTimesMs.at(i));
+		int k = core::clamp((int)(p * (n - 1) + 0.5f), 0, n - 1);
+		std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+		return sorted[k];
+	}
+
+	float getMedian() {
+		return getPercentile(0.5f);
+	}
+
+	float getMax() {
+		return getPercentile(1.f);
+	}
+
+	float getLastFrameTime() {
+		return frameTimesMs.getNumElements() > 0 ? frameTimesMs.last() : 0.f;
+	}
+
+	u32 getFrameCount() {
+		return frameCount;
+	}
+
+	// Number of frames that took longer than the target period
+	u32 getOverruns() {
+		return overruns;
+	}
+};
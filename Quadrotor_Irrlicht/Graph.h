@@ -1,9 +1,16 @@
 #pragma once
 #include <irrlicht.h>
-#include "RingBuffer.h"
+#include <vector>
+#include "MinMaxPyramid.h"
+#include "SimulationClock.h"
+#include "HudText.h"
 
 using namespace irr;
 
+enum GraphDecimation {
+	GD_MINMAX, // min/max envelope per pixel column
+	GD_LTTB	   // Largest-Triangle-Three-Buckets downsampling of the bucket means
+};
 
 class Graph
 {
@@ -14,13 +21,124 @@ class Graph
 
 	int width, height;
 	int bufSize, numBuffers;
-	RingBuffer<core::vector2df>** buffers;
-	int nextIdx = 0, numElements = 0;
+	MinMaxPyramid** buffers;
 	float maxVal, minVal;
 	gui::IGUIFont* font;
+	HudText* hud = NULL;
+	int hudValueLine = -1;
+	const u32 fontLineOffset = 17;
+
+	// x values are stored as seconds relative to epoch, which slides forward when they grow too large for f32
+	s64 epoch = 0;
+	s64 ticksPerSecond = SIM_TICKS_PER_SECOND;
+	float rebaseSeconds = 1024.f;
+
+	GraphDecimation decimation = GD_MINMAX;
+	// LTTB picks from up to this many buckets per output point
+	const int lttbOversampling = 4;
+	std::vector<core::vector2df> lttbInput, lttbOutput;
+
+	core::vector2d<s32> toScreen(float x, float y, float startVal, float xSpan) {
+		return core::vector2d<s32>((s32)((x - startVal) / xSpan * width) + pos.UpperLeftCorner.X,
+			pos.LowerRightCorner.Y - (s32)((y - minVal) / (maxVal - minVal) * height));
+	}
+
+	void drawClipped(video::IVideoDriver* driver, core::vector2d<s32> startPos, core::vector2d<s32> endPos,
+		video::SColor color) {
+		if (pos.isPointInside(startPos) && pos.isPointInside(endPos))
+			driver->draw2DLine(startPos, endPos, color);
+	}
+
+	// Draws one bucket per pixel column: a vertical line spanning min and max of the bucket,
+	// connected to the neighbouring buckets by their first and last samples.
+	void renderMinMax(video::IVideoDriver* driver, MinMaxPyramid* buffer, float startVal, float xSpan,
+		video::SColor color) {
+		int level = buffer->findLevel(width);
+		int numVals = buffer->getNumElements(level);
+		bool hasPrev = false;
+		core::vector2d<s32> prevPos;
+		for (int idx = 0; idx <= numVals; ++idx) {
+			GraphBucket bucket = (idx < numVals) ? buffer->get(level, idx) : buffer->getTail(level);
+			if (bucket.count == 0 || bucket.xLast < startVal)
+				continue;
+			core::vector2d<s32> firstPos = toScreen(bucket.xFirst, bucket.yFirst, startVal, xSpan);
+			if (hasPrev)
+				drawClipped(driver, prevPos, firstPos, color);
+			if (bucket.count > 1) {
+				s32 x = toScreen(bucket.getMean().X, 0, startVal, xSpan).X;
+				s32 yTop = toScreen(0, bucket.yMax, startVal, xSpan).Y;
+				s32 yBottom = toScreen(0, bucket.yMin, startVal, xSpan).Y;
+				yTop = core::clamp(yTop, pos.UpperLeftCorner.Y, pos.LowerRightCorner.Y);
+				yBottom = core::clamp(yBottom, pos.UpperLeftCorner.Y, pos.LowerRightCorner.Y);
+				if (yTop != yBottom)
+					drawClipped(driver, core::vector2d<s32>(x, yTop), core::vector2d<s32>(x, yBottom), color);
+			}
+			prevPos = toScreen(bucket.xLast, bucket.yLast, startVal, xSpan);
+			hasPrev = true;
+		}
+	}
+
+	// Downsamples the bucket means of a level with at most lttbOversampling * width buckets
+	// to about width points, keeping the points that span the largest triangles.
+	void renderLTTB(video::IVideoDriver* driver, MinMaxPyramid* buffer, float startVal, float xSpan,
+		video::SColor color) {
+		int level = buffer->findLevel(lttbOversampling * width);
+		int numVals = buffer->getNumElements(level);
+		lttbInput.clear();
+		for (int idx = 0; idx <= numVals; ++idx) {
+			GraphBucket bucket = (idx < numVals) ? buffer->get(level, idx) : buffer->getTail(level);
+			if (bucket.count == 0 || bucket.xLast < startVal)
+				continue;
+			lttbInput.push_back(bucket.getMean());
+		}
+		int n = (int)lttbInput.size();
+		int threshold = width;
+		lttbOutput.clear();
+		if (n <= threshold || threshold < 3) {
+			lttbOutput = lttbInput;
+		}
+		else {
+			float every = (float)(n - 2) / (threshold - 2);
+			int a = 0;
+			lttbOutput.push_back(lttbInput[0]);
+			for (int i = 0; i < threshold - 2; ++i) {
+				// Average of the next bucket is the third triangle point
+				int avgStart = (int)((i + 1) * every) + 1;
+				int avgEnd = core::min_((int)((i + 2) * every) + 1, n);
+				core::vector2df avg(0, 0);
+				for (int j = avgStart; j < avgEnd; ++j)
+					avg += lttbInput[j];
+				if (avgEnd > avgStart)
+					avg = avg * (1.f / (avgEnd - avgStart));
+				else
+					avg = lttbInput[n - 1];
+
+				int rangeStart = (int)(i * every) + 1;
+				int rangeEnd = (int)((i + 1) * every) + 1;
+				const core::vector2df& pA = lttbInput[a];
+				float maxArea = -1.f;
+				int maxIdx = rangeStart;
+				for (int j = rangeStart; j < rangeEnd; ++j) {
+					float area = fabsf((pA.X - avg.X) * (lttbInput[j].Y - pA.Y) -
+						(pA.X - lttbInput[j].X) * (avg.Y - pA.Y));
+					if (area > maxArea) {
+						maxArea = area;
+						maxIdx = j;
+					}
+				}
+				lttbOutput.push_back(lttbInput[maxIdx]);
+				a = maxIdx;
+			}
+			lttbOutput.push_back(lttbInput[n - 1]);
+		}
+		for (size_t idx = 1; idx < lttbOutput.size(); ++idx)
+			drawClipped(driver, toScreen(lttbOutput[idx - 1].X, lttbOutput[idx - 1].Y, startVal, xSpan),
+				toScreen(lttbOutput[idx].X, lttbOutput[idx].Y, startVal, xSpan), color);
+	}
 
 public:
 
+	// bufSize is the number of samples kept per buffer; rendering cost only depends on the graph width.
 	Graph(const wchar_t* caption, core::rect<s32> pos, float maxVal, float minVal, int numBuffers, int bufSize,
 		gui::IGUIFont* font)
 	{
@@ -31,60 +149,103 @@ public:
 		this->pos = pos;
 		this->bufSize = bufSize;
 		this->numBuffers = numBuffers;
-		this->buffers = new RingBuffer<core::vector2df>*[numBuffers];
+		this->buffers = new MinMaxPyramid*[numBuffers];
 		for (int i = 0; i < numBuffers; ++i)
-			buffers[i] = new RingBuffer<core::vector2df>(bufSize);
+			buffers[i] = new MinMaxPyramid(bufSize);
 
 		colorRect.set(150, 50, 50, 50);
 		colorFont.set(255, 255, 255, 255);
 
 		this->width = pos.LowerRightCorner.X - pos.UpperLeftCorner.X;
 		this->height = pos.LowerRightCorner.Y - pos.UpperLeftCorner.Y;
+
+		lttbInput.reserve(lttbOversampling * width + 1);
+		lttbOutput.reserve(lttbOversampling * width + 1);
 	}
-	
+
 	~Graph() {
 		for (int i = 0; i < numBuffers; ++i)
 			delete buffers[i];
-		delete buffers;
+		delete[] buffers;
+	}
+
+	// Adds a value at the given simulation time in ticks
+	void addVal(int buffer, s64 time, float val) {
+		if (time - epoch > (s64)(rebaseSeconds * ticksPerSecond))
+			rebase(time);
+		buffers[buffer]->push(core::vector2df((f32)((double)(time - epoch) / ticksPerSecond), val));
+	}
+
+	// Moves the epoch to the oldest held sample so that relative times stay small
+	void rebase(s64 time) {
+		double oldest = (double)(time - epoch) / ticksPerSecond;
+		for (int i = 0; i < numBuffers; ++i)
+			if (buffers[i]->getNumElements(0) > 0 && buffers[i]->getFirst().X < oldest)
+				oldest = buffers[i]->getFirst().X;
+		s64 delta = (s64)(oldest * ticksPerSecond);
+		f32 dx = (f32)(-(double)delta / ticksPerSecond);
+		for (int i = 0; i < numBuffers; ++i)
+			buffers[i]->shiftX(dx);
+		epoch += delta;
+		// History spans more than half the window: widen it
+		while ((double)(time - epoch) / ticksPerSecond > rebaseSeconds / 2)
+			rebaseSeconds *= 2;
 	}
 
-	void addVal(int buffer, core::vector2df val) {
-		buffers[buffer]->push(val);
+	void setTicksPerSecond(s64 ticksPerSecond) {
+		this->ticksPerSecond = ticksPerSecond;
 	}
 
+	// Draws caption and current value through the given HUD instead of the font
+	void setHud(HudText* hud) {
+		this->hud = hud;
+		hud->setText(hud->addLine(pos, colorFont, true), caption.c_str());
+		core::rect<s32> valuePos = pos;
+		valuePos.UpperLeftCorner.Y += fontLineOffset;
+		hudValueLine = hud->addLine(valuePos, colorFont, true);
+	}
+
+	void setDecimation(GraphDecimation decimation) {
+		this->decimation = decimation;
+	}
+
+	GraphDecimation getDecimation() {
+		return decimation;
+	}
 
 
 	virtual void render(video::IVideoDriver* driver)
 	{
-		const u32 fontLineOffset = 17;
 		driver->draw2DRectangle(colorRect, pos);
-		font->draw(caption, pos, colorFont, true);
-		wchar_t wStr[20];
-		swprintf(wStr, 100, L"%.2f", buffers[0]->get(buffers[0]->getNumElements() - 1).Y);
-		pos.UpperLeftCorner.Y += fontLineOffset;
-		font->draw(wStr, pos, colorFont, true);
-		pos.UpperLeftCorner.Y -= fontLineOffset;
+		float lastVal = buffers[0]->getLast().Y;
+		if (hud != NULL) {
+			hud->setValues(hudValueLine, L"%.2f", &lastVal, 1, 2);
+		}
+		else {
+			font->draw(caption, pos, colorFont, true);
+			wchar_t wStr[20];
+			swprintf(wStr, 20, L"%.2f", lastVal);
+			pos.UpperLeftCorner.Y += fontLineOffset;
+			font->draw(wStr, pos, colorFont, true);
+			pos.UpperLeftCorner.Y -= fontLineOffset;
+		}
 		video::SColor color;
-		if (buffers[0]->getNumElements() < 2)
+		if (buffers[0]->getNumElements(0) < 2)
+			return;
+		// The time range is given by the first buffer at the resolution it is drawn with
+		int level = buffers[0]->findLevel(decimation == GD_LTTB ? lttbOversampling * width : width);
+		float startVal = buffers[0]->get(level, 0).xFirst;
+		float xSpan = buffers[0]->getLast().X - startVal;
+		if (xSpan <= 0)
 			return;
-		float startVal = buffers[0]->get(0).X;
-		float xSpan = buffers[0]->get(buffers[0]->getNumElements() - 1).X - startVal;
 		for (int i = 0; i < numBuffers; ++i) {
 			color.set(255, 255 * (i == 0), 255 * (i == 1), 255 * (i == 2));
-			int numVals = buffers[i]->getNumElements();
-			if (numVals < 2)
+			if (buffers[i]->getNumElements(0) < 2)
 				continue;
-			for (int idx = numVals - 2; idx >= 0; --idx) {
-				core::vector2d<s32> startPos, endPos;
-				startPos.X = (s32)((buffers[i]->get(idx).X - startVal) / xSpan * width) + pos.UpperLeftCorner.X;
-				startPos.Y = pos.LowerRightCorner.Y - (s32)((buffers[i]->get(idx).Y - minVal) / (maxVal-minVal) * height);
-				endPos.X = (s32)((buffers[i]->get(idx+1).X -startVal) / xSpan * width) + pos.UpperLeftCorner.X;
-				endPos.Y = pos.LowerRightCorner.Y - (s32)((buffers[i]->get(idx+1).Y - minVal) / (maxVal - minVal) * height);
-				if (startPos.X < pos.UpperLeftCorner.X)
-					break;
-				if (pos.isPointInside(startPos) && pos.isPointInside(endPos))
-					driver->draw2DLine(startPos, endPos, color);
-			}
+			if (decimation == GD_LTTB)
+				renderLTTB(driver, buffers[i], startVal, xSpan, color);
+			else
+				renderMinMax(driver, buffers[i], startVal, xSpan, color);
 		}
 	}
 
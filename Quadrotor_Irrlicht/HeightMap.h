@@ -0,0 +1,218 @@
+#pragma once
+#include <irrlicht.h>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace irr;
+
+// Square grid of 16-bit height samples, either a memory-mapped raw raster (little endian,
+// row by row, as exported by most terrain tools as .raw or .r16) or generated in memory.
+// Sample (ix, iz) lies at origin + (ix, iz) * cellSize on the X/Z plane; the height is
+// raw * heightScale + heightOffset. The offset is chosen so that the world origin, where
+// the vehicles start, is at height 0.
+// Only the pages that are actually touched are read from disk, so rasters of several
+// hundred megabytes load instantly.
+class HeightMap {
+private:
+	const u16* samples = NULL;
+	std::vector<u16> generated;
+	int size = 0; // samples per row and column
+	float cellSize = 1.f, invCellSize = 1.f;
+	float heightScale = 1.f, heightOffset = 0.f;
+	core::vector2df origin;
+	u16 rawMin = 0, rawMax = 0;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE, mapping = NULL;
+#else
+	int file = -1;
+	size_t mappedBytes = 0;
+#endif
+	const void* view = NULL;
+
+	void unmap() {
+#ifdef _WIN32
+		if (view != NULL)
+			UnmapViewOfFile(view);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#else
+		if (view != NULL)
+			munmap((void*)view, mappedBytes);
+		if (file >= 0)
+			close(file);
+		file = -1;
+#endif
+		view = NULL;
+	}
+
+	// Places the grid centered on the world origin and moves the origin to height 0
+	void setup(float cellSize, float heightScale) {
+		this->cellSize = cellSize;
+		invCellSize = 1.f / cellSize;
+		this->heightScale = heightScale;
+		origin.set(-(size - 1) * cellSize / 2, -(size - 1) * cellSize / 2);
+		rawMin = 0xffff;
+		rawMax = 0;
+		for (size_t i = 0; i < (size_t)size * size; ++i) {
+			rawMin = core::min_(rawMin, samples[i]);
+			rawMax = core::max_(rawMax, samples[i]);
+		}
+		heightOffset = 0.f;
+		heightOffset = -getHeight(0.f, 0.f);
+	}
+
+	static float hash(int x, int z, u32 seed) {
+		u32 h = (u32)x * 374761393u + (u32)z * 668265263u + seed * 2246822519u;
+		h = (h ^ (h >> 13)) * 1274126177u;
+		return (float)((h ^ (h >> 16)) & 0xffff) / 65535.f;
+	}
+
+	static float valueNoise(float x, float z, u32 seed) {
+		int ix = (int)floorf(x), iz = (int)floorf(z);
+		float fx = x - ix, fz = z - iz;
+		fx = fx * fx * (3 - 2 * fx);
+		fz = fz * fz * (3 - 2 * fz);
+		float a = hash(ix, iz, seed), b = hash(ix + 1, iz, seed);
+		float c = hash(ix, iz + 1, seed), d = hash(ix + 1, iz + 1, seed);
+		return a + (b - a) * fx + (c - a) * fz + (a - b - c + d) * fx * fz;
+	}
+
+public:
+	HeightMap() {}
+
+	~HeightMap() {
+		unmap();
+	}
+
+	// Maps a square raw raster; the number of samples per row follows from the file size
+	bool load(const char* fileName, float cellSize, float heightScale) {
+		unmap();
+		size_t bytes = 0;
+#ifdef _WIN32
+		file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		LARGE_INTEGER fileSize;
+		if (file != INVALID_HANDLE_VALUE && GetFileSizeEx(file, &fileSize)) {
+			bytes = (size_t)fileSize.QuadPart;
+			mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping != NULL)
+				view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+#else
+		file = open(fileName, O_RDONLY);
+		struct stat fileStat;
+		if (file >= 0 && fstat(file, &fileStat) == 0) {
+			bytes = mappedBytes = (size_t)fileStat.st_size;
+			view = mmap(NULL, bytes, PROT_READ, MAP_SHARED, file, 0);
+			if (view == MAP_FAILED)
+				view = NULL;
+		}
+#endif
+		size = (int)(sqrt((double)(bytes / 2)) + 0.5);
+		if (view == NULL || size < 2 || (size_t)size * size * 2 != bytes) {
+			printf("HeightMap: %s is not a square 16-bit raster\n", fileName);
+			unmap();
+			size = 0;
+			return false;
+		}
+		samples = (const u16*)view;
+		setup(cellSize, heightScale);
+		return true;
+	}
+
+	// Rolling hills from a few octaves of value noise, flattened around the origin
+	void generate(int size, float cellSize, float heightRange, u32 seed = 1) {
+		unmap();
+		this->size = size;
+		generated.resize((size_t)size * size);
+		float flatRadius = 16.f; // in cells
+		for (int z = 0; z < size; ++z)
+			for (int x = 0; x < size; ++x) {
+				float h = 0.f, amplitude = 0.5f, frequency = 4.f / size;
+				for (int octave = 0; octave < 6; ++octave) {
+					h += amplitude * valueNoise(x * frequency, z * frequency, seed + octave);
+					amplitude *= 0.5f;
+					frequency *= 2.f;
+				}
+				float dx = x - (size - 1) / 2.f, dz = z - (size - 1) / 2.f;
+				float blend = core::clamp((sqrtf(dx * dx + dz * dz) - flatRadius) / flatRadius, 0.f, 1.f);
+				h = 0.5f + (h - 0.5f) * blend;
+				generated[(size_t)z * size + x] = (u16)core::clamp(h * 65535.f, 0.f, 65535.f);
+			}
+		samples = generated.data();
+		setup(cellSize, heightRange / 65535.f);
+	}
+
+	bool isValid() const {
+		return size > 0;
+	}
+
+	int getSize() const {
+		return size;
+	}
+
+	float getCellSize() const {
+		return cellSize;
+	}
+
+	// World position of sample (0, 0)
+	core::vector2df getOrigin() const {
+		return origin;
+	}
+
+	float getMinHeight() const {
+		return rawMin * heightScale + heightOffset;
+	}
+
+	float getMaxHeight() const {
+		return rawMax * heightScale + heightOffset;
+	}
+
+	float getSampleHeight(int ix, int iz) const {
+		ix = core::clamp(ix, 0, size - 1);
+		iz = core::clamp(iz, 0, size - 1);
+		return samples[(size_t)iz * size + ix] * heightScale + heightOffset;
+	}
+
+	// Bilinear height at a world position; outside the grid the border continues
+	float getHeight(float x, float z) const {
+		float gx = core::clamp((x - origin.X) * invCellSize, 0.f, (float)(size - 1));
+		float gz = core::clamp((z - origin.Y) * invCellSize, 0.f, (float)(size - 1));
+		int ix = core::min_((int)gx, size - 2), iz = core::min_((int)gz, size - 2);
+		float fx = gx - ix, fz = gz - iz;
+		const u16* row = samples + (size_t)iz * size + ix;
+		float a = row[0], b = row[1], c = row[size], d = row[size + 1];
+		float raw = a + (b - a) * fx + (c - a) * fz + (a - b - c + d) * fx * fz;
+		return raw * heightScale + heightOffset;
+	}
+
+	// Surface normal from central differences of the samples around a world position
+	core::vector3df getNormal(float x, float z) const {
+		int ix = core::round32((x - origin.X) * invCellSize), iz = core::round32((z - origin.Y) * invCellSize);
+		return getSampleNormal(ix, iz);
+	}
+
+	core::vector3df getSampleNormal(int ix, int iz) const {
+		core::vector3df n(getSampleHeight(ix - 1, iz) - getSampleHeight(ix + 1, iz), 2 * cellSize,
+			getSampleHeight(ix, iz - 1) - getSampleHeight(ix, iz + 1));
+		return n.normalize();
+	}
+};
@@ -0,0 +1,192 @@
+#pragma once
+#include <irrlicht.h>
+#include <vector>
+#include <cmath>
+
+using namespace irr;
+
+#define HUD_MAX_VALUES 8
+#define HUD_LINE_LENGTH 128
+
+// Collects all HUD strings and draws them together.
+// A line is only re-formatted when one of its values changes at the displayed precision,
+// and only re-laid out when its text changes. For bitmap fonts the glyph quads of every
+// line are cached and all lines are drawn with one draw2DImageBatch call per texture and color.
+class HudText {
+private:
+	struct Line {
+		core::rect<s32> pos;
+		video::SColor color;
+		bool hcenter, vcenter;
+		core::stringw text;
+		bool visible = true;
+
+		// Values the text was last formatted with, in units of the displayed precision
+		s64 quantized[HUD_MAX_VALUES];
+		int numValues = -1;
+
+		// Glyph quads relative to the rectangle
+		core::array<core::position2d<s32> > glyphPos;
+		core::array<core::rect<s32> > glyphRects;
+		core::array<u32> glyphTextures;
+	};
+
+	struct Batch {
+		video::ITexture* texture;
+		video::SColor color;
+		core::array<core::position2d<s32> > positions;
+		core::array<core::rect<s32> > sourceRects;
+	};
+
+	gui::IGUIFont* font;
+	gui::IGUIFontBitmap* bitmapFont = NULL;
+	std::vector<Line> lines;
+	std::vector<Batch> batches;
+	bool batchesDirty = true;
+
+	// Replicates the glyph placement of Irrlicht's bitmap font
+	void layout(Line& line) {
+		line.glyphPos.set_used(0);
+		line.glyphRects.set_used(0);
+		line.glyphTextures.set_used(0);
+		if (bitmapFont == NULL)
+			return;
+		gui::IGUISpriteBank* bank = bitmapFont->getSpriteBank();
+		core::dimension2d<u32> dim = font->getDimension(line.text.c_str());
+		core::position2d<s32> offset(0, 0);
+		if (line.hcenter)
+			offset.X += ((s32)line.pos.getWidth() - (s32)dim.Width) >> 1;
+		if (line.vcenter)
+			offset.Y += ((s32)line.pos.getHeight() - (s32)dim.Height) >> 1;
+		s32 lineStartX = offset.X;
+
+		for (u32 i = 0; i < line.text.size(); ++i) {
+			const wchar_t* c = &line.text[i];
+			if (*c == L'\n') {
+				offset.Y += font->getDimension(L"A").Height + font->getKerningHeight();
+				offset.X = lineStartX;
+				continue;
+			}
+			u32 spriteNo = bitmapFont->getSpriteNoFromChar(c);
+			const gui::SGUISprite& sprite = bank->getSprites()[spriteNo];
+			if (sprite.Frames.size() == 0)
+				continue;
+			const core::rect<s32>& source = bank->getPositions()[sprite.Frames[0].rectNumber];
+			s32 overhangAndKerning = font->getKerningWidth(c);
+			offset.X += font->getKerningWidth(c, c) - overhangAndKerning; // underhang
+			if (*c != L' ') {
+				line.glyphPos.push_back(offset);
+				line.glyphRects.push_back(source);
+				line.glyphTextures.push_back(sprite.Frames[0].textureNumber);
+			}
+			offset.X += source.getWidth() + overhangAndKerning;
+		}
+		batchesDirty = true;
+	}
+
+	void rebuildBatches() {
+		for (size_t b = 0; b < batches.size(); ++b) {
+			batches[b].positions.set_used(0);
+			batches[b].sourceRects.set_used(0);
+		}
+		gui::IGUISpriteBank* bank = bitmapFont->getSpriteBank();
+		for (size_t l = 0; l < lines.size(); ++l) {
+			Line& line = lines[l];
+			if (!line.visible)
+				continue;
+			for (u32 g = 0; g < line.glyphPos.size(); ++g) {
+				video::ITexture* texture = bank->getTexture(line.glyphTextures[g]);
+				size_t b = 0;
+				while (b < batches.size() && (batches[b].texture != texture || batches[b].color != line.color))
+					++b;
+				if (b == batches.size()) {
+					batches.push_back(Batch());
+					batches[b].texture = texture;
+					batches[b].color = line.color;
+				}
+				batches[b].positions.push_back(line.glyphPos[g] + line.pos.UpperLeftCorner);
+				batches[b].sourceRects.push_back(line.glyphRects[g]);
+			}
+		}
+		batchesDirty = false;
+	}
+
+public:
+	HudText(gui::IGUIFont* font) : font(font) {
+		if (font->getType() == gui::EGFT_BITMAP)
+			bitmapFont = static_cast<gui::IGUIFontBitmap*>(font);
+	}
+
+	// Returns the index of the new line
+	int addLine(core::rect<s32> pos, video::SColor color = video::SColor(255, 255, 255, 255),
+		bool hcenter = false, bool vcenter = false) {
+		lines.push_back(Line());
+		Line& line = lines.back();
+		line.pos = pos;
+		line.color = color;
+		line.hcenter = hcenter;
+		line.vcenter = vcenter;
+		return (int)lines.size() - 1;
+	}
+
+	void setText(int idx, const wchar_t* text) {
+		Line& line = lines[idx];
+		if (line.text == text)
+			return;
+		line.text = text;
+		line.numValues = -1;
+		layout(line);
+	}
+
+	// Formats the values into the line; skipped if none of them changed at the given number of decimals
+	void setValues(int idx, const wchar_t* format, const float* values, int numValues, int decimals) {
+		Line& line = lines[idx];
+		float scale = powf(10.f, (float)decimals);
+		bool changed = line.numValues != numValues;
+		for (int i = 0; i < numValues && i < HUD_MAX_VALUES; ++i) {
+			s64 q = (s64)floor(values[i] * scale + 0.5);
+			changed |= line.quantized[i] != q;
+			line.quantized[i] = q;
+		}
+		if (!changed)
+			return;
+
+		double v[HUD_MAX_VALUES] = { 0 };
+		for (int i = 0; i < numValues && i < HUD_MAX_VALUES; ++i)
+			v[i] = values[i];
+		wchar_t str[HUD_LINE_LENGTH];
+		swprintf(str, HUD_LINE_LENGTH, format, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+		line.text = str;
+		line.numValues = numValues;
+		layout(line);
+	}
+
+	void setPosition(int idx, core::rect<s32> pos) {
+		Line& line = lines[idx];
+		if (line.pos == pos)
+			return;
+		line.pos = pos;
+		layout(line);
+	}
+
+	void setVisible(int idx, bool visible) {
+		if (lines[idx].visible != visible)
+			batchesDirty = true;
+		lines[idx].visible = visible;
+	}
+
+	void draw(video::IVideoDriver* driver) {
+		if (bitmapFont == NULL) {
+			for (size_t l = 0; l < lines.size(); ++l)
+				if (lines[l].visible)
+					font->draw(lines[l].text, lines[l].pos, lines[l].color, lines[l].hcenter, lines[l].vcenter);
+			return;
+		}
+		if (batchesDirty)
+			rebuildBatches();
+		for (size_t b = 0; b < batches.size(); ++b)
+			if (batches[b].positions.size() > 0)
+				driver->draw2DImageBatch(batches[b].texture, batches[b].positions, batches[b].sourceRects, 0,
+					batches[b].color, true);
+	}
+};
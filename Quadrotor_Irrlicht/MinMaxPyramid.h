@@ -0,0 +1,150 @@
+#pragma once
+#include <irrlicht.h>
+#include "RingBuffer.h"
+
+using namespace irr;
+
+// Summary of a range of consecutive samples
+struct GraphBucket {
+	f32 xFirst, xLast;
+	f32 yFirst, yLast;
+	f32 yMin, yMax, ySum;
+	int count;
+
+	GraphBucket() : xFirst(0), xLast(0), yFirst(0), yLast(0), yMin(0), yMax(0), ySum(0), count(0) {}
+
+	GraphBucket(const core::vector2df& sample) :
+		xFirst(sample.X), xLast(sample.X), yFirst(sample.Y), yLast(sample.Y),
+		yMin(sample.Y), yMax(sample.Y), ySum(sample.Y), count(1) {}
+
+	// Appends a bucket that directly follows this one; empty buckets change nothing
+	void merge(const GraphBucket& next) {
+		if (next.count == 0)
+			return;
+		if (count == 0) {
+			*this = next;
+			return;
+		}
+		xLast = next.xLast;
+		yLast = next.yLast;
+		if (next.yMin < yMin)
+			yMin = next.yMin;
+		if (next.yMax > yMax)
+			yMax = next.yMax;
+		ySum += next.ySum;
+		count += next.count;
+	}
+
+	core::vector2df getMean() const {
+		return core::vector2df((xFirst + xLast) / 2, ySum / count);
+	}
+};
+
+
+// Multi-resolution history of a sample stream.
+// Level 0 holds the raw samples, level k holds buckets of 2^k consecutive samples.
+// Every level keeps roughly the same time span, so any zoom can be drawn from a
+// level whose element count is close to the number of pixels.
+// Pushing is amortized O(1): each completed bucket is merged into the next level.
+class MinMaxPyramid {
+private:
+	RingBuffer<core::vector2df>* samples;
+	RingBuffer<GraphBucket>** levels; // levels[k] holds the buckets of level k+1
+	GraphBucket* pending;			  // pending[k] is the incomplete bucket of level k+1
+	int numLevels;
+
+public:
+	MinMaxPyramid(int capacity) {
+		samples = new RingBuffer<core::vector2df>(capacity);
+		numLevels = 1;
+		while ((capacity >> numLevels) > 1)
+			numLevels++;
+		levels = new RingBuffer<GraphBucket>*[numLevels - 1];
+		pending = new GraphBucket[numLevels - 1];
+		for (int k = 1; k < numLevels; ++k)
+			levels[k - 1] = new RingBuffer<GraphBucket>((capacity >> k) + 1);
+	}
+
+	~MinMaxPyramid() {
+		for (int k = 1; k < numLevels; ++k)
+			delete levels[k - 1];
+		delete[] levels;
+		delete[] pending;
+		delete samples;
+	}
+
+	void push(const core::vector2df& sample) {
+		samples->push(sample);
+		GraphBucket completed(sample);
+		for (int k = 1; k < numLevels; ++k) {
+			GraphBucket& p = pending[k - 1];
+			p.merge(completed);
+			if (p.count < (1 << k))
+				return;
+			levels[k - 1]->push(p);
+			completed = p;
+			p = GraphBucket();
+		}
+	}
+
+	// Moves every stored sample by dx along the x axis
+	void shiftX(f32 dx) {
+		for (int i = 0; i < samples->getNumElements(); ++i)
+			samples->at(i).X += dx;
+		for (int k = 1; k < numLevels; ++k) {
+			for (int i = 0; i < levels[k - 1]->getNumElements(); ++i) {
+				levels[k - 1]->at(i).xFirst += dx;
+				levels[k - 1]->at(i).xLast += dx;
+			}
+			pending[k - 1].xFirst += dx;
+			pending[k - 1].xLast += dx;
+		}
+	}
+
+	void clear() {
+		samples->clear();
+		for (int k = 1; k < numLevels; ++k) {
+			levels[k - 1]->clear();
+			pending[k - 1] = GraphBucket();
+		}
+	}
+
+	int getNumLevels() {
+		return numLevels;
+	}
+
+	// Number of complete buckets in the given level
+	int getNumElements(int level) {
+		return level == 0 ? samples->getNumElements() : levels[level - 1]->getNumElements();
+	}
+
+	GraphBucket get(int level, int i) {
+		if (level == 0)
+			return GraphBucket(samples->at(i));
+		return levels[level - 1]->at(i);
+	}
+
+	// Samples that are newer than the last complete bucket of the given level
+	GraphBucket getTail(int level) {
+		GraphBucket tail;
+		for (int k = level; k >= 1; --k)
+			tail.merge(pending[k - 1]);
+		return tail;
+	}
+
+	core::vector2df getFirst() {
+		return samples->get(0);
+	}
+
+	core::vector2df getLast() {
+		return samples->get(samples->getNumElements() - 1);
+	}
+
+	// Finest level that holds at most maxElements buckets
+	int findLevel(int maxElements) {
+		int level = 0;
+		while (level < numLevels - 1 && getNumElements(level) > maxElements)
+			level++;
+		return level;
+	}
+};
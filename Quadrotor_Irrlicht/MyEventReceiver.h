@@ -18,6 +18,24 @@ private:
 
 	scene::ISceneManager* smgr = NULL;
 	std::map<wchar_t, bool*> keyMap;
+
+	// Sets every motor of the airframe: a common speed, plus more in front, on the +Z side and on the
+	// counterclockwise rotors. The outermost motors get the full difference, like the mixer.
+	void setMotorSpeeds(float common, float front, float side, float counterclockwise) {
+		const AirframeGeometry& airframe = quadrotor->getAirframe();
+		float maxX = 0, maxZ = 0;
+		for (int i = 0; i < airframe.motorCount; ++i) {
+			maxX = core::max_(maxX, fabsf(airframe.rotors[i].x));
+			maxZ = core::max_(maxZ, fabsf(airframe.rotors[i].z));
+		}
+		float desiredSpeed[AIRFRAME_MAX_MOTORS] = {};
+		for (int i = 0; i < airframe.motorCount; ++i) {
+			const RotorGeometry& rotor = airframe.rotors[i];
+			desiredSpeed[i] = common + front * rotor.x / maxX + side * rotor.z / maxZ
+				+ counterclockwise * (rotor.spin > 0 ? 1 : -1);
+		}
+		quadrotor->setMotorSpeed(desiredSpeed);
+	}
 public:
 	// We'll create a struct to record info on the mouse state
 	struct SMouseState
@@ -107,40 +125,28 @@ public:
 					trajectoryController->reset();
 				break;
 			case KEY_KEY_0:
-				if (quadrotor != NULL) {
-					float desiredSpeed[] = { 0.005f, 0.005f, 0.005f, 0.005f };
-					quadrotor->setMotorSpeed(desiredSpeed);
-				}
+				if (quadrotor != NULL)
+					setMotorSpeeds(0.005f, 0, 0, 0);
 				break;
 			case KEY_KEY_9:
-				if (quadrotor != NULL) {
-					float desiredSpeed[] = { 0.5f, 0.5f, 0.5f, 0.5f };
-					quadrotor->setMotorSpeed(desiredSpeed);
-				}
+				if (quadrotor != NULL)
+					setMotorSpeeds(0.5f, 0, 0, 0);
 				break;
 			case KEY_KEY_8:
-				if (quadrotor != NULL) {
-					float desiredSpeed[] = { 0.7f, 0.2f, 0.2f, 0.7f };
-					quadrotor->setMotorSpeed(desiredSpeed);
-				}
+				if (quadrotor != NULL)
+					setMotorSpeeds(0.45f, 0, 0, 0.25f);
 				break;
 			case KEY_KEY_7:
-				if (quadrotor != NULL) {
-					float desiredSpeed[] = { 0.7003f, 0.7003f, 0.6997f, 0.6997f };
-					quadrotor->setMotorSpeed(desiredSpeed);
-				}
+				if (quadrotor != NULL)
+					setMotorSpeeds(0.7f, 0.0003f, 0, 0);
 				break;
 			case KEY_KEY_6:
-				if (quadrotor != NULL) {
-					float desiredSpeed[] = { 0.7003f, 0.6997f, 0.7003f, 0.6997f };
-					quadrotor->setMotorSpeed(desiredSpeed);
-				}
+				if (quadrotor != NULL)
+					setMotorSpeeds(0.7f, 0, 0.0003f, 0);
 				break;
 			case KEY_KEY_5:
-				if (quadrotor != NULL) {
-					float desiredSpeed[] = { 1.f, 1.f, 1.f, 1.f };
-					quadrotor->setMotorSpeed(desiredSpeed);
-				}
+				if (quadrotor != NULL)
+					setMotorSpeeds(1.f, 0, 0, 0);
 				break;
 			// Trajectory Controller keys
 			case KEY_KEY_S:
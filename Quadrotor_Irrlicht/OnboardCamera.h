@@ -0,0 +1,305 @@
+#pragma once
+#include <irrlicht.h>
+#include <vector>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "Quadrotor.h"
+#include "SimulationClock.h"
+#include "FrameCapture.h"
+#include "Profiler.h"
+
+using namespace irr;
+
+#define _METER *100
+
+// Three slots shared by one writer and one reader without locks. The writer fills its back slot and
+// publishes it by swapping it with the middle one; the reader swaps its front slot with the middle one
+// when a newer slot was published. Neither side ever waits or copies: the writer always has a slot to
+// write, and the reader keeps its slot until it asks for a newer one. Frames the reader did not pick
+// up in time are overwritten.
+template <class T>
+class TripleBuffer {
+private:
+	enum { INDEX = 3, FRESH = 4 };
+	T slots[3];
+	std::atomic<int> middle;
+	int back = 0, front = 1;
+
+public:
+	TripleBuffer() : middle(2) {}
+
+	// For allocating the slots before the first use
+	T& getSlot(int i) {
+		return slots[i];
+	}
+
+	// Writer side
+	T& getBack() {
+		return slots[back];
+	}
+
+	void publish() {
+		back = middle.exchange(back | FRESH) & INDEX;
+	}
+
+	// Reader side: true if a newer slot is now in front
+	bool acquire() {
+		if (!(middle.load() & FRESH))
+			return false;
+		front = middle.exchange(front) & INDEX;
+		return true;
+	}
+
+	const T& getFront() const {
+		return slots[front];
+	}
+};
+
+struct CameraFrame {
+	std::vector<u8> rgb; // RGB24 rows from top to bottom
+	core::dimension2d<u32> size;
+	u32 index = 0;
+	s64 time = -1;	  // simulation clock ticks of the pose
+	core::vector3df position, rotation; // of the vehicle
+};
+
+// A camera looking forward from the nose of a vehicle. Frames are rendered by a CameraRenderer and
+// read from here by any one consumer thread.
+class OnboardCamera {
+private:
+	friend class CameraRenderer;
+	int vehicle;
+	core::dimension2d<u32> size;
+	float fov;	// horizontal, degrees
+	float rate; // frames per second
+	s64 nextTime = 0; // simulation clock ticks
+	bool due = false;
+	TripleBuffer<CameraFrame> frames;
+	video::ITexture* target = NULL; // render target of the main device
+	u32 frameCount = 0;
+
+	OnboardCamera(int vehicle, core::dimension2d<u32> size, float fov, float rate) :
+		vehicle(vehicle), size(size), fov(fov), rate(rate) {
+		for (int i = 0; i < 3; ++i) {
+			frames.getSlot(i).rgb.resize(3 * size.Width * size.Height);
+			frames.getSlot(i).size = size;
+		}
+	}
+
+public:
+	// True if a frame newer than the last one is available; it stays valid until the next call
+	bool acquire() {
+		return frames.acquire();
+	}
+
+	const CameraFrame& getFrame() const {
+		return frames.getFront();
+	}
+
+	int getVehicle() const {
+		return vehicle;
+	}
+
+	core::dimension2d<u32> getSize() const {
+		return size;
+	}
+};
+
+// Renders the onboard cameras of any number of vehicles from the displayed scene into render targets
+// of the main device. Rendering stays on the main thread: Irrlicht keeps its logger and timer in
+// process-wide statics, which a second device on another thread would share. Only the hand-off is
+// asynchronous. The main thread copies the locked pixels of each new frame, and a worker converts them
+// to RGB24 and publishes them. A copy the worker has not converted yet is replaced by the newer one,
+// so neither rendering nor physics ever waits for it.
+class CameraRenderer {
+private:
+	struct Readback {
+		std::vector<u8> pixels;
+		video::ECOLOR_FORMAT format = video::ECF_A8R8G8B8;
+		u32 pitch = 0;
+		core::dimension2d<u32> size;
+		s64 time = 0;
+		core::vector3df position, rotation;
+		bool valid = false;
+	};
+
+	video::IVideoDriver* driver;
+	scene::ISceneManager* smgr;
+	scene::ICameraSceneNode* view;
+	float vehicleSize;
+	bool flipY;
+	std::vector<OnboardCamera*> cameras;
+	std::vector<int> rendered; // cameras drawn in the current render()
+
+	std::vector<Readback> pending, working; // one per camera
+	bool hasPending = false, stopping = false, started = false;
+	std::mutex mutex;
+	std::condition_variable posted;
+	std::thread worker;
+	std::atomic<u32> replaced;
+
+	void setView(const OnboardCamera* camera, const core::vector3df& position, const core::vector3df& rotation) {
+		core::matrix4 rotMatrix;
+		rotMatrix.setRotationDegrees(rotation);
+		core::vector3df forward(1, 0, 0), up(0, 1, 0), mount(0.6f * vehicleSize, 0.25f * vehicleSize, 0);
+		rotMatrix.rotateVect(forward);
+		rotMatrix.rotateVect(up);
+		rotMatrix.rotateVect(mount);
+		view->setPosition(position + mount);
+		view->setTarget(position + mount + forward);
+		view->setUpVector(up);
+		float aspect = (float)camera->size.Width / camera->size.Height;
+		view->setAspectRatio(aspect);
+		// The camera node takes the vertical field of view
+		view->setFOV(2 * atanf(tanf(camera->fov * core::DEGTORAD / 2) / aspect));
+		view->updateAbsolutePosition();
+	}
+
+	void run() {
+		Profiler::get().setThreadName("onboard cameras");
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				posted.wait(lock, [this] { return stopping || hasPending; });
+				if (stopping)
+					break;
+				std::swap(pending, working);
+				hasPending = false;
+			}
+			for (size_t c = 0; c < cameras.size(); ++c) {
+				Readback& readback = working[c];
+				if (!readback.valid)
+					continue;
+				PROFILE_SCOPE("onboard camera readback");
+				OnboardCamera* camera = cameras[c];
+				CameraFrame& frame = camera->frames.getBack();
+				convertToRgb24(readback.pixels.data(), readback.format, readback.pitch, readback.size, flipY,
+					frame.rgb.data(), frame.size);
+				frame.index = camera->frameCount++;
+				frame.time = readback.time;
+				frame.position = readback.position;
+				frame.rotation = readback.rotation;
+				camera->frames.publish();
+				readback.valid = false;
+			}
+		}
+	}
+
+public:
+	CameraRenderer(video::IVideoDriver* driver, scene::ISceneManager* smgr, float vehicleSize) :
+		driver(driver), smgr(smgr), vehicleSize(vehicleSize), replaced(0) {
+		// OpenGL render targets are stored bottom-up
+		flipY = driver->getDriverType() == video::EDT_OPENGL;
+		view = smgr->addCameraSceneNode(0, core::vector3df(0, 0, 0), core::vector3df(0, 0, 100), -1, false);
+		view->setNearValue(0.05f _METER);
+		view->setFarValue(1000 _METER);
+	}
+
+	~CameraRenderer() {
+		if (started) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			posted.notify_one();
+			worker.join();
+		}
+		for (size_t c = 0; c < cameras.size(); ++c)
+			delete cameras[c];
+		view->remove();
+	}
+
+	// Before start(); vehicle is the index into the vehicles passed to render(), fov is horizontal in degrees
+	OnboardCamera* addCamera(int vehicle, core::dimension2d<u32> size, float fov = 90, float rate = 15) {
+		OnboardCamera* camera = new OnboardCamera(vehicle, size, fov, rate);
+		if (driver->queryFeature(video::EVDF_RENDER_TO_TARGET))
+			camera->target = driver->addRenderTargetTexture(size, "onboard camera", video::ECF_A8R8G8B8);
+		if (camera->target == NULL)
+			printf("CameraRenderer: no render target support, camera on vehicle %d stays dark\n", vehicle);
+		cameras.push_back(camera);
+		return camera;
+	}
+
+	void start() {
+		if (started || cameras.empty())
+			return;
+		started = true;
+		pending.resize(cameras.size());
+		working.resize(cameras.size());
+		worker = std::thread(&CameraRenderer::run, this);
+	}
+
+	// Call every step after the vehicles moved; marks the cameras whose next frame is due
+	void update(const SimulationClock& clock) {
+		s64 time = clock.getTicks();
+		for (size_t c = 0; c < cameras.size(); ++c) {
+			OnboardCamera* camera = cameras[c];
+			if (time < camera->nextTime)
+				continue;
+			// Stay on the grid of frame times; frames missed in a long step are dropped
+			do
+				camera->nextTime += clock.fromSeconds(1.0 / camera->rate);
+			while (camera->nextTime <= time);
+			camera->due = true;
+		}
+	}
+
+	// Call after beginScene and before the display is drawn: renders the due cameras and hands their
+	// pixels to the worker, then restores the display's render target and camera
+	void render(const SimulationClock& clock, Quadrotor** vehicles, int count) {
+		if (!started)
+			return;
+		scene::ICameraSceneNode* display = smgr->getActiveCamera();
+		rendered.clear();
+		for (size_t c = 0; c < cameras.size(); ++c) {
+			OnboardCamera* camera = cameras[c];
+			if (!camera->due || camera->target == NULL || camera->vehicle >= count)
+				continue;
+			camera->due = false;
+			PROFILE_SCOPE("onboard camera");
+			Quadrotor* vehicle = vehicles[camera->vehicle];
+			setView(camera, vehicle->getPosition(), vehicle->getRotation());
+			smgr->setActiveCamera(view);
+			driver->setRenderTarget(camera->target, true, true, video::SColor(255, 140, 170, 210));
+			smgr->drawAll();
+			rendered.push_back((int)c);
+		}
+		if (rendered.empty())
+			return;
+		driver->setRenderTarget(0, false, false);
+		smgr->setActiveCamera(display);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t i = 0; i < rendered.size(); ++i) {
+				OnboardCamera* camera = cameras[rendered[i]];
+				Readback& readback = pending[rendered[i]];
+				const void* data = camera->target->lock(video::ETLM_READ_ONLY);
+				if (data != NULL) {
+					if (readback.valid)
+						++replaced;
+					readback.format = camera->target->getColorFormat();
+					readback.pitch = camera->target->getPitch();
+					readback.size = camera->target->getSize();
+					readback.pixels.resize(readback.pitch * readback.size.Height);
+					memcpy(readback.pixels.data(), data, readback.pixels.size());
+					readback.time = clock.getTicks();
+					readback.position = vehicles[camera->vehicle]->getPosition();
+					readback.rotation = vehicles[camera->vehicle]->getRotation();
+					readback.valid = true;
+					hasPending = true;
+				}
+				camera->target->unlock();
+			}
+		}
+		posted.notify_one();
+	}
+
+	// Frames replaced before the worker converted them, i.e. frames it could not keep up with
+	u32 getReplaced() const {
+		return replaced;
+	}
+};
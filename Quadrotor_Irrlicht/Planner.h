@@ -0,0 +1,599 @@
+#pragma once
+#include <irrlicht.h>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include "VoxelMap.h"
+#include "ThreadPool.h"
+#include "Sensors.h"
+#include "QuadrotorTrajectoryController.h"
+#include "Profiler.h"
+
+using namespace irr;
+
+#define _METER *100
+
+// Static k-d tree over points for nearest neighbour and radius queries. The points are kept in tree
+// order: each range [begin, end) is split at its middle entry along the axis of its largest extent,
+// so the tree needs no nodes of its own and is built in O(n log n).
+class KdTree {
+private:
+	struct Entry {
+		core::vector3df point;
+		int id;
+		int axis; // split axis of the range this entry is the middle of
+	};
+
+	std::vector<Entry> entries;
+
+	void split(int begin, int end) {
+		if (end - begin <= 1)
+			return;
+		core::aabbox3df box(entries[begin].point);
+		for (int i = begin + 1; i < end; ++i)
+			box.addInternalPoint(entries[i].point);
+		core::vector3df extent = box.getExtent();
+		int axis = extent.X >= extent.Y && extent.X >= extent.Z ? 0 : extent.Y >= extent.Z ? 1 : 2;
+		int mid = (begin + end) / 2;
+		std::nth_element(entries.begin() + begin, entries.begin() + mid, entries.begin() + end,
+			[axis](const Entry& a, const Entry& b) { return (&a.point.X)[axis] < (&b.point.X)[axis]; });
+		entries[mid].axis = axis;
+		split(begin, mid);
+		split(mid + 1, end);
+	}
+
+	void nearest(int begin, int end, const core::vector3df& query, float& bestSq, int& best) const {
+		while (end > begin) {
+			int mid = (begin + end) / 2;
+			const Entry& entry = entries[mid];
+			float distanceSq = entry.point.getDistanceFromSQ(query);
+			if (distanceSq < bestSq) {
+				bestSq = distanceSq;
+				best = entry.id;
+			}
+			float diff = (&query.X)[entry.axis] - (&entry.point.X)[entry.axis];
+			// Nearer side first, the other one only if the splitting plane is within the best distance
+			if (diff < 0) {
+				nearest(begin, mid, query, bestSq, best);
+				if (diff * diff >= bestSq)
+					return;
+				begin = mid + 1;
+			}
+			else {
+				nearest(mid + 1, end, query, bestSq, best);
+				if (diff * diff >= bestSq)
+					return;
+				end = mid;
+			}
+		}
+	}
+
+	void withinRadius(int begin, int end, const core::vector3df& query, float radiusSq, std::vector<int>& result) const {
+		while (end > begin) {
+			int mid = (begin + end) / 2;
+			const Entry& entry = entries[mid];
+			if (entry.point.getDistanceFromSQ(query) <= radiusSq)
+				result.push_back(entry.id);
+			float diff = (&query.X)[entry.axis] - (&entry.point.X)[entry.axis];
+			if (diff * diff <= radiusSq) {
+				withinRadius(begin, mid, query, radiusSq, result);
+				begin = mid + 1;
+			}
+			else if (diff < 0)
+				end = mid;
+			else
+				begin = mid + 1;
+		}
+	}
+
+public:
+	// Point i is reported as id i
+	void build(const core::vector3df* points, int count) {
+		entries.resize(count);
+		for (int i = 0; i < count; ++i) {
+			entries[i].point = points[i];
+			entries[i].id = i;
+			entries[i].axis = 0;
+		}
+		split(0, count);
+	}
+
+	int getSize() const {
+		return (int)entries.size();
+	}
+
+	// The id of the nearest point if it is nearer than sqrt(bestSq), which is lowered to its distance; -1 if none is
+	int nearest(const core::vector3df& query, float& bestSq) const {
+		int best = -1;
+		nearest(0, (int)entries.size(), query, bestSq, best);
+		return best;
+	}
+
+	// Appends the ids of all points within the radius
+	void withinRadius(const core::vector3df& query, float radius, std::vector<int>& result) const {
+		withinRadius(0, (int)entries.size(), query, radius * radius, result);
+	}
+};
+
+struct RrtStarSettings {
+	float radius = 0.4f _METER; // of the vehicle, plus margin
+	float step = 3 _METER;		// longest edge
+	float goalBias = 0.05f;		// share of samples at the goal
+	int batchSize = 64;			// per thread
+	int maxNodes = 200000;
+	u64 seed = 1;
+};
+
+// Asymptotically optimal sampling-based planner (RRT*, informed once a path is known) for a vehicle
+// of the given radius in the free space of a VoxelMap.
+// Samples are drawn and connected in batches: for every sample of a batch the nearest node, the
+// neighbours, the best collision-free parent and the edges worth rewiring are found in parallel on a
+// ThreadPool, against the tree as it was at the start of the batch. Inserting the batch and rewiring
+// is then a short serial pass. Samples of one batch do not see each other, which costs some path
+// quality per sample but keeps the expensive part free of locks.
+// The tree's nodes are indexed by a k-d tree that is rebuilt whenever a quarter of the nodes is new,
+// the newer ones are searched linearly. solve() is anytime: it stops when the time budget is spent and
+// can be called again to keep improving the path.
+class RrtStarPlanner {
+private:
+	enum { MAX_NEIGHBORS = 32 };
+
+	struct Node {
+		core::vector3df position;
+		int parent;
+		float cost;			// path length from the start
+		int firstChild, nextSibling;
+	};
+
+	// Result of connecting one sample; parent -1 if it could not be connected
+	struct Candidate {
+		core::vector3df position;
+		int parent;
+		int neighborCount;
+		int neighbors[MAX_NEIGHBORS];
+		u32 rewireMask;		// neighbours reachable on a free edge that might get cheaper through the sample
+		bool reachesGoal;
+	};
+
+	const VoxelMap* map;
+	ThreadPool* pool;
+	RrtStarSettings settings;
+	core::aabbox3df bounds;
+	core::vector3df start, goal;
+
+	std::vector<Node> nodes;
+	KdTree index;
+	int indexed = 0; // nodes [0, indexed) are in the k-d tree
+	std::vector<Candidate> candidates;
+	std::vector<int> goalNodes; // nodes with a free edge to the goal
+	int bestGoalNode = -1;
+	float bestCost = 0.f;
+	u64 samples = 0;
+	std::vector<int> stack;
+	std::vector<core::vector3df> positions;
+
+	// Informed sampling: uniform in the ellipsoid of all points whose path via them can be shorter
+	// than the best one, with the start and the goal as foci
+	core::vector3df sampleInformed(u64 counter) const {
+		u64 stream = CounterRng::makeStream(settings.seed, 1);
+		core::vector3df ball;
+		for (int tries = 0; tries < 16; ++tries) {
+			ball.set(CounterRng::uniform(stream, 3 * (counter * 16 + tries)) * 2 - 1,
+				CounterRng::uniform(stream, 3 * (counter * 16 + tries) + 1) * 2 - 1,
+				CounterRng::uniform(stream, 3 * (counter * 16 + tries) + 2) * 2 - 1);
+			if (ball.getLengthSQ() <= 1)
+				break;
+		}
+		float minCost = start.getDistanceFrom(goal);
+		float a = bestCost / 2, b = sqrtf(core::max_(bestCost * bestCost - minCost * minCost, 0.f)) / 2;
+		core::vector3df axis = (goal - start) / core::max_(minCost, 1e-3f);
+		core::vector3df side = fabsf(axis.Y) < 0.9f ? axis.crossProduct(core::vector3df(0, 1, 0)) : axis.crossProduct(core::vector3df(1, 0, 0));
+		side.normalize();
+		core::vector3df up = axis.crossProduct(side);
+		return (start + goal) * 0.5f + axis * (a * ball.X) + side * (b * ball.Y) + up * (b * ball.Z);
+	}
+
+	core::vector3df sample(u64 counter) const {
+		u64 stream = CounterRng::makeStream(settings.seed, 0);
+		if (CounterRng::uniform(stream, 4 * counter) < settings.goalBias)
+			return goal;
+		if (bestGoalNode >= 0) {
+			core::vector3df informed = sampleInformed(counter);
+			informed.X = core::clamp(informed.X, bounds.MinEdge.X, bounds.MaxEdge.X);
+			informed.Y = core::clamp(informed.Y, bounds.MinEdge.Y, bounds.MaxEdge.Y);
+			informed.Z = core::clamp(informed.Z, bounds.MinEdge.Z, bounds.MaxEdge.Z);
+			return informed;
+		}
+		core::vector3df extent = bounds.getExtent();
+		return bounds.MinEdge + core::vector3df(extent.X * CounterRng::uniform(stream, 4 * counter + 1),
+			extent.Y * CounterRng::uniform(stream, 4 * counter + 2), extent.Z * CounterRng::uniform(stream, 4 * counter + 3));
+	}
+
+	int findNearest(const core::vector3df& position) const {
+		float bestSq = FLT_MAX;
+		int best = index.nearest(position, bestSq);
+		for (int i = indexed; i < (int)nodes.size(); ++i) {
+			float distanceSq = nodes[i].position.getDistanceFromSQ(position);
+			if (distanceSq < bestSq) {
+				bestSq = distanceSq;
+				best = i;
+			}
+		}
+		return best;
+	}
+
+	// Shrinks with the number of nodes as RRT* needs, never beyond two steps
+	float getNeighborRadius() const {
+		core::vector3df extent = bounds.getExtent();
+		float volume = extent.X * extent.Y * extent.Z;
+		// 1.1 times the lower bound for asymptotic optimality in three dimensions
+		float gamma = 1.1f * 1.387f * cbrtf(volume / 4.18879f);
+		float n = (float)nodes.size() + 1;
+		return core::min_(gamma * cbrtf(logf(n) / n), 2 * settings.step);
+	}
+
+	void connect(Candidate& candidate, u64 counter, float neighborRadius, std::vector<int>& near) const {
+		candidate.parent = -1;
+		candidate.neighborCount = 0;
+		candidate.rewireMask = 0;
+		candidate.reachesGoal = false;
+		core::vector3df target = sample(counter);
+		int nearest = findNearest(target);
+		core::vector3df from = nodes[nearest].position;
+		core::vector3df delta = target - from;
+		float length = delta.getLength();
+		if (length > settings.step)
+			target = from + delta * (settings.step / length);
+		if (map->getDistance(target) <= settings.radius)
+			return;
+		candidate.position = target;
+
+		// Neighbours by the cost through them, nearest first if there are too many
+		near.clear();
+		index.withinRadius(target, neighborRadius, near);
+		for (int i = indexed; i < (int)nodes.size(); ++i)
+			if (nodes[i].position.getDistanceFromSQ(target) <= neighborRadius * neighborRadius)
+				near.push_back(i);
+		if (std::find(near.begin(), near.end(), nearest) == near.end())
+			near.push_back(nearest);
+		if ((int)near.size() > MAX_NEIGHBORS) {
+			std::nth_element(near.begin(), near.begin() + MAX_NEIGHBORS, near.end(), [&](int a, int b) {
+				return nodes[a].position.getDistanceFromSQ(target) < nodes[b].position.getDistanceFromSQ(target); });
+			near.resize(MAX_NEIGHBORS);
+		}
+		std::sort(near.begin(), near.end(), [&](int a, int b) {
+			return nodes[a].cost + nodes[a].position.getDistanceFrom(target) < nodes[b].cost + nodes[b].position.getDistanceFrom(target); });
+
+		// The cheapest neighbour with a free edge becomes the parent, edges are only checked until then
+		int parentSlot = -1;
+		for (int i = 0; i < (int)near.size() && parentSlot < 0; ++i)
+			if (map->isSegmentFree(nodes[near[i]].position, target, settings.radius))
+				parentSlot = i;
+		if (parentSlot < 0)
+			return;
+		candidate.parent = near[parentSlot];
+		candidate.neighborCount = (int)near.size();
+		std::copy(near.begin(), near.end(), candidate.neighbors);
+		float cost = nodes[candidate.parent].cost + nodes[candidate.parent].position.getDistanceFrom(target);
+		for (int i = 0; i < (int)near.size(); ++i) {
+			const Node& node = nodes[near[i]];
+			if (i != parentSlot && cost + node.position.getDistanceFrom(target) < node.cost
+				&& map->isSegmentFree(target, node.position, settings.radius))
+				candidate.rewireMask |= 1u << i;
+		}
+		candidate.reachesGoal = target.getDistanceFrom(goal) <= settings.step && map->isSegmentFree(target, goal, settings.radius);
+	}
+
+	void link(int node, int parent) {
+		nodes[node].parent = parent;
+		nodes[node].nextSibling = nodes[parent].firstChild;
+		nodes[parent].firstChild = node;
+	}
+
+	void unlink(int node) {
+		int* next = &nodes[nodes[node].parent].firstChild;
+		while (*next != node)
+			next = &nodes[*next].nextSibling;
+		*next = nodes[node].nextSibling;
+	}
+
+	// Moves a node under a new parent and passes the change of cost on to its subtree
+	void rewire(int node, int parent, float cost) {
+		unlink(node);
+		link(node, parent);
+		float delta = cost - nodes[node].cost;
+		stack.clear();
+		stack.push_back(node);
+		while (!stack.empty()) {
+			int n = stack.back();
+			stack.pop_back();
+			nodes[n].cost += delta;
+			for (int child = nodes[n].firstChild; child >= 0; child = nodes[child].nextSibling)
+				stack.push_back(child);
+		}
+	}
+
+	void insert(const Candidate& candidate) {
+		if (candidate.parent < 0 || (int)nodes.size() >= settings.maxNodes)
+			return;
+		Node node;
+		node.position = candidate.position;
+		node.cost = nodes[candidate.parent].cost + nodes[candidate.parent].position.getDistanceFrom(candidate.position);
+		node.firstChild = -1;
+		int index = (int)nodes.size();
+		nodes.push_back(node);
+		link(index, candidate.parent);
+		for (int i = 0; i < candidate.neighborCount; ++i) {
+			if (!(candidate.rewireMask & (1u << i)))
+				continue;
+			int neighbor = candidate.neighbors[i];
+			float cost = node.cost + nodes[neighbor].position.getDistanceFrom(node.position);
+			// Costs only went down since the edge was checked, so the neighbour may not need it anymore
+			if (cost < nodes[neighbor].cost)
+				rewire(neighbor, index, cost);
+		}
+		if (candidate.reachesGoal)
+			goalNodes.push_back(index);
+	}
+
+	void updateIndex() {
+		if ((int)nodes.size() - indexed <= core::max_(64, indexed / 4))
+			return;
+		PROFILE_SCOPE("planner index");
+		positions.resize(nodes.size());
+		for (size_t i = 0; i < nodes.size(); ++i)
+			positions[i] = nodes[i].position;
+		index.build(positions.data(), (int)nodes.size());
+		indexed = (int)nodes.size();
+	}
+
+	void updateBest() {
+		for (size_t i = 0; i < goalNodes.size(); ++i) {
+			const Node& node = nodes[goalNodes[i]];
+			float cost = node.cost + node.position.getDistanceFrom(goal);
+			if (bestGoalNode < 0 || cost < bestCost) {
+				bestGoalNode = goalNodes[i];
+				bestCost = cost;
+			}
+		}
+		// Rewiring may have made the best one cheaper without making another one better
+		if (bestGoalNode >= 0)
+			bestCost = nodes[bestGoalNode].cost + nodes[bestGoalNode].position.getDistanceFrom(goal);
+	}
+
+public:
+	// pool may be NULL to plan on the calling thread only
+	RrtStarPlanner(const VoxelMap* map, ThreadPool* pool, const RrtStarSettings& settings = RrtStarSettings()) :
+		map(map), pool(pool), settings(settings) {}
+
+	// Starts a new search; samples are drawn inside bounds
+	void reset(const core::vector3df& start, const core::vector3df& goal, const core::aabbox3df& bounds) {
+		this->start = start;
+		this->goal = goal;
+		this->bounds = bounds;
+		nodes.clear();
+		goalNodes.clear();
+		index.build(NULL, 0);
+		indexed = 0;
+		bestGoalNode = -1;
+		bestCost = 0.f;
+		samples = 0;
+		Node root;
+		root.position = start;
+		root.parent = -1;
+		root.cost = 0.f;
+		root.firstChild = root.nextSibling = -1;
+		nodes.push_back(root);
+		if (start.getDistanceFrom(goal) <= settings.step && map->isSegmentFree(start, goal, settings.radius))
+			goalNodes.push_back(0);
+		updateBest();
+	}
+
+	// Grows the tree for the given time; true if a path to the goal is known
+	bool solve(float seconds) {
+		PROFILE_SCOPE("planner");
+		typedef std::chrono::steady_clock Clock;
+		Clock::time_point deadline = Clock::now() + std::chrono::microseconds((long long)(seconds * 1e6f));
+		int threads = pool != NULL ? pool->getThreadCount() : 1;
+		int batch = settings.batchSize * threads;
+		candidates.resize(batch);
+		while (Clock::now() < deadline && (int)nodes.size() < settings.maxNodes) {
+			updateIndex();
+			float neighborRadius = getNeighborRadius();
+			u64 first = samples;
+			auto connectRange = [&](int begin, int end) {
+				std::vector<int> near;
+				near.reserve(64);
+				for (int i = begin; i < end; ++i)
+					connect(candidates[i], first + i, neighborRadius, near);
+			};
+			if (pool != NULL)
+				pool->parallelFor(batch, settings.batchSize / 4 + 1, connectRange);
+			else
+				connectRange(0, batch);
+			samples += batch;
+			for (int i = 0; i < batch; ++i)
+				insert(candidates[i]);
+			updateBest();
+		}
+		return bestGoalNode >= 0;
+	}
+
+	bool isSolved() const {
+		return bestGoalNode >= 0;
+	}
+
+	// Length of the best path, 0 without one
+	float getBestCost() const {
+		return bestCost;
+	}
+
+	int getNodeCount() const {
+		return (int)nodes.size();
+	}
+
+	u64 getSampleCount() const {
+		return samples;
+	}
+
+	// The best path from the start to the goal found so far; false without one
+	bool getPath(std::vector<core::vector3df>& path) const {
+		path.clear();
+		if (bestGoalNode < 0)
+			return false;
+		path.push_back(goal);
+		for (int n = bestGoalNode; n >= 0; n = nodes[n].parent)
+			path.push_back(nodes[n].position);
+		std::reverse(path.begin(), path.end());
+		return true;
+	}
+};
+
+// A* over the voxels of a VoxelMap with 26 neighbours, as a baseline for the sampling planner. It finds
+// the shortest path on the voxel lattice, which is up to 8% longer than the straight one and expands
+// every voxel closer to the start than that; shortcutPath() straightens it.
+class GridAStar {
+private:
+	struct Visit {
+		float cost;
+		s64 parent;
+		bool closed;
+	};
+
+	struct Open {
+		float estimate; // cost plus heuristic
+		s64 key;
+		bool operator<(const Open& other) const {
+			return estimate > other.estimate;
+		}
+	};
+
+	const VoxelMap* map;
+	float radius;
+	std::unordered_map<s64, Visit> visits;
+	std::priority_queue<Open> open;
+	int expanded = 0;
+
+	static s64 pack(int x, int y, int z) {
+		return ((s64)(x & 0x1fffff) << 42) | ((s64)(y & 0x1fffff) << 21) | (s64)(z & 0x1fffff);
+	}
+
+	// Sign extends the 21 bit fields again
+	static void unpack(s64 key, int& x, int& y, int& z) {
+		x = (int)((key >> 42) & 0x1fffff) << 11 >> 11;
+		y = (int)((key >> 21) & 0x1fffff) << 11 >> 11;
+		z = (int)(key & 0x1fffff) << 11 >> 11;
+	}
+
+	core::vector3df getCenter(int x, int y, int z) const {
+		return core::vector3df(x + 0.5f, y + 0.5f, z + 0.5f) * map->getVoxelSize();
+	}
+
+public:
+	GridAStar(const VoxelMap* map, float radius) : map(map), radius(radius) {}
+
+	// Searches within bounds and gives up after maxExpanded voxels; the path starts at start and ends
+	// at goal, with voxel centers between
+	bool plan(const core::vector3df& start, const core::vector3df& goal, const core::aabbox3df& bounds,
+		std::vector<core::vector3df>& path, int maxExpanded = 2000000) {
+		PROFILE_SCOPE("grid planner");
+		path.clear();
+		visits.clear();
+		open = std::priority_queue<Open>();
+		expanded = 0;
+		float voxelSize = map->getVoxelSize();
+		int sx = (int)floorf(start.X / voxelSize), sy = (int)floorf(start.Y / voxelSize), sz = (int)floorf(start.Z / voxelSize);
+		int gx = (int)floorf(goal.X / voxelSize), gy = (int)floorf(goal.Y / voxelSize), gz = (int)floorf(goal.Z / voxelSize);
+		s64 goalKey = pack(gx, gy, gz);
+		core::vector3df goalCenter = getCenter(gx, gy, gz);
+
+		Visit first = { 0.f, -1, false };
+		visits[pack(sx, sy, sz)] = first;
+		Open entry = { getCenter(sx, sy, sz).getDistanceFrom(goalCenter), pack(sx, sy, sz) };
+		open.push(entry);
+		while (!open.empty() && expanded < maxExpanded) {
+			s64 key = open.top().key;
+			open.pop();
+			Visit& visit = visits[key];
+			if (visit.closed)
+				continue;
+			visit.closed = true;
+			++expanded;
+			if (key == goalKey) {
+				path.push_back(goal);
+				for (s64 k = visits[key].parent; k >= 0 && visits[k].parent >= 0; k = visits[k].parent) {
+					int x, y, z;
+					unpack(k, x, y, z);
+					path.push_back(getCenter(x, y, z));
+				}
+				path.push_back(start);
+				std::reverse(path.begin(), path.end());
+				return true;
+			}
+			float cost = visit.cost;
+			int x, y, z;
+			unpack(key, x, y, z);
+			for (int dz = -1; dz <= 1; ++dz)
+				for (int dy = -1; dy <= 1; ++dy)
+					for (int dx = -1; dx <= 1; ++dx) {
+						if (dx == 0 && dy == 0 && dz == 0)
+							continue;
+						core::vector3df center = getCenter(x + dx, y + dy, z + dz);
+						if (!bounds.isPointInside(center) || map->getDistance(center) <= radius)
+							continue;
+						s64 next = pack(x + dx, y + dy, z + dz);
+						float nextCost = cost + sqrtf((float)(dx * dx + dy * dy + dz * dz)) * voxelSize;
+						std::unordered_map<s64, Visit>::iterator it = visits.find(next);
+						if (it != visits.end() && (it->second.closed || it->second.cost <= nextCost))
+							continue;
+						Visit v = { nextCost, key, false };
+						visits[next] = v;
+						Open o = { nextCost + center.getDistanceFrom(goalCenter), next };
+						open.push(o);
+					}
+		}
+		return false;
+	}
+
+	int getExpanded() const {
+		return expanded;
+	}
+};
+
+// Drops every waypoint the vehicle can skip by flying straight from the last kept one
+inline void shortcutPath(const VoxelMap* map, float radius, std::vector<core::vector3df>& path) {
+	if (path.size() <= 2)
+		return;
+	std::vector<core::vector3df> result(1, path[0]);
+	size_t from = 0;
+	while (from + 1 < path.size()) {
+		size_t to = path.size() - 1;
+		while (to > from + 1 && !map->isSegmentFree(path[from], path[to], radius))
+			--to;
+		result.push_back(path[to]);
+		from = to;
+	}
+	path.swap(result);
+}
+
+// Times a path for flying it at a constant speed; the first and the last leg take rampTime / 2
+// longer for speeding up and slowing down
+inline void makeTimedWaypoints(const std::vector<core::vector3df>& path, float speed, float rampTime,
+	std::vector<TimedWaypoint>& waypoints) {
+	waypoints.clear();
+	float time = 0.f;
+	for (size_t i = 0; i < path.size(); ++i) {
+		if (i > 0)
+			time += path[i].getDistanceFrom(path[i - 1]) / speed;
+		if (i == 1)
+			time += rampTime / 2;
+		if (i > 0 && i + 1 == path.size())
+			time += rampTime / 2;
+		TimedWaypoint waypoint = { path[i], time };
+		waypoints.push_back(waypoint);
+	}
+}
@@ -0,0 +1,344 @@
+#pragma once
+#include <irrlicht.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace irr;
+
+#define PROFILER_BUFFER_SIZE 16384 // events per thread between two calls of Profiler::collect
+#define PROFILER_MAX_RECORDED (1 << 21) // events kept for export, about 70 MB; later ones are dropped
+
+// Scoped instrumentation: PROFILE_SCOPE("name") measures until the end of the enclosing block.
+// The name has to be a string literal, scopes are identified by its address.
+#ifdef NO_PROFILER
+#define PROFILE_SCOPE(name)
+#define PROFILE_FUNCTION()
+#else
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+#endif
+
+struct ProfileEvent {
+	const char* name;
+	s64 start, end; // ns on steady_clock
+	u16 depth;
+};
+
+// One event in a thread's ring buffer. The fields are atomics because collect() may read a slot while
+// the writer reuses it; such a copy is torn, and collect() rejects it by the write count.
+struct ProfileSlot {
+	std::atomic<const char*> name;
+	std::atomic<s64> start, end;
+	std::atomic<u16> depth;
+};
+
+// Written only by its own thread; other threads read up to the published write count
+struct ProfileThreadBuffer {
+	ProfileSlot events[PROFILER_BUFFER_SIZE];
+	std::atomic<u64> written;
+	u64 collected = 0;
+	u16 depth = 0;
+	u16 tid;
+	std::string name;
+
+	ProfileThreadBuffer(u16 tid) : tid(tid) {
+		written = 0;
+	}
+};
+
+// Collects the events of all threads, keeps rolling per-scope timings and optionally records
+// everything for export as Chrome trace-event JSON (chrome://tracing, Perfetto) or binary.
+//
+// Binary format, little endian:
+//   "QPRF", u32 version = 1
+//   u32 numThreads, per thread: u16 tid, u16 nameLength, name
+//   u32 numNames, per name: u16 length, name
+//   u64 numEvents, per event: u16 nameIndex, u16 tid, u16 depth, s64 startNs, u32 durationNs
+class Profiler {
+public:
+	struct ScopeStats {
+		const char* name;
+		u16 depth;
+		s64 firstStart;
+		float frameMs = 0.f; // summed over the current frame
+		u32 frameCalls = 0;
+		float avgMs = 0.f;	 // rolling average per frame
+		float peakMs = 0.f;	 // slowly decaying maximum
+		u32 calls = 0;		 // calls in the last frame
+	};
+
+private:
+	std::atomic<bool> enabled;
+	std::mutex registryMutex;
+	std::vector<ProfileThreadBuffer*> threads;
+
+	std::map<const char*, int> statIndices;
+	std::vector<ScopeStats> stats;
+	std::vector<int> displayOrder;
+
+	bool recording = false;
+	std::vector<ProfileEvent> recorded;
+	std::vector<u16> recordedTids;
+	u64 droppedEvents = 0; // beyond PROFILER_MAX_RECORDED
+
+	Profiler() {
+		enabled = false;
+	}
+
+	~Profiler() {
+		for (size_t i = 0; i < threads.size(); ++i)
+			delete threads[i];
+	}
+
+	static void writeJsonString(FILE* file, const char* str) {
+		fputc('"', file);
+		for (; *str; ++str) {
+			if (*str == '"' || *str == '\\')
+				fputc('\\', file);
+			fputc(*str, file);
+		}
+		fputc('"', file);
+	}
+
+public:
+	static Profiler& get() {
+		static Profiler profiler;
+		return profiler;
+	}
+
+	static s64 now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Buffer of the calling thread, registered on first use
+	ProfileThreadBuffer* getThreadBuffer() {
+		static thread_local ProfileThreadBuffer* buffer = NULL;
+		if (buffer == NULL) {
+			std::lock_guard<std::mutex> lock(registryMutex);
+			buffer = new ProfileThreadBuffer((u16)threads.size());
+			threads.push_back(buffer);
+		}
+		return buffer;
+	}
+
+	void setThreadName(const char* name) {
+		getThreadBuffer()->name = name;
+	}
+
+	void setEnabled(bool enabled) {
+		this->enabled = enabled;
+	}
+
+	bool isEnabled() const {
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	// Keeps the collected events until export, up to PROFILER_MAX_RECORDED
+	void setRecording(bool recording) {
+		this->recording = recording;
+	}
+
+	// Call once per frame from the main thread: reads the new events of all threads
+	// and updates the rolling timings.
+	void collect() {
+		std::vector<ProfileThreadBuffer*> buffers;
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+			buffers = threads;
+		}
+		for (size_t t = 0; t < buffers.size(); ++t) {
+			ProfileThreadBuffer* buffer = buffers[t];
+			u64 written = buffer->written.load(std::memory_order_acquire);
+			// Events overwritten since the last collect are lost
+			if (written - buffer->collected > PROFILER_BUFFER_SIZE)
+				buffer->collected = written - PROFILER_BUFFER_SIZE;
+			for (; buffer->collected < written; ++buffer->collected) {
+				const ProfileSlot& slot = buffer->events[buffer->collected % PROFILER_BUFFER_SIZE];
+				ProfileEvent e;
+				e.name = slot.name.load(std::memory_order_relaxed);
+				e.start = slot.start.load(std::memory_order_relaxed);
+				e.end = slot.end.load(std::memory_order_relaxed);
+				e.depth = slot.depth.load(std::memory_order_relaxed);
+				// Seqlock check: the fence pairs with the writer's, so if the copy saw any store of a newer event,
+				// the count read below includes it. The writer may have lapped us while copying: once it is
+				// a full buffer ahead, its next event goes to this slot.
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (buffer->written.load(std::memory_order_relaxed) - buffer->collected >= PROFILER_BUFFER_SIZE)
+					continue;
+				std::map<const char*, int>::iterator it = statIndices.find(e.name);
+				int idx;
+				if (it == statIndices.end()) {
+					idx = (int)stats.size();
+					statIndices[e.name] = idx;
+					stats.push_back(ScopeStats());
+					stats[idx].name = e.name;
+					stats[idx].depth = e.depth;
+					stats[idx].firstStart = e.start;
+					displayOrder.push_back(idx);
+					// Parents start before their children
+					std::sort(displayOrder.begin(), displayOrder.end(),
+						[this](int a, int b) { return stats[a].firstStart < stats[b].firstStart; });
+				}
+				else
+					idx = it->second;
+				stats[idx].frameMs += (e.end - e.start) / 1e6f;
+				stats[idx].frameCalls++;
+				if (recording && recorded.size() >= PROFILER_MAX_RECORDED)
+					++droppedEvents;
+				else if (recording) {
+					recorded.push_back(e);
+					recordedTids.push_back(buffer->tid);
+				}
+			}
+		}
+		for (size_t i = 0; i < stats.size(); ++i) {
+			ScopeStats& s = stats[i];
+			s.avgMs = s.avgMs * 0.95f + s.frameMs * 0.05f;
+			s.peakMs = core::max_(s.peakMs * 0.995f, s.frameMs);
+			s.calls = s.frameCalls;
+			s.frameMs = 0.f;
+			s.frameCalls = 0;
+		}
+	}
+
+	int getNumScopes() {
+		return (int)displayOrder.size();
+	}
+
+	// Scopes ordered by their first appearance, so nested scopes follow their parent
+	const ScopeStats& getScope(int i) {
+		return stats[displayOrder[i]];
+	}
+
+	// Recorded events that did not fit into PROFILER_MAX_RECORDED
+	u64 getDroppedEvents() const {
+		return droppedEvents;
+	}
+
+	bool exportChromeJson(const char* fileName) {
+		FILE* file = fopen(fileName, "w");
+		if (file == NULL)
+			return false;
+		s64 origin = recorded.empty() ? 0 : recorded[0].start;
+		for (size_t i = 0; i < recorded.size(); ++i)
+			origin = core::min_(origin, recorded[i].start);
+		fprintf(file, "{\"traceEvents\":[\n");
+		bool first = true;
+		for (size_t t = 0; t < threads.size(); ++t) {
+			if (threads[t]->name.empty())
+				continue;
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+				first ? "" : ",\n", (u32)threads[t]->tid);
+			writeJsonString(file, threads[t]->name.c_str());
+			fprintf(file, "}}");
+			first = false;
+		}
+		for (size_t i = 0; i < recorded.size(); ++i) {
+			const ProfileEvent& e = recorded[i];
+			fprintf(file, "%s{\"name\":", first ? "" : ",\n");
+			writeJsonString(file, e.name);
+			fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				(u32)recordedTids[i], (e.start - origin) / 1e3, (e.end - e.start) / 1e3);
+			first = false;
+		}
+		fprintf(file, "\n]}\n");
+		return fclose(file) == 0;
+	}
+
+	bool exportBinary(const char* fileName) {
+		FILE* file = fopen(fileName, "wb");
+		if (file == NULL)
+			return false;
+		fwrite("QPRF", 1, 4, file);
+		u32 version = 1;
+		fwrite(&version, sizeof(version), 1, file);
+
+		u32 numThreads = (u32)threads.size();
+		fwrite(&numThreads, sizeof(numThreads), 1, file);
+		for (size_t t = 0; t < threads.size(); ++t) {
+			u16 length = (u16)threads[t]->name.size();
+			fwrite(&threads[t]->tid, sizeof(u16), 1, file);
+			fwrite(&length, sizeof(length), 1, file);
+			fwrite(threads[t]->name.data(), 1, length, file);
+		}
+
+		std::map<const char*, u16> nameIndices;
+		std::vector<const char*> names;
+		for (size_t i = 0; i < recorded.size(); ++i)
+			if (nameIndices.find(recorded[i].name) == nameIndices.end()) {
+				nameIndices[recorded[i].name] = (u16)names.size();
+				names.push_back(recorded[i].name);
+			}
+		u32 numNames = (u32)names.size();
+		fwrite(&numNames, sizeof(numNames), 1, file);
+		for (size_t i = 0; i < names.size(); ++i) {
+			u16 length = (u16)strlen(names[i]);
+			fwrite(&length, sizeof(length), 1, file);
+			fwrite(names[i], 1, length, file);
+		}
+
+		u64 numEvents = recorded.size();
+		fwrite(&numEvents, sizeof(numEvents), 1, file);
+		for (size_t i = 0; i < recorded.size(); ++i) {
+			const ProfileEvent& e = recorded[i];
+			u16 header[3] = { nameIndices[e.name], recordedTids[i], e.depth };
+			u32 duration = (u32)core::min_(e.end - e.start, (s64)0xffffffff);
+			fwrite(header, sizeof(u16), 3, file);
+			fwrite(&e.start, sizeof(s64), 1, file);
+			fwrite(&duration, sizeof(duration), 1, file);
+		}
+		return fclose(file) == 0;
+	}
+
+	// Chooses the format by the file extension
+	bool exportTrace(const char* fileName) {
+		size_t length = strlen(fileName);
+		if (length >= 5 && strcmp(fileName + length - 5, ".json") == 0)
+			return exportChromeJson(fileName);
+		return exportBinary(fileName);
+	}
+};
+
+
+class ProfileScope {
+private:
+	ProfileThreadBuffer* buffer;
+	const char* name;
+	s64 start;
+
+public:
+	ProfileScope(const char* name) : buffer(NULL), name(name) {
+		Profiler& profiler = Profiler::get();
+		if (!profiler.isEnabled())
+			return;
+		buffer = profiler.getThreadBuffer();
+		buffer->depth++;
+		start = Profiler::now();
+	}
+
+	~ProfileScope() {
+		if (buffer == NULL)
+			return;
+		s64 end = Profiler::now();
+		buffer->depth--;
+		u64 w = buffer->written.load(std::memory_order_relaxed);
+		// Orders the last count before the slot stores, for the reader's seqlock check
+		std::atomic_thread_fence(std::memory_order_release);
+		ProfileSlot& e = buffer->events[w % PROFILER_BUFFER_SIZE];
+		e.name.store(name, std::memory_order_relaxed);
+		e.start.store(start, std::memory_order_relaxed);
+		e.end.store(end, std::memory_order_relaxed);
+		e.depth.store(buffer->depth, std::memory_order_relaxed);
+		buffer->written.store(w + 1, std::memory_order_release);
+	}
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include <irrlicht.h>
+#include <cmath>
+
+using namespace irr;
+
+enum RotorLod {
+	RL_MESH,	// propeller mesh, spinning
+	RL_DISC,	// translucent disc, the propeller is too fast or too small to be seen turning
+	RL_IMPOSTOR // the whole vehicle is a single camera facing quad
+};
+
+// Thresholds for choosing how vehicles and their rotors are drawn
+struct PropellerLod {
+	// Above this speed in rotations per second a rotor is drawn as a disc. A two-bladed propeller
+	// looks the same after half a turn, so beyond a quarter turn per frame its spin aliases anyway.
+	float discSpeed = 15.f;
+	// Rotors smaller than this radius on screen in pixels are drawn as discs
+	float discPixels = 8.f;
+	// Vehicles smaller than this radius on screen in pixels collapse to the impostor
+	float impostorPixels = 4.f;
+
+	// Vehicle level decision; returns RL_MESH if the rotors have to be decided one by one
+	RotorLod selectVehicle(float distance, float vehicleRadius, float pixelsPerUnit) const {
+		if (vehicleRadius * pixelsPerUnit < impostorPixels * distance)
+			return RL_IMPOSTOR;
+		return RL_MESH;
+	}
+
+	RotorLod selectRotor(float distance, float rotorRadius, float rotationsPerSecond, float pixelsPerUnit) const {
+		if (fabsf(rotationsPerSecond) > discSpeed || rotorRadius * pixelsPerUnit < discPixels * distance)
+			return RL_DISC;
+		return RL_MESH;
+	}
+
+	// Size in pixels of one unit at distance 1 in front of the camera
+	static float getPixelsPerUnit(scene::ICameraSceneNode* camera, video::IVideoDriver* driver) {
+		return driver->getCurrentRenderTargetSize().Height * 0.5f / tanf(camera->getFOV() * 0.5f);
+	}
+
+	// Radius of the propellers of a vehicle of the given size, for its physics, collisions and drawing alike
+	static float getRotorRadius(float size) {
+		return size / 2;
+	}
+
+	// Scale that makes the propeller mesh as wide as getRotorRadius()
+	static float getPropellerScale(scene::IMesh* propeller, float size) {
+		if (propeller == NULL)
+			return 1.f;
+		core::vector3df extent = propeller->getBoundingBox().getExtent();
+		return getRotorRadius(size) / (core::max_(extent.X, extent.Y, extent.Z) / 2);
+	}
+
+	// Disc lying in the rotor plane, opaque in the middle and fading out to the rim
+	static scene::SMeshBuffer* createDiscMeshBuffer(float radius, video::SColor color, int segments = 16) {
+		scene::SMeshBuffer* buffer = new scene::SMeshBuffer();
+		video::SColor center = color, rim = color;
+		center.setAlpha(110);
+		rim.setAlpha(30);
+		buffer->Vertices.push_back(video::S3DVertex(0, 0, 0, 0, 1, 0, center, 0.5f, 0.5f));
+		for (int i = 0; i < segments; ++i) {
+			float a = 2 * core::PI * i / segments;
+			buffer->Vertices.push_back(video::S3DVertex(radius * cosf(a), 0, radius * sinf(a), 0, 1, 0, rim,
+				0.5f + 0.5f * cosf(a), 0.5f + 0.5f * sinf(a)));
+		}
+		for (int i = 0; i < segments; ++i) {
+			buffer->Indices.push_back(0);
+			buffer->Indices.push_back((u16)(1 + (i + 1) % segments));
+			buffer->Indices.push_back((u16)(1 + i));
+		}
+		buffer->recalculateBoundingBox();
+
+		video::SMaterial& material = buffer->Material;
+		material.Lighting = false;
+		material.BackfaceCulling = false;
+		material.ZWriteEnable = false;
+		material.MaterialType = video::EMT_TRANSPARENT_VERTEX_ALPHA;
+		return buffer;
+	}
+};
@@ -0,0 +1,242 @@
+#pragma once
+#include <irrlicht.h>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+using namespace irr;
+
+#define _METER *100
+
+// Thrust and drag torque of a propeller over rotation speed and axial airspeed, and motor current
+// over throttle, as tables on uniform grids. A lookup is an index computation and one bilinear
+// (thrust and torque together) or linear interpolation, with no search and no transcendental call.
+// Tables either come from CSV measurements (e.g. a thrust stand or a propeller database) or are
+// generated from the quadratic propeller law. Negative rotation speeds mirror the table.
+// The first-order motor lag factor exp(-dt / tau) is cached for the last step size.
+// One model is shared by all vehicles with the same propulsion; it is reference counted.
+//
+// Values are in world units: rotations per second, cm/s, kg cm/s^2 for thrust, kg cm^2/s^2 for torque.
+// The axial airspeed is the rotor's speed through the air along its axis: positive when climbing,
+// the air then flows in from above and the thrust drops.
+class PropulsionModel : public virtual IReferenceCounted {
+private:
+	enum { SPEED_STEPS = 64, AIRSPEED_STEPS = 32, THROTTLE_STEPS = 64 };
+
+	float maxSpeed, invSpeedStep;
+	float maxAirspeed, invAirspeedStep;
+	std::vector<float> thrustTorque; // pairs, rows of constant speed
+	std::vector<float> current;		 // over throttle 0..1
+
+	float timeConstant = 0.05f; // seconds, typical of small brushless motors
+	mutable float cachedStep = -1.f, cachedLag = 0.f;
+
+	void setGrid(float maxSpeed, float maxAirspeed) {
+		this->maxSpeed = maxSpeed;
+		this->maxAirspeed = maxAirspeed;
+		invSpeedStep = (SPEED_STEPS - 1) / maxSpeed;
+		invAirspeedStep = (AIRSPEED_STEPS - 1) / (2 * maxAirspeed);
+		thrustTorque.assign(SPEED_STEPS * AIRSPEED_STEPS * 2, 0.f);
+	}
+
+	float getSpeed(int i) const {
+		return i / invSpeedStep;
+	}
+
+	float getAirspeed(int j) const {
+		return j / invAirspeedStep - maxAirspeed;
+	}
+
+	// Reads rows of numbers separated by commas, semicolons or whitespace; other lines (headers) are skipped
+	static bool readCsv(const char* fileName, int columns, std::vector<float>& values) {
+		FILE* file = fopen(fileName, "r");
+		if (file == NULL) {
+			printf("PropulsionModel: could not open %s\n", fileName);
+			return false;
+		}
+		char line[1024];
+		while (fgets(line, sizeof(line), file) != NULL) {
+			float row[8];
+			int n = 0;
+			char* p = line;
+			while (n < columns) {
+				char* end;
+				row[n] = strtof(p, &end);
+				if (end == p)
+					break;
+				n++;
+				p = end;
+				while (*p == ',' || *p == ';' || *p == ' ' || *p == '\t')
+					p++;
+			}
+			if (n == columns)
+				values.insert(values.end(), row, row + columns);
+		}
+		fclose(file);
+		return !values.empty();
+	}
+
+	// Position of v between the sorted samples, as index and fraction
+	static void locate(const std::vector<float>& samples, float v, int& i, float& t) {
+		if (samples.size() == 1) {
+			i = 0;
+			t = 0.f;
+			return;
+		}
+		i = (int)(std::upper_bound(samples.begin(), samples.end(), v) - samples.begin()) - 1;
+		i = core::clamp(i, 0, (int)samples.size() - 2);
+		t = core::clamp((v - samples[i]) / (samples[i + 1] - samples[i]), 0.f, 1.f);
+	}
+
+public:
+	// Quadratic thrust that equals hoverThrust at hoverSpeed. The thrust vanishes when the axial airspeed
+	// reaches pitch * speed (the distance a rotation screws through the air) and rises by up to half in descent.
+	// The drag torque is torquePerThrust times the thrust; the current rises with the cube of the throttle.
+	PropulsionModel(float maxSpeed, float hoverSpeed, float hoverThrust, float pitch, float torquePerThrust,
+		float maxCurrent = 20.f) {
+		setGrid(maxSpeed, 30 _METER);
+		float kT = hoverThrust / (hoverSpeed * hoverSpeed);
+		for (int i = 0; i < SPEED_STEPS; ++i)
+			for (int j = 0; j < AIRSPEED_STEPS; ++j) {
+				float n = getSpeed(i);
+				float factor = n > 0 ? core::clamp(1.f - getAirspeed(j) / (pitch * n), 0.f, 1.5f) : 0.f;
+				float thrust = kT * n * n * factor;
+				thrustTorque[2 * (i * AIRSPEED_STEPS + j)] = thrust;
+				thrustTorque[2 * (i * AIRSPEED_STEPS + j) + 1] = thrust * torquePerThrust;
+			}
+		current.resize(THROTTLE_STEPS);
+		for (int i = 0; i < THROTTLE_STEPS; ++i) {
+			float throttle = (float)i / (THROTTLE_STEPS - 1);
+			current[i] = maxCurrent * throttle * throttle * throttle;
+		}
+	}
+
+	// Columns: rpm, axial airspeed in m/s, thrust in N, torque in Nm. The rows have to cover every
+	// combination of the rpm and airspeed values that occur; they are resampled to the uniform grid.
+	// Below the lowest measured rpm thrust and torque fall linearly to zero at 0 rpm.
+	bool loadPropellerCsv(const char* fileName) {
+		std::vector<float> values;
+		if (!readCsv(fileName, 4, values))
+			return false;
+		std::vector<float> speeds, airspeeds;
+		for (size_t r = 0; r < values.size(); r += 4) {
+			speeds.push_back(values[r] / 60);
+			airspeeds.push_back(values[r + 1] _METER);
+		}
+		std::sort(speeds.begin(), speeds.end());
+		speeds.erase(std::unique(speeds.begin(), speeds.end()), speeds.end());
+		std::sort(airspeeds.begin(), airspeeds.end());
+		airspeeds.erase(std::unique(airspeeds.begin(), airspeeds.end()), airspeeds.end());
+		size_t ns = speeds.size(), na = airspeeds.size();
+		if (ns * na != values.size() / 4 || speeds.back() <= 0) {
+			printf("PropulsionModel: %s is no complete rpm x airspeed grid\n", fileName);
+			return false;
+		}
+		// A standing propeller gives nothing, whatever the airspeed
+		if (speeds.front() > 0) {
+			speeds.insert(speeds.begin(), 0.f);
+			ns++;
+		}
+		std::vector<float> grid(ns * na * 2, 0.f);
+		for (size_t r = 0; r < values.size(); r += 4) {
+			size_t i = std::lower_bound(speeds.begin(), speeds.end(), values[r] / 60) - speeds.begin();
+			size_t j = std::lower_bound(airspeeds.begin(), airspeeds.end(), values[r + 1] _METER) - airspeeds.begin();
+			grid[2 * (i * na + j)] = values[r + 2] _METER;
+			grid[2 * (i * na + j) + 1] = values[r + 3] _METER _METER;
+		}
+
+		setGrid(speeds.back(), core::max_(fabsf(airspeeds.front()), fabsf(airspeeds.back()), 1.f));
+		for (int i = 0; i < SPEED_STEPS; ++i)
+			for (int j = 0; j < AIRSPEED_STEPS; ++j) {
+				int si, aj;
+				float st, at;
+				locate(speeds, getSpeed(i), si, st);
+				locate(airspeeds, getAirspeed(j), aj, at);
+				int si1 = core::min_(si + 1, (int)ns - 1), aj1 = core::min_(aj + 1, (int)na - 1);
+				for (int k = 0; k < 2; ++k) {
+					float a = grid[2 * (si * na + aj) + k], b = grid[2 * (si * na + aj1) + k];
+					float c = grid[2 * (si1 * na + aj) + k], d = grid[2 * (si1 * na + aj1) + k];
+					float low = a + (b - a) * at, high = c + (d - c) * at;
+					thrustTorque[2 * (i * AIRSPEED_STEPS + j) + k] = low + (high - low) * st;
+				}
+			}
+		return true;
+	}
+
+	// Columns: throttle from 0 to 1, current in A. Rows with the same throttle are averaged.
+	bool loadMotorCsv(const char* fileName) {
+		std::vector<float> values;
+		if (!readCsv(fileName, 2, values))
+			return false;
+		std::vector<std::pair<float, float> > rows;
+		for (size_t r = 0; r < values.size(); r += 2)
+			rows.push_back(std::make_pair(values[r], values[r + 1]));
+		std::sort(rows.begin(), rows.end());
+		std::vector<float> throttles, currents;
+		int merged = 1;
+		for (size_t r = 0; r < rows.size(); ++r) {
+			if (!throttles.empty() && rows[r].first == throttles.back()) {
+				currents.back() += (rows[r].second - currents.back()) / ++merged;
+				continue;
+			}
+			throttles.push_back(rows[r].first);
+			currents.push_back(rows[r].second);
+			merged = 1;
+		}
+		for (int i = 0; i < THROTTLE_STEPS; ++i) {
+			int k;
+			float t;
+			locate(throttles, (float)i / (THROTTLE_STEPS - 1), k, t);
+			current[i] = currents.size() == 1 ? currents[0] : currents[k] + (currents[k + 1] - currents[k]) * t;
+		}
+		return true;
+	}
+
+	// Time constant of the motors' first-order response to a new speed, in seconds
+	void setTimeConstant(float timeConstant) {
+		this->timeConstant = timeConstant;
+		cachedStep = -1.f;
+	}
+
+	// Fraction of the remaining difference to the wanted speed that is left after a step
+	float getLagFactor(float elapsedTime) const {
+		if (elapsedTime != cachedStep) {
+			cachedStep = elapsedTime;
+			cachedLag = expf(-elapsedTime / timeConstant);
+		}
+		return cachedLag;
+	}
+
+	float getMaxSpeed() const {
+		return maxSpeed;
+	}
+
+	// Thrust and drag torque at a rotation speed in rotations per second
+	void evaluate(float speed, float axialAirspeed, float& thrust, float& torque) const {
+		float sign = 1.f;
+		if (speed < 0) {
+			// A reversed rotor blows the other way
+			speed = -speed;
+			axialAirspeed = -axialAirspeed;
+			sign = -1.f;
+		}
+		float x = core::clamp(speed * invSpeedStep, 0.f, (float)(SPEED_STEPS - 1));
+		float y = core::clamp((axialAirspeed + maxAirspeed) * invAirspeedStep, 0.f, (float)(AIRSPEED_STEPS - 1));
+		int i = core::min_((int)x, SPEED_STEPS - 2), j = core::min_((int)y, AIRSPEED_STEPS - 2);
+		float tx = x - i, ty = y - j;
+		const float* cell = &thrustTorque[2 * (i * AIRSPEED_STEPS + j)];
+		const float* next = cell + 2 * AIRSPEED_STEPS;
+		float t0 = cell[0] + (cell[2] - cell[0]) * ty, t1 = next[0] + (next[2] - next[0]) * ty;
+		float q0 = cell[1] + (cell[3] - cell[1]) * ty, q1 = next[1] + (next[3] - next[1]) * ty;
+		thrust = sign * (t0 + (t1 - t0) * tx);
+		torque = sign * (q0 + (q1 - q0) * tx);
+	}
+
+	// Current drawn by one motor in A at a throttle between 0 and 1
+	float getCurrent(float throttle) const {
+		float x = core::clamp(throttle, 0.f, 1.f) * (THROTTLE_STEPS - 1);
+		int i = core::min_((int)x, THROTTLE_STEPS - 2);
+		return current[i] + (current[i + 1] - current[i]) * (x - i);
+	}
+};
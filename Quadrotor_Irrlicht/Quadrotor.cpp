@@ -1,29 +1,68 @@
 #include "Quadrotor.h"
+#include "Profiler.h"
+#include "HeightMap.h"
+#include "WindField.h"
+#include "BatteryBank.h"
 #include <cmath>
 
 #define _METER *100
 
-#define FORCE_FACTOR (2 * 9.81f _METER / 4 * weight / maxRPS) // half power: floating)
 #define DRAG_PER_SPEED  0.175f // A 80kg person will have static speed at 200 km/h (55 m/s)
 #define PI 3.14159265f
-#define YAW_FACTOR 1.f
-#define INERTIA (2*weight*WEIGHT_OUTER_FACTOR * size/2*size/2) // Two propellers opposite, distance to mid size/2, weight weight*WEIGHT_OUTER_FACTOR
+#define INFLOW_SPEED (10 _METER) // axial airspeed at which the thrust vanishes in hover, about twice the induced velocity
+#define ARM_FACTOR 0.5f // rotor thrust acts at half the hub distance, as the controllers are tuned for
+#define POWER_PER_THRUST 0.4f // C_P / C_T of a fixed-pitch propeller near hover (0.04 / 0.1)
 
 #define WEIGHT_INNER_FACTOR 0.5f
 #define WEIGHT_OUTER_FACTOR 0.125f
+#define WEIGHT_PROPELLER_FACTOR 0.01f
 
 Quadrotor::Quadrotor(float size, float weight,
-	float maxRPS, float gravity, scene::ISceneNode* parent, scene::ISceneManager* smgr, s32 id)
-	: scene::ISceneNode(parent, smgr, id), weight(weight), gravity(gravity), maxRPS(maxRPS)
+	float maxRPS, float gravity, scene::ISceneNode* parent, scene::ISceneManager* smgr, s32 id, bool createVisual,
+	const AirframeGeometry& airframe)
+	: scene::ISceneNode(parent, smgr, id), hasVisual(createVisual), airframe(airframe), weight(weight),
+	maxRPS(maxRPS), gravity(gravity)
 
 {
 	Material.Lighting = false;
 
 	this->size = size;
-	for (int i = 0; i < 4; ++i) {
+	for (int i = 0; i < AIRFRAME_MAX_MOTORS; ++i) {
 		this->motorSpeed[i] = 0.f;
 		this->wantedMotorSpeed[i] = 0.f;
+		this->rotorAngle[i] = 0.f;
+		this->rotor[i] = NULL;
+		this->disc[i] = NULL;
+		this->rotorLod[i] = RL_MESH;
 	}
+	impostor = NULL;
+	bodyNodeCount = 0;
+	rotorRadius = PropellerLod::getRotorRadius(size);
+
+	// Outer weights of 2 * weight * WEIGHT_OUTER_FACTOR in total, split over the motors where the thrust acts
+	int motorCount = airframe.motorCount;
+	SMatrix3f outerInertia = SMatrix3f::zero();
+	for (int i = 0; i < motorCount; ++i) {
+		float x = airframe.rotors[i].x * size * ARM_FACTOR, z = airframe.rotors[i].z * size * ARM_FACTOR;
+		outerInertia += SMatrix3f::diagonal(z * z, x * x + z * z, x * x) * (2 * weight * WEIGHT_OUTER_FACTOR / motorCount);
+	}
+	setInertia(outerInertia);
+	// Blades as thin rods
+	rotorInertia = weight * WEIGHT_PROPELLER_FACTOR * rotorRadius * rotorRadius / 3;
+	// Quadratic thrust, floating at half power. The drag torque per thrust follows from the propeller
+	// coefficients: Q / T = C_Q D / C_T with C_Q = C_P / 2 pi.
+	float hoverSpeed = maxRPS / 2, hoverThrust = 9.81f _METER * weight / motorCount;
+	float torquePerThrust = POWER_PER_THRUST * 2 * rotorRadius / (2 * PI);
+	propulsion = new PropulsionModel(maxRPS, hoverSpeed, hoverThrust, INFLOW_SPEED / hoverSpeed, torquePerThrust);
+	aerodynamics.setRotor(rotorRadius, hoverThrust);
+
+	Box.reset(Vertices[0].Pos);
+	for (s32 i = 1; i<4; ++i)
+		Box.addInternalPoint(Vertices[i].Pos);
+
+	this->reset();
+	if (!createVisual)
+		return;
 
 	ISceneNode* weightNode = smgr->addCubeSceneNode(size, this, -1, core::vector3df(0, size/4, 0));
 	weightNode->setScale(core::vector3df(1, 0.5f, 1.f));
@@ -33,40 +72,58 @@ Quadrotor::Quadrotor(float size, float weight,
 	//weightNodeMaterial.EmissiveColor = video::SColor(255, 0, 200, 0);
 	weightNodeMaterial.AmbientColor = video::SColor(255, 50, 50, 50);
 	weightNodeMaterial.DiffuseColor = video::SColor(255, 100, 100, 100);
+	bodyNodes[0] = weightNode;
 
-	ISceneNode* rodNodes[2];
-	for (int i = 0; i < 2; ++i) {
-		rodNodes[i] = smgr->addCubeSceneNode(size * 2 * sqrtf(2.f), this, -1, core::vector3df(0.f, size*(0.5f - rodSizeFactor) - 1, 0.f),
-			core::vector3df(0.f, ((i == 0) ? -45.f : 45.f), 0.f), core::vector3df(1.f, rodSizeFactor, rodSizeFactor));
-		rodNodes[i]->getMaterial(0).EmissiveColor = video::SColor(255, 40, 40, 40);
+	bodyNodeCount = 1;
+
+	// One rod from the middle to every hub; coaxial rotors share theirs
+	float rodThickness = size * 2 * sqrtf(2.f) * rodSizeFactor;
+	for (int i = 0; i < motorCount; ++i) {
+		const RotorGeometry& r = airframe.rotors[i];
+		if (i > 0 && r.x == airframe.rotors[i - 1].x && r.z == airframe.rotors[i - 1].z)
+			continue;
+		float length = sqrtf(r.x * r.x + r.z * r.z) * size;
+		ISceneNode* rodNode = smgr->addCubeSceneNode(length, this, -1, core::vector3df(r.x * size / 2, size*(0.5f - rodSizeFactor) - 1, r.z * size / 2),
+			core::vector3df(0.f, -atan2f(r.z, r.x) * core::RADTODEG, 0.f), core::vector3df(1.f, rodThickness / length, rodThickness / length));
+		rodNode->getMaterial(0).EmissiveColor = video::SColor(255, 40, 40, 40);
+		bodyNodes[bodyNodeCount++] = rodNode;
 	}
 
 
-	for (int i = 0; i < 4; ++i) {
-		rotor[i] = smgr->addMeshSceneNode(smgr->getMesh("../media/Propeller.obj"), this);
-		int x = i / 2, y = i % 2;
-		rotor[i]->setPosition(core::vector3df(size - 2 * x * size, size / 2 + size*0.05f, size - 2 * y*size));
+	scene::IMesh* propeller = smgr->getMesh("../media/Propeller.obj");
+	float propellerScale = PropellerLod::getPropellerScale(propeller, size);
+	for (int i = 0; i < motorCount; ++i) {
+		rotor[i] = smgr->addMeshSceneNode(propeller, this);
+		rotor[i]->setPosition(getRotorPosition(i));
 		rotor[i]->setRotation(core::vector3df(90, 0, 180));
-		rotor[i]->setScale(core::vector3df(size/1.7f, size/1.7f, size/1.7f));
-		rotor[i]->getMaterial(0).EmissiveColor = video::SColor(255, 120 + i * 30,  100 + i*30, 80 + i*30);
+		rotor[i]->setScale(core::vector3df(propellerScale, propellerScale, propellerScale));
+		rotor[i]->getMaterial(0).EmissiveColor = video::SColor(255, 120 + i % 4 * 30,  100 + i % 4 * 30, 80 + i % 4 * 30);
 		rotor[i]->getMaterial(0).Lighting = true;
 		rotor[i]->getMaterial(0).ColorMaterial = video::ECM_DIFFUSE_AND_AMBIENT;
+
+		scene::SMesh* discMesh = new scene::SMesh();
+		scene::SMeshBuffer* discBuffer = PropellerLod::createDiscMeshBuffer(rotorRadius, rotor[i]->getMaterial(0).EmissiveColor);
+		discMesh->addMeshBuffer(discBuffer);
+		discMesh->recalculateBoundingBox();
+		discBuffer->drop();
+		disc[i] = smgr->addMeshSceneNode(discMesh, this, -1, getRotorPosition(i));
+		disc[i]->setVisible(false);
+		discMesh->drop();
 	}
 
+	// Far away the whole vehicle is a single camera facing quad
+	impostor = smgr->addBillboardSceneNode(this, core::dimension2d<f32>(2 * (size + rotorRadius), size * 0.8f),
+		core::vector3df(0, size / 4, 0), -1, video::SColor(255, 100, 100, 100), video::SColor(255, 100, 100, 100));
+	impostor->setVisible(false);
+
 	ISceneNode *cubeFront = smgr->addCubeSceneNode(size / 2, weightNode, -1, core::vector3df(size / 4 + 0.2f, 0.f, 0.f));
 	cubeFront->getMaterial(0).AmbientColor = video::SColor(255, 240, 240, 240);
 	cubeFront->getMaterial(0).EmissiveColor = video::SColor(255, 150, 150, 150);
-	
-	Box.reset(Vertices[0].Pos);
-	for (s32 i = 1; i<4; ++i)
-		Box.addInternalPoint(Vertices[i].Pos);
-
-	this->reset();
 }
 
 
 void Quadrotor::setMotorSpeed(float speed[]) {
-	for (int i = 0; i < 4; ++i) {
+	for (int i = 0; i < airframe.motorCount; ++i) {
 		if (speed[i] < -1)
 			speed[i] = -1;
 		else if (speed[i] > 1)
@@ -75,35 +132,77 @@ void Quadrotor::setMotorSpeed(float speed[]) {
 	}
 }
 
+void Quadrotor::reset() {
+	this->setPosition(core::vector3df(0, 0, 0));
+	this->setRotation(core::vector3df(0, 0, 0));
+	this->angularSpeed = SVector3f::zero();
+	this->speed = core::vector3df(0, 0, 0);
+	for (int i = 0; i < AIRFRAME_MAX_MOTORS; ++i) {
+		this->wantedMotorSpeed[i] = 0;
+		this->motorSpeed[i] = 0;
+	}
+	if (battery != NULL)
+		battery->recharge(batteryPack);
+	this->updateAbsolutePosition();
+}
+
 void Quadrotor::update(f32 elapsedTime) {
+	PROFILE_SCOPE("Quadrotor::update");
 	// Update speed of Rotors
-	for (int i = 0; i < 4; ++i) {
-		motorSpeed[i] += (wantedMotorSpeed[i] - motorSpeed[i]) * (1 - std::exp(-elapsedTime / rotorTimeConstant));
-		core::vector3df rot = rotor[i]->getRotation();
-		// Positive Rotation = counterclockwise; motors 0 and 3 are turning clockwise
-		rot.Y += (i == 0 || i == 3 ? -1 : 1) * motorSpeed[i] * 360 * elapsedTime; // rotation in degree, not radian
-		rotor[i]->setRotation(rot);
+	float rotorAcceleration[AIRFRAME_MAX_MOTORS];
+	float lag = propulsion->getLagFactor(elapsedTime);
+	// A draining or sagging battery cannot drive the motors to full speed
+	float maxSpeed = battery != NULL ? maxRPS * battery->getSpeedLimit(batteryPack) : maxRPS;
+	int motorCount = airframe.motorCount;
+	for (int i = 0; i < motorCount; ++i) {
+		float wanted = core::clamp(wantedMotorSpeed[i], -maxSpeed, maxSpeed);
+		float change = (wanted - motorSpeed[i]) * (1 - lag);
+		motorSpeed[i] += change;
+		rotorAcceleration[i] = elapsedTime > 0 ? change / elapsedTime : 0.f;
+		// Positive Rotation = counterclockwise
+		rotorAngle[i] += getSpinDirection(i) * motorSpeed[i] * 360 * elapsedTime; // rotation in degree, not radian
+		rotorAngle[i] -= 360 * (int)(rotorAngle[i] / 360);
 	}
+	if (battery != NULL)
+		battery->setDemand(batteryPack, getCurrent());
 
 	// Calculate Forces and update Position
 	core::vector3df  pos = this->getPosition();
 	core::vector3df force(0, -gravity * weight, 0);
-	float forceSum = 0.f;
-	for (int i = 0; i < 4; ++i)
-		forceSum += motorSpeed[i] * FORCE_FACTOR;
-	// Construct a plane out of the rotor positions; its normal is the direction of the force
-	core::plane3df plane(rotor[0]->getAbsolutePosition(), rotor[1]->getAbsolutePosition(),
-		rotor[2]->getAbsolutePosition());
-
+	// The force points along the vehicle's up axis, the normal of the plane through the rotors
 	core::vector3df rot = this->getRotation();
+	core::matrix4 rotMatrix;
+	rotMatrix.setRotationDegrees(rot);
+	core::vector3df normal(0, 1, 0);
+	rotMatrix.rotateVect(normal);
+	core::vector3df airspeed = getAirspeed();
+	float axialAirspeed = airspeed.dotProduct(normal);
+	core::vector3df crossflow = airspeed - normal * axialAirspeed;
+	// Wind blowing into the rotors from above lowers the thrust, from below raises it. Only the wind's
+	// part of the airspeed counts, so in still air the thrust is the static one of the propeller
+	float axialWind = wind != NULL ? (airspeed - speed).dotProduct(normal) : 0.f;
+	// Sinking into the own wake loses thrust, the ground below a rotor adds to it
+	float vortexRing = aerodynamics.getVortexRing(axialAirspeed, crossflow.getLength());
+	float thrust[AIRFRAME_MAX_MOTORS], dragTorque[AIRFRAME_MAX_MOTORS];
+	float forceSum = 0.f;
+	for (int i = 0; i < motorCount; ++i) {
+		propulsion->evaluate(motorSpeed[i], axialWind, thrust[i], dragTorque[i]);
+		core::vector3df hub = getRotorPosition(i);
+		rotMatrix.rotateVect(hub);
+		hub += pos;
+		thrust[i] *= vortexRing * aerodynamics.getGroundEffect(hub.Y - getGroundHeight(hub.X, hub.Z));
+		forceSum += thrust[i];
+	}
 	//core::vector3df normal(sinf(rot.X * 2 *PI / 360), cosf(rot.Y *2 * PI / 360), 0);
 	//printf("Normal: %.3f %.3f %.3f\n",plane.Normal.X, plane.Normal.Y, plane.Normal.Z);
 
 
-	force += plane.Normal * forceSum;
+	force += normal * forceSum;
 
 	//aerodynamic drag
-	force -= speed * DRAG_PER_SPEED;
+	force -= airspeed * DRAG_PER_SPEED;
+	// Induced drag of the rotors against air crossing their plane
+	force -= crossflow * (aerodynamics.getRotorDrag() * forceSum);
 
 
 	speed += force / weight * elapsedTime;
@@ -117,37 +216,90 @@ void Quadrotor::update(f32 elapsedTime) {
 	//printf("Position: %.3f %.3f %.3f\n", pos.X, pos.Y, pos.Z);
 	this->setPosition(pos);
 
-	// Calculate Angular Forces and update Rotation
-	rot = this->getRotation();
-	
-	core::vector3df angularForce;
-	angularForce.X = size / 2 * FORCE_FACTOR *
-		(-motorSpeed[0] + motorSpeed[1] - motorSpeed[2] + motorSpeed[3]);
-	angularForce.Z = size / 2 * FORCE_FACTOR *
-		(motorSpeed[0] + motorSpeed[1] - motorSpeed[2] - motorSpeed[3]);
-	angularForce.Y = (-motorSpeed[0] - motorSpeed[3] + motorSpeed[1] + motorSpeed[2]) * YAW_FACTOR;
-	//printf("angular Force: %.3f %.3f %.3f\n",angularForce.X, angularForce.Y, angularForce.Z);
+	// Calculate Angular Forces and update Rotation, all in body axes:
+	// I dw/dt = torque - w x (I w + angular momentum of the rotors)
+	SVector3f torque = SVector3f::zero();
+	float rotorMomentum = 0.f; // along the body's up axis
+	for (int i = 0; i < motorCount; ++i) {
+		core::vector3df arm = getRotorPosition(i) * ARM_FACTOR;
+		torque += cross(makeVector(arm.X, 0.f, arm.Z), makeVector(0.f, thrust[i], 0.f));
+		// The blade drag and spinning up the propeller turn the body against the spin
+		int spin = getSpinDirection(i);
+		torque[1] -= spin * (dragTorque[i] + rotorInertia * 2 * PI * rotorAcceleration[i]);
+		rotorMomentum += spin * rotorInertia * 2 * PI * motorSpeed[i];
+	}
+	//printf("torque: %.3f %.3f %.3f\n", torque[0], torque[1], torque[2]);
 
 	// Approximation for aerodynamic drag
-	angularForce -= angularSpeed *2*PI/360 * size/2 * DRAG_PER_SPEED;
+	torque -= angularSpeed * (size / 2 * DRAG_PER_SPEED);
 
-	angularSpeed += angularForce * 1.f / INERTIA * elapsedTime * 360 / 2 / PI; // in degrees
-	//printf("angular Speed: %.3f %.3f %.3f, elapsedTime: %f\n", angularSpeed.X, angularSpeed.Y, angularSpeed.Z, elapsedTime);
+	SVector3f momentum = inertia * angularSpeed;
+	momentum[1] += rotorMomentum;
+	angularSpeed += inverseInertia * (torque - cross(angularSpeed, momentum)) * elapsedTime;
 
-	//rot += core::vector3df(0, 90, 0) * elapsedTime;
-	rot += angularSpeed * elapsedTime;
+	SMatrix3f orientation = toSMatrix(rotMatrix) * rotationFromVector(angularSpeed * elapsedTime);
+	orthonormalize(orientation);
+	// Euler angles continue from the last ones instead of wrapping, the controllers work on their differences
+	core::vector3df newRot = toMatrix4(orientation).getRotationDegrees();
+	for (int a = 0; a < 3; ++a) {
+		float change = (&newRot.X)[a] - (&rot.X)[a];
+		(&rot.X)[a] += change - 360 * floorf((change + 180) / 360);
+	}
 
 	this->setRotation(rot);
 	
 
-	// Restrict Height to > 0
-	if (pos.Y < 0) {
+	// Restrict height to the ground
+	float groundHeight = getGroundHeight();
+	if (pos.Y < groundHeight) {
 		//printf("restricted height");
-		pos.Y = 0;
+		pos.Y = groundHeight;
 		speed.Y = 0;
 		speed *= 0.2f;
-		this->angularSpeed = core::vector3df(0, 0, 0);
+		this->angularSpeed = SVector3f::zero();
 		this->setPosition(pos);
 		this->setRotation(core::vector3df(0, 0, 0));
 	}
-}
\ No newline at end of file
+	// Vehicles without a parent are not animated by the scene manager
+	this->updateAbsolutePosition();
+}
+
+core::vector3df Quadrotor::getAirspeed() {
+	if (wind == NULL)
+		return speed;
+	return speed - wind->getWind(getPosition());
+}
+
+float Quadrotor::getGroundHeight() {
+	core::vector3df pos = getPosition();
+	return getGroundHeight(pos.X, pos.Z);
+}
+
+float Quadrotor::getGroundHeight(float x, float z) {
+	if (ground == NULL)
+		return 0.f;
+	return ground->getHeight(x, z);
+}
+
+void Quadrotor::updateLod() {
+	scene::ICameraSceneNode* camera = SceneManager->getActiveCamera();
+	if (camera == NULL)
+		return;
+	float pixelsPerUnit = PropellerLod::getPixelsPerUnit(camera, SceneManager->getVideoDriver());
+	float distance = core::max_(camera->getAbsolutePosition().getDistanceFrom(getAbsolutePosition()), 1.f);
+
+	bool useImpostor = lod.selectVehicle(distance, getRadius(), pixelsPerUnit) == RL_IMPOSTOR;
+	impostor->setVisible(useImpostor);
+	for (int i = 0; i < bodyNodeCount; ++i)
+		bodyNodes[i]->setVisible(!useImpostor);
+	for (int i = 0; i < airframe.motorCount; ++i) {
+		rotorLod[i] = useImpostor ? RL_IMPOSTOR : lod.selectRotor(distance, rotorRadius, motorSpeed[i], pixelsPerUnit);
+		rotor[i]->setVisible(rotorLod[i] == RL_MESH);
+		disc[i]->setVisible(rotorLod[i] == RL_DISC);
+		// The spin is only written to the scene graph when the propeller mesh is drawn
+		if (rotorLod[i] == RL_MESH) {
+			rotor[i]->setRotation(core::vector3df(90, rotorAngle[i], 180));
+			rotor[i]->updateAbsolutePosition();
+		}
+	}
+}
@@ -1,37 +1,91 @@
 #pragma once
 #include <irrlicht.h>
+#include "PropellerLod.h"
+#include "SmallMatrix.h"
+#include "PropulsionModel.h"
+#include "Aerodynamics.h"
+#include "Airframe.h"
 
 using namespace irr;
 
+class HeightMap;
+class WindField;
+class BatteryBank;
+
 class Quadrotor : public scene::ISceneNode
 {
 private:
 	core::aabbox3d<f32> Box;
 	video::S3DVertex Vertices[4];
 	video::SMaterial Material;
-	scene::IMeshSceneNode* rotor[4];
-
-	float motorSpeed[4];
-	float wantedMotorSpeed[4];
-	core::vector3df angularSpeed = core::vector3df(0, 0, 0);
+	scene::IMeshSceneNode* rotor[AIRFRAME_MAX_MOTORS];
+	scene::IMeshSceneNode* disc[AIRFRAME_MAX_MOTORS];
+	scene::ISceneNode* bodyNodes[1 + AIRFRAME_MAX_MOTORS]; // weight and arms
+	int bodyNodeCount;
+	scene::IBillboardSceneNode* impostor;
+	bool hasVisual;
+
+	PropellerLod lod;
+	RotorLod rotorLod[AIRFRAME_MAX_MOTORS];
+	float rotorRadius;
+
+	AirframeGeometry airframe;
+	float motorSpeed[AIRFRAME_MAX_MOTORS];
+	float rotorAngle[AIRFRAME_MAX_MOTORS];
+	float wantedMotorSpeed[AIRFRAME_MAX_MOTORS];
+	SVector3f angularSpeed = SVector3f::zero(); // body axes, radians per second
 	core::vector3df speed = core::vector3df(0, 0, 0);
 
+	SMatrix3f inertia, inverseInertia; // body axes
+	float rotorInertia;				   // of one propeller around its axis
+	PropulsionModel* propulsion;
+	Aerodynamics aerodynamics;
+
 	const float rodSizeFactor = 0.03f;
-	const float rotorTimeConstant = 1.f;
 
 	float size;
 	const float weight, maxRPS, gravity;
 
+	const HeightMap* ground = NULL; // flat ground at height 0 if not set
+	const WindField* wind = NULL;	// still air if not set
+	BatteryBank* battery = NULL;	// unlimited power if not set
+	int batteryPack = 0;
+
+	// Chooses between propeller meshes, discs and the impostor for the next frame
+	void updateLod();
 
 public:
 
+	// Without a visual no child scene nodes are created; such vehicles are drawn by a QuadrotorSwarmNode.
+	// The airframe sets number, position and spin of the rotors, e.g. makeAirframeGeometry<Hexa>().
 	Quadrotor(float size,  float weight,
-		float maxRPM, float gravity, scene::ISceneNode* parent, scene::ISceneManager* smgr, s32 id);
+		float maxRPM, float gravity, scene::ISceneNode* parent, scene::ISceneManager* smgr, s32 id,
+		bool createVisual = true, const AirframeGeometry& airframe = makeAirframeGeometry<QuadX>());
+
+	virtual ~Quadrotor() {
+		propulsion->drop();
+	}
+
+	const AirframeGeometry& getAirframe() {
+		return airframe;
+	}
+
+	int getMotorCount() {
+		return airframe.motorCount;
+	}
+
+	// Position of the rotor hub relative to the vehicle
+	core::vector3df getRotorPosition(int i) {
+		return ::getRotorPosition(airframe.rotors[i], size);
+	}
 
 	virtual void OnRegisterSceneNode()
 	{
-		if (IsVisible)
+		if (IsVisible) {
 			SceneManager->registerNodeForRendering(this);
+			if (hasVisual)
+				updateLod();
+		}
 
 		ISceneNode::OnRegisterSceneNode();
 	}
@@ -40,10 +94,54 @@ public:
 		return speed;
 	}
 
+	// Acceleration of gravity in cm/s^2
+	float getGravity() const {
+		return gravity;
+	}
+
+	void setSpeed(const core::vector3df& speed) {
+		this->speed = speed;
+	}
+
+	// Rotation speed around the body axes in degrees per second
 	core::vector3df getAngularSpeed() {
-		return speed;
+		return toVector(angularSpeed) * core::RADTODEG;
+	}
+
+	// +1 if the rotor turns counterclockwise seen from above, -1 if clockwise
+	int getSpinDirection(int i) {
+		return airframe.rotors[i].spin;
+	}
+
+	// Inertia tensor in body axes (X forward, Y up, Z across)
+	void setInertia(const SMatrix3f& inertia) {
+		this->inertia = inertia;
+		this->inverseInertia = ::inverse(inertia);
+	}
+
+	const SMatrix3f& getInertia() {
+		return inertia;
+	}
+	// Thrust, drag torque, current and lag of the motors, shared by vehicles with the same propulsion
+	void setPropulsion(PropulsionModel* propulsion) {
+		propulsion->grab();
+		this->propulsion->drop();
+		this->propulsion = propulsion;
+	}
+
+	PropulsionModel* getPropulsion() {
+		return propulsion;
+	}
+
+	// Current drawn by all motors in A
+	float getCurrent() {
+		float current = 0.f;
+		for (int i = 0; i < airframe.motorCount; ++i)
+			current += propulsion->getCurrent(fabsf(motorSpeed[i]) / maxRPS);
+		return current;
 	}
-	// Every element in speed is between -1 and 1
+
+	// One element per motor, each between -1 and 1
 	void setMotorSpeed(float speed[]);
 
 	float getMotorSpeed(int motor) {
@@ -54,6 +152,58 @@ public:
 		return wantedMotorSpeed[motor] / maxRPS;
 	}
 
+	// Rotor speed in rotations per second
+	float getRotorSpeed(int motor) {
+		return motorSpeed[motor];
+	}
+
+	// Spin angle of a rotor in degrees
+	float getRotorAngle(int motor) {
+		return rotorAngle[motor];
+	}
+
+	float getSize() {
+		return size;
+	}
+
+	// Radius of the sphere around the rods and rotors
+	float getRadius() {
+		float arm = 0.f;
+		for (int i = 0; i < airframe.motorCount; ++i)
+			arm = core::max_(arm, airframe.rotors[i].x * airframe.rotors[i].x + airframe.rotors[i].z * airframe.rotors[i].z);
+		return sqrtf(arm) * size + rotorRadius;
+	}
+
+	PropellerLod& getLod() {
+		return lod;
+	}
+
+	// Terrain the vehicle lands on; NULL for flat ground at height 0
+	void setGround(const HeightMap* ground) {
+		this->ground = ground;
+	}
+
+	float getGroundHeight();
+	float getGroundHeight(float x, float z);
+
+	Aerodynamics& getAerodynamics() {
+		return aerodynamics;
+	}
+
+	// Air the vehicle flies through; NULL for still air
+	void setWind(const WindField* wind) {
+		this->wind = wind;
+	}
+
+	// Pack in the bank that powers the motors; NULL for unlimited power
+	void setBattery(BatteryBank* battery, int pack) {
+		this->battery = battery;
+		this->batteryPack = pack;
+	}
+
+	// Velocity relative to the surrounding air
+	core::vector3df getAirspeed();
+
 	virtual void render()
 	{
 		/*video::IVideoDriver* driver = SceneManager->getVideoDriver();
@@ -64,16 +214,8 @@ public:
 		*/
 	}
 
-	void reset() {
-		this->setPosition(core::vector3df(0, 0, 0));
-		this->setRotation(core::vector3df(0, 0, 0));
-		this->angularSpeed = core::vector3df(0, 0, 0);
-		this->speed = core::vector3df(0, 0, 0);
-		for (int i = 0; i < 4; ++i) {
-			this->wantedMotorSpeed[i] = 0;
-			this->motorSpeed[i] = 0;
-		}
-	}
+	// Back to the start, motors off and the battery recharged
+	void reset();
 
 	void update(f32 elapsedTime);
 
@@ -1,40 +1,75 @@
 #pragma once
 #include "PDController.h"
 #include "Quadrotor.h"
+#include "ControlAllocator.h"
+#include "StateProvider.h"
+#include "Profiler.h"
 
-class QuadrotorController {
+// Attitude and height control shared by the trajectory controller for every airframe
+class AttitudeController {
+public:
+	virtual ~AttitudeController() {}
+
+	virtual void reset() = 0;
+
+	// inputParams has 4 elements; 0 is the desired height, 1 the desired roll and so on.
+	virtual void adjust(float* inputParams, float elapsedTime) = 0;
+
+	// Where the controller takes height and attitude from; nullptr for the simulation's truth
+	virtual void setStateProvider(StateProvider* state) = 0;
+
+	virtual StateProvider* getStateProvider() = 0;
+};
+
+// PD control of height, roll, pitch and yaw, mixed to the motors of the airframe by a matrix
+// that is built at compile time; the per-motor loops have a constant trip count and unroll.
+// When motors saturate, the allocator keeps roll and pitch before yaw before thrust.
+template <class Airframe>
+class MultirotorController : public AttitudeController {
 private:
 	PDController heightController;
 	PDController rollpitchController;
 	PDController yawController;
 
 	Quadrotor* quadrotor;
+	TruthStateProvider truth;
+	StateProvider* state;
 
 	float lastErrors[4];
 	float derivates[4];
+	bool saturated = false;
 public:
-	QuadrotorController(PDController height, PDController rollpitch, PDController yaw, Quadrotor* quadrotor) :
+	MultirotorController(PDController height, PDController rollpitch, PDController yaw, Quadrotor* quadrotor) :
 		heightController(height), rollpitchController(rollpitch), yawController(yaw),
-		quadrotor(quadrotor){
+		quadrotor(quadrotor), truth(quadrotor), state(&truth) {
 		reset();
 	}
 
-	void reset() {
+	virtual void setStateProvider(StateProvider* state) {
+		this->state = state ? state : &truth;
+	}
+
+	virtual StateProvider* getStateProvider() {
+		return state;
+	}
+
+	virtual void reset() {
 		for (int i = 0; i < 4; ++i) {
 			lastErrors[i] = 0.f;
 			derivates[i] = 0.f;
 		}
 	}
 
-	// inputParams has 4 elements; 0 is the desired height, 1 the desired roll and so on.
-	void adjust(float* inputParams, float elapsedTime) {
+	virtual void adjust(float* inputParams, float elapsedTime) {
+		PROFILE_SCOPE("QuadrotorController::adjust");
 		// Calculate the error and its derivate and integral
 		float errors[4];
 		// In the engine's coordinate system, the Z and Y - axis are swapped
-		errors[0] = inputParams[0] - quadrotor->getAbsolutePosition().Y;
-		errors[1] = inputParams[1] - quadrotor->getRotation().X;
-		errors[2] = inputParams[2] - quadrotor->getRotation().Z;
-		errors[3] = inputParams[3] - quadrotor->getRotation().Y;
+		core::vector3df rotation = state->getRotation();
+		errors[0] = inputParams[0] - state->getPosition().Y;
+		errors[1] = inputParams[1] - rotation.X;
+		errors[2] = inputParams[2] - rotation.Z;
+		errors[3] = inputParams[3] - rotation.Y;
 
 		for (int i = 0; i < 4; ++i) {
 			derivates[i] = (errors[i] - lastErrors[i]) / elapsedTime;
@@ -45,15 +80,17 @@ public:
 		float uPitch = rollpitchController.control(errors[2], derivates[2]);
 		float uYaw = yawController.control(errors[3], derivates[3]);
 		
-		float outSpeeds[4];
-
-		outSpeeds[0] = uHeight - uRoll + uPitch - uYaw;
-		outSpeeds[1] = uHeight + uRoll + uPitch + uYaw;
-		outSpeeds[2] = uHeight - uRoll - uPitch + uYaw;
-		outSpeeds[3] = uHeight + uRoll - uPitch - uYaw;
+		float outSpeeds[Airframe::MOTORS];
+		saturated = !ControlAllocator<Airframe>::allocate(uHeight, uRoll, uPitch, uYaw, outSpeeds);
 
 		quadrotor->setMotorSpeed(outSpeeds);
 	}
 
+	// True if the last commands did not fit into the motor range and were reduced
+	bool isSaturated() {
+		return saturated;
+	}
+
+};
 
-};
\ No newline at end of file
+typedef MultirotorController<QuadX> QuadrotorController;
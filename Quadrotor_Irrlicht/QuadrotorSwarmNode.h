@@ -0,0 +1,435 @@
+#pragma once
+#include <irrlicht.h>
+#include <vector>
+#include "Quadrotor.h"
+#include "PropellerLod.h"
+
+using namespace irr;
+
+// Draws many vehicles with the look of a QuadX Quadrotor from structure-of-arrays state.
+// Every part (body, rods, rotors, front) is one shared mesh buffer; the vehicles only differ
+// by their transform, so no scene node per vehicle or part is needed.
+// Irrlicht has no hardware instancing, so there are two submission paths:
+// - per-instance: one material setup per part, then only a world transform and draw call per vehicle
+// - batched: all instances of a part are transformed on the CPU into one vertex array and submitted
+//   in chunks of up to 65535 vertices; used by default for the software drivers, where
+//   every draw call sets up the whole pipeline.
+// Vehicles outside the view frustum are skipped. Rotors that spin fast or are small on screen
+// are drawn as translucent discs, far vehicles as one camera facing quad (see PropellerLod).
+class QuadrotorSwarmNode : public scene::ISceneNode
+{
+private:
+	struct Part {
+		scene::IMeshBuffer* meshBuffer;
+		core::matrix4 local; // part relative to the vehicle
+		video::SMaterial material;
+		int rotor;			 // index of the rotor the part spins with, -1 if it is rigid
+		int drawList;		 // vehicles the part is drawn for, one of DL_*
+		bool transparent;
+
+		// batched path
+		core::array<video::S3DVertex> vertices;
+		core::array<u16> indices; // index pattern for one full chunk
+		int instancesPerChunk;
+	};
+
+	// Draw lists: full vehicles, then per rotor the vehicles showing the mesh or the disc
+	enum { DL_BODY = 0, DL_ROTOR_MESH = 1, DL_ROTOR_DISC = 5, DL_COUNT = 9 };
+
+	core::aabbox3d<f32> Box;
+	std::vector<Part> parts;
+	float size;
+	float rotorRadius;
+	float propellerScale = 1.f;
+	bool batched;
+	bool hasTransparentParts = false;
+
+	PropellerLod lod;
+	std::vector<int> drawLists[DL_COUNT];
+	std::vector<int> impostors;
+	video::SMaterial impostorMaterial;
+	core::array<video::S3DVertex> impostorVertices;
+	core::array<u16> impostorIndices;
+
+	// Vehicle state, one entry per vehicle in each array
+	std::vector<f32> posX, posY, posZ;
+	std::vector<f32> rotX, rotY, rotZ;
+	std::vector<f32> rotorAngle[4];
+	std::vector<f32> rotorSpeed[4]; // rotations per second
+	std::vector<core::matrix4> transforms;
+	bool transformsDirty = true;
+
+	void addPart(scene::IMeshBuffer* meshBuffer, const core::vector3df& position, const core::vector3df& rotation,
+		const core::vector3df& scale, const video::SMaterial& material, int rotor = -1, int drawList = DL_BODY) {
+		Part part;
+		part.meshBuffer = meshBuffer;
+		meshBuffer->grab();
+		core::matrix4 scaleMatrix;
+		scaleMatrix.setScale(scale);
+		part.local.setRotationDegrees(rotation);
+		part.local.setTranslation(position);
+		part.local *= scaleMatrix;
+		part.material = material;
+		part.material.NormalizeNormals = true; // the part transforms contain scaling
+		part.rotor = rotor;
+		part.drawList = drawList;
+		part.transparent = material.isTransparent();
+		hasTransparentParts |= part.transparent;
+		u32 numVertices = meshBuffer->getVertexCount();
+		part.instancesPerChunk = numVertices > 0 ? (int)(65535 / numVertices) : 0;
+		parts.push_back(part);
+	}
+
+	void addMeshParts(scene::IMesh* mesh, const core::vector3df& position, const core::vector3df& rotation,
+		const core::vector3df& scale, const video::SMaterial& material, int rotor = -1, int drawList = DL_BODY) {
+		for (u32 i = 0; i < mesh->getMeshBufferCount(); ++i)
+			if (mesh->getMeshBuffer(i)->getVertexType() == video::EVT_STANDARD &&
+				mesh->getMeshBuffer(i)->getIndexType() == video::EIT_16BIT)
+				addPart(mesh->getMeshBuffer(i), position, rotation, scale, material, rotor, drawList);
+	}
+
+	core::matrix4 getPartTransform(int vehicle, const Part& part) {
+		if (part.rotor < 0)
+			return transforms[vehicle] * part.local;
+		core::matrix4 spin;
+		spin.setRotationDegrees(core::vector3df(90, rotorAngle[part.rotor][vehicle], 180));
+		core::matrix4 scale;
+		scale.setScale(core::vector3df(propellerScale));
+		core::matrix4 m = transforms[vehicle] * part.local;
+		return m * spin * scale;
+	}
+
+	void updateTransforms() {
+		int n = getVehicleCount();
+		Box.reset(0, 0, 0);
+		for (int i = 0; i < n; ++i) {
+			core::matrix4& m = transforms[i];
+			m.setRotationDegrees(core::vector3df(rotX[i], rotY[i], rotZ[i]));
+			m.setTranslation(core::vector3df(posX[i], posY[i], posZ[i]));
+			if (i == 0)
+				Box.reset(posX[i], posY[i], posZ[i]);
+			else
+				Box.addInternalPoint(posX[i], posY[i], posZ[i]);
+		}
+		// Grow by the extent of a single vehicle
+		Box.MinEdge -= core::vector3df(2 * size);
+		Box.MaxEdge += core::vector3df(2 * size);
+		transformsDirty = false;
+	}
+
+	// Sorts the visible vehicles into the draw lists
+	void updateDrawLists() {
+		for (int l = 0; l < DL_COUNT; ++l)
+			drawLists[l].clear();
+		impostors.clear();
+		scene::ICameraSceneNode* camera = SceneManager->getActiveCamera();
+		if (camera == NULL)
+			return;
+		const scene::SViewFrustum* frustum = camera->getViewFrustum();
+		core::vector3df cameraPos = camera->getAbsolutePosition();
+		float pixelsPerUnit = PropellerLod::getPixelsPerUnit(camera, SceneManager->getVideoDriver());
+		float vehicleRadius = sqrtf(2.f) * size + rotorRadius;
+
+		int n = getVehicleCount();
+		for (int i = 0; i < n; ++i) {
+			core::vector3df pos(posX[i], posY[i], posZ[i]);
+			bool outside = false;
+			for (int p = 0; p < scene::SViewFrustum::VF_PLANE_COUNT && !outside; ++p)
+				outside = frustum->planes[p].getDistanceTo(pos) > vehicleRadius;
+			if (outside)
+				continue;
+			float distance = core::max_(pos.getDistanceFrom(cameraPos), 1.f);
+			if (lod.selectVehicle(distance, vehicleRadius, pixelsPerUnit) == RL_IMPOSTOR) {
+				impostors.push_back(i);
+				continue;
+			}
+			drawLists[DL_BODY].push_back(i);
+			for (int r = 0; r < 4; ++r) {
+				bool disc = lod.selectRotor(distance, rotorRadius, rotorSpeed[r][i], pixelsPerUnit) == RL_DISC;
+				drawLists[(disc ? DL_ROTOR_DISC : DL_ROTOR_MESH) + r].push_back(i);
+			}
+		}
+	}
+
+	void renderPerInstance(video::IVideoDriver* driver, const Part& part, const std::vector<int>& vehicles) {
+		for (size_t v = 0; v < vehicles.size(); ++v) {
+			driver->setTransform(video::ETS_WORLD, getPartTransform(vehicles[v], part));
+			driver->drawMeshBuffer(part.meshBuffer);
+		}
+	}
+
+	void renderBatched(video::IVideoDriver* driver, Part& part, const std::vector<int>& vehicles) {
+		int n = (int)vehicles.size();
+		const video::S3DVertex* src = (const video::S3DVertex*)part.meshBuffer->getVertices();
+		const u16* srcIndices = part.meshBuffer->getIndices();
+		u32 numVertices = part.meshBuffer->getVertexCount();
+		u32 numIndices = part.meshBuffer->getIndexCount();
+		if (part.instancesPerChunk == 0 || numIndices == 0)
+			return;
+
+		if (part.indices.size() == 0) {
+			part.indices.reallocate(numIndices * part.instancesPerChunk);
+			for (int inst = 0; inst < part.instancesPerChunk; ++inst)
+				for (u32 j = 0; j < numIndices; ++j)
+					part.indices.push_back((u16)(srcIndices[j] + inst * numVertices));
+		}
+		part.vertices.set_used(numVertices * core::min_(n, part.instancesPerChunk));
+
+		driver->setTransform(video::ETS_WORLD, core::IdentityMatrix);
+		for (int first = 0; first < n; first += part.instancesPerChunk) {
+			int count = core::min_(n - first, part.instancesPerChunk);
+			video::S3DVertex* dst = part.vertices.pointer();
+			for (int v = first; v < first + count; ++v) {
+				core::matrix4 m = getPartTransform(vehicles[v], part);
+				for (u32 j = 0; j < numVertices; ++j, ++dst) {
+					*dst = src[j];
+					m.transformVect(dst->Pos);
+					m.rotateVect(dst->Normal);
+				}
+			}
+			driver->drawVertexPrimitiveList(part.vertices.pointer(), count * numVertices, part.indices.pointer(),
+				count * numIndices / 3, video::EVT_STANDARD, scene::EPT_TRIANGLES, video::EIT_16BIT);
+		}
+	}
+
+	// One camera facing quad per far vehicle, all in as few draw calls as possible
+	void renderImpostors(video::IVideoDriver* driver) {
+		if (impostors.empty())
+			return;
+		const int quadsPerChunk = 65535 / 4;
+		if (impostorIndices.size() == 0) {
+			impostorIndices.reallocate(6 * quadsPerChunk);
+			for (int q = 0; q < quadsPerChunk; ++q) {
+				u16 base = (u16)(4 * q);
+				u16 quad[6] = { base, (u16)(base + 1), (u16)(base + 2), base, (u16)(base + 2), (u16)(base + 3) };
+				for (int k = 0; k < 6; ++k)
+					impostorIndices.push_back(quad[k]);
+			}
+		}
+		// Camera axes in world space are the rows of the view rotation
+		const core::matrix4& view = SceneManager->getActiveCamera()->getViewMatrix();
+		core::vector3df right(view[0], view[4], view[8]), up(view[1], view[5], view[9]);
+		core::vector3df halfWidth = right * (size + rotorRadius), halfHeight = up * (size * 0.4f);
+		core::vector3df normal = right.crossProduct(up);
+		video::SColor color(255, 100, 100, 100);
+
+		driver->setMaterial(impostorMaterial);
+		driver->setTransform(video::ETS_WORLD, core::IdentityMatrix);
+		int n = (int)impostors.size();
+		impostorVertices.set_used(4 * core::min_(n, quadsPerChunk));
+		for (int first = 0; first < n; first += quadsPerChunk) {
+			int count = core::min_(n - first, quadsPerChunk);
+			video::S3DVertex* dst = impostorVertices.pointer();
+			for (int v = first; v < first + count; ++v, dst += 4) {
+				int i = impostors[v];
+				core::vector3df center(posX[i], posY[i] + size / 4, posZ[i]);
+				dst[0] = video::S3DVertex(center - halfWidth - halfHeight, normal, color, core::vector2df(0, 1));
+				dst[1] = video::S3DVertex(center - halfWidth + halfHeight, normal, color, core::vector2df(0, 0));
+				dst[2] = video::S3DVertex(center + halfWidth + halfHeight, normal, color, core::vector2df(1, 0));
+				dst[3] = video::S3DVertex(center + halfWidth - halfHeight, normal, color, core::vector2df(1, 1));
+			}
+			driver->drawVertexPrimitiveList(impostorVertices.pointer(), 4 * count, impostorIndices.pointer(),
+				2 * count, video::EVT_STANDARD, scene::EPT_TRIANGLES, video::EIT_16BIT);
+		}
+	}
+
+public:
+	QuadrotorSwarmNode(float size, scene::ISceneNode* parent, scene::ISceneManager* smgr, s32 id)
+		: scene::ISceneNode(parent, smgr, id), size(size)
+	{
+		video::E_DRIVER_TYPE driverType = smgr->getVideoDriver()->getDriverType();
+		batched = driverType == video::EDT_BURNINGSVIDEO || driverType == video::EDT_SOFTWARE;
+		// Vehicles move independently of the node
+		setAutomaticCulling(scene::EAC_OFF);
+
+		// Same parts and materials as the child nodes created by the Quadrotor constructor
+		const scene::IGeometryCreator* geometry = smgr->getGeometryCreator();
+		scene::IMesh* cube = geometry->createCubeMesh(core::vector3df(1.f));
+
+		video::SMaterial bodyMaterial;
+		bodyMaterial.Lighting = true;
+		bodyMaterial.ColorMaterial = video::ECM_AMBIENT;
+		bodyMaterial.AmbientColor = video::SColor(255, 50, 50, 50);
+		bodyMaterial.DiffuseColor = video::SColor(255, 100, 100, 100);
+		addMeshParts(cube, core::vector3df(0, size / 4, 0), core::vector3df(0, 0, 0),
+			core::vector3df(size, size / 2, size), bodyMaterial);
+
+		video::SMaterial rodMaterial;
+		rodMaterial.EmissiveColor = video::SColor(255, 40, 40, 40);
+		const float rodSizeFactor = 0.03f;
+		for (int i = 0; i < 2; ++i)
+			addMeshParts(cube, core::vector3df(0.f, size*(0.5f - rodSizeFactor) - 1, 0.f),
+				core::vector3df(0.f, ((i == 0) ? -45.f : 45.f), 0.f),
+				core::vector3df(1.f, rodSizeFactor, rodSizeFactor) * (size * 2 * sqrtf(2.f)), rodMaterial);
+
+		video::SMaterial frontMaterial;
+		frontMaterial.AmbientColor = video::SColor(255, 240, 240, 240);
+		frontMaterial.EmissiveColor = video::SColor(255, 150, 150, 150);
+		addMeshParts(cube, core::vector3df(size / 4 + 0.2f, size / 4, 0.f), core::vector3df(0, 0, 0),
+			core::vector3df(size / 2, size / 4, size / 2), frontMaterial);
+		cube->drop();
+
+		scene::IMesh* propeller = smgr->getMesh("../media/Propeller.obj");
+		rotorRadius = PropellerLod::getRotorRadius(size);
+		propellerScale = PropellerLod::getPropellerScale(propeller, size);
+		for (int i = 0; i < 4; ++i) {
+			video::SColor rotorColor(255, 120 + i * 30, 100 + i * 30, 80 + i * 30);
+			if (propeller) {
+				video::SMaterial rotorMaterial;
+				rotorMaterial.EmissiveColor = rotorColor;
+				rotorMaterial.Lighting = true;
+				rotorMaterial.ColorMaterial = video::ECM_DIFFUSE_AND_AMBIENT;
+				// The rotation and scale of rotors are applied per vehicle together with their spin
+				addMeshParts(propeller, getRotorPosition(QuadX::getRotor(i), size), core::vector3df(0, 0, 0),
+					core::vector3df(1.f), rotorMaterial, i, DL_ROTOR_MESH + i);
+			}
+			scene::SMeshBuffer* disc = PropellerLod::createDiscMeshBuffer(rotorRadius, rotorColor);
+			addPart(disc, getRotorPosition(QuadX::getRotor(i), size), core::vector3df(0, 0, 0), core::vector3df(1.f),
+				disc->Material, -1, DL_ROTOR_DISC + i);
+			parts.back().material.NormalizeNormals = false;
+			disc->drop();
+		}
+
+		impostorMaterial.Lighting = false;
+		impostorMaterial.BackfaceCulling = false;
+		Box.reset(0, 0, 0);
+	}
+
+	~QuadrotorSwarmNode() {
+		for (size_t p = 0; p < parts.size(); ++p)
+			parts[p].meshBuffer->drop();
+	}
+
+	// Returns the index of the new vehicle
+	int addVehicle(const core::vector3df& pos = core::vector3df(0, 0, 0), const core::vector3df& rot = core::vector3df(0, 0, 0)) {
+		posX.push_back(pos.X);
+		posY.push_back(pos.Y);
+		posZ.push_back(pos.Z);
+		rotX.push_back(rot.X);
+		rotY.push_back(rot.Y);
+		rotZ.push_back(rot.Z);
+		for (int r = 0; r < 4; ++r) {
+			rotorAngle[r].push_back(0.f);
+			rotorSpeed[r].push_back(0.f);
+		}
+		transforms.push_back(core::matrix4());
+		transformsDirty = true;
+		return getVehicleCount() - 1;
+	}
+
+	int getVehicleCount() {
+		return (int)posX.size();
+	}
+
+	void setVehicle(int i, const core::vector3df& pos, const core::vector3df& rot) {
+		posX[i] = pos.X;
+		posY[i] = pos.Y;
+		posZ[i] = pos.Z;
+		rotX[i] = rot.X;
+		rotY[i] = rot.Y;
+		rotZ[i] = rot.Z;
+		transformsDirty = true;
+	}
+
+	void setRotorAngle(int i, int rotor, float angle) {
+		rotorAngle[rotor][i] = angle;
+	}
+
+	// Rotations per second; fast rotors are drawn as discs
+	void setRotorSpeed(int i, int rotor, float speed) {
+		rotorSpeed[rotor][i] = speed;
+	}
+
+	// Direct access to the state arrays for bulk updates; call markDirty() afterwards
+	f32* getPosX() { return posX.data(); }
+	f32* getPosY() { return posY.data(); }
+	f32* getPosZ() { return posZ.data(); }
+	f32* getRotX() { return rotX.data(); }
+	f32* getRotY() { return rotY.data(); }
+	f32* getRotZ() { return rotZ.data(); }
+	f32* getRotorAngles(int rotor) { return rotorAngle[rotor].data(); }
+	f32* getRotorSpeeds(int rotor) { return rotorSpeed[rotor].data(); }
+
+	void markDirty() {
+		transformsDirty = true;
+	}
+
+	// Copies the state of simulated vehicles; vehicle i of the swarm shows quadrotors[i]
+	void syncFrom(Quadrotor** quadrotors, int count) {
+		while (getVehicleCount() < count)
+			addVehicle();
+		for (int i = 0; i < count; ++i) {
+			const core::vector3df& pos = quadrotors[i]->getPosition();
+			const core::vector3df& rot = quadrotors[i]->getRotation();
+			posX[i] = pos.X;
+			posY[i] = pos.Y;
+			posZ[i] = pos.Z;
+			rotX[i] = rot.X;
+			rotY[i] = rot.Y;
+			rotZ[i] = rot.Z;
+			for (int r = 0; r < 4; ++r) {
+				rotorAngle[r][i] = quadrotors[i]->getRotorAngle(r);
+				rotorSpeed[r][i] = quadrotors[i]->getRotorSpeed(r);
+			}
+		}
+		transformsDirty = true;
+	}
+
+	void setBatched(bool batched) {
+		this->batched = batched;
+	}
+
+	PropellerLod& getLod() {
+		return lod;
+	}
+
+	virtual void OnRegisterSceneNode()
+	{
+		if (IsVisible && getVehicleCount() > 0) {
+			SceneManager->registerNodeForRendering(this, scene::ESNRP_SOLID);
+			// The rotor discs are blended after all solid geometry
+			if (hasTransparentParts)
+				SceneManager->registerNodeForRendering(this, scene::ESNRP_TRANSPARENT);
+		}
+
+		ISceneNode::OnRegisterSceneNode();
+	}
+
+	virtual void render()
+	{
+		video::IVideoDriver* driver = SceneManager->getVideoDriver();
+		// The solid pass comes first and decides what is drawn in both passes
+		bool transparentPass = SceneManager->getSceneNodeRenderPass() == scene::ESNRP_TRANSPARENT;
+		if (!transparentPass) {
+			if (transformsDirty)
+				updateTransforms();
+			updateDrawLists();
+			renderImpostors(driver);
+		}
+		for (size_t p = 0; p < parts.size(); ++p) {
+			Part& part = parts[p];
+			if (part.transparent != transparentPass || drawLists[part.drawList].empty())
+				continue;
+			driver->setMaterial(part.material);
+			if (batched)
+				renderBatched(driver, part, drawLists[part.drawList]);
+			else
+				renderPerInstance(driver, part, drawLists[part.drawList]);
+		}
+	}
+
+	virtual const core::aabbox3d<f32>& getBoundingBox() const
+	{
+		return Box;
+	}
+
+	virtual u32 getMaterialCount() const
+	{
+		return (u32)parts.size();
+	}
+
+	virtual video::SMaterial& getMaterial(u32 i)
+	{
+		return parts[i].material;
+	}
+};
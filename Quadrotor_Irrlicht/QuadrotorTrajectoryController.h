@@ -1,4 +1,5 @@
 #pragma once
+#include <vector>
 #include "Quadrotor.h"
 #include "QuadrotorController.h"
 
@@ -12,6 +13,13 @@ enum QuadrotorTrajectory {
 	QT_STABLE_MEDIUM,
 	QT_STABLE_HIGH,
 	QT_YAW_BACKWARDS,
+	QT_WAYPOINTS,
+};
+
+// A point the vehicle should pass at the given time, in seconds from the start of the trajectory
+struct TimedWaypoint {
+	core::vector3df position;
+	float time;
 };
 
 class QuadrotorTrajectoryController {
@@ -19,15 +27,47 @@ private:
 	float params[4];
 
 	Quadrotor* quadrotor;
-	QuadrotorController* quadrotorController;
+	AttitudeController* quadrotorController;
 
 	//void(*currentTrajectory)() = NULL;
 	QuadrotorTrajectory currentTrajectory = QT_NONE;
 
+	std::vector<TimedWaypoint> waypoints;
+	size_t waypointIndex = 0;
+	float waypointTime = 0.f;
+	float maxTilt = 10.f; // degrees
+
+	// Flies towards the point that is due on the path with a PD law on position and speed. The wanted
+	// horizontal acceleration becomes a tilt, with yaw held at 0: rolling about X moves along +Z,
+	// pitching about Z along -X.
+	void followWaypoints(float elapsedTime) {
+		waypointTime += elapsedTime;
+		while (waypointIndex + 1 < waypoints.size() && waypoints[waypointIndex + 1].time <= waypointTime)
+			++waypointIndex;
+		core::vector3df target = waypoints[waypointIndex].position, targetSpeed;
+		if (waypointIndex + 1 < waypoints.size()) {
+			const TimedWaypoint& a = waypoints[waypointIndex];
+			const TimedWaypoint& b = waypoints[waypointIndex + 1];
+			float duration = core::max_(b.time - a.time, 1e-3f);
+			target = a.position + (b.position - a.position) * ((waypointTime - a.time) / duration);
+			targetSpeed = (b.position - a.position) / duration;
+		}
+		StateProvider* state = quadrotorController->getStateProvider();
+		core::vector3df error = target - state->getPosition();
+		core::vector3df speedError = targetSpeed - state->getSpeed();
+		const float positionGain = 1.f, speedGain = 1.5f, gravity = quadrotor->getGravity();
+		float accelX = positionGain * error.X + speedGain * speedError.X;
+		float accelZ = positionGain * error.Z + speedGain * speedError.Z;
+		params[0] = target.Y;
+		params[1] = core::clamp(atan2f(accelZ, gravity) * core::RADTODEG, -maxTilt, maxTilt);
+		params[2] = core::clamp(-atan2f(accelX, gravity) * core::RADTODEG, -maxTilt, maxTilt);
+		params[3] = 0.f;
+	}
+
 public:
 
 
-	QuadrotorTrajectoryController(QuadrotorController* controller, Quadrotor* quadrotor):
+	QuadrotorTrajectoryController(AttitudeController* controller, Quadrotor* quadrotor):
 	quadrotor(quadrotor), quadrotorController(controller){
 		this->reset();
 	}
@@ -56,6 +96,11 @@ public:
 			params[0] = 4000;
 			params[1] = params[2] = params[3] = 0.f;
 			break;
+		case QT_WAYPOINTS:
+			if (waypoints.empty())
+				return;
+			followWaypoints(elapsedTime);
+			break;
 		case QT_YAW_BACKWARDS:
 			params[0] = quadrotor->getAbsolutePosition().Y;
 			params[1] = params[3] = 0.f;
@@ -72,11 +117,23 @@ public:
 		this->currentTrajectory = trajectory;
 	}
 
+	// Starts following the waypoints from the first one; the last one is held when the time is up
+	void setWaypoints(const std::vector<TimedWaypoint>& waypoints) {
+		this->waypoints = waypoints;
+		waypointIndex = 0;
+		waypointTime = 0.f;
+		currentTrajectory = QT_WAYPOINTS;
+	}
+
+	const std::vector<TimedWaypoint>& getWaypoints() {
+		return waypoints;
+	}
+
 	QuadrotorTrajectory getTrajectory() {
 		return this->currentTrajectory;
 	}
 
-	void setQuadrotorController(QuadrotorController* controller) {
+	void setQuadrotorController(AttitudeController* controller) {
 		this->quadrotorController = controller;
 	}
 
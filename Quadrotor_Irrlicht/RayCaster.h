@@ -0,0 +1,337 @@
+#pragma once
+#include <irrlicht.h>
+#include <cmath>
+#include <vector>
+#include "Bvh.h"
+#include "HeightMap.h"
+#include "CollisionWorld.h"
+#include "Quadrotor.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+
+using namespace irr;
+
+#define _METER *100
+
+// Ray queries against everything a range sensor can see: the terrain, the static obstacles and the
+// vehicles of a CollisionWorld.
+// The terrain is cut into patches of PATCH x PATCH cells; their bounds go into one BVH together with
+// the obstacles, which is built once. A ray that reaches a patch walks through its cells and finds
+// where it crosses the bilinear surface by bisection. The vehicles are spheres in a second BVH over
+// the same vehicles, refit after every step.
+// Queries only read, so any number of threads can cast at the same time.
+class RayCaster {
+private:
+	enum { PATCH = 16, BISECTIONS = 10 };
+
+	const HeightMap* terrain;
+	CollisionWorld* world;
+	Bvh staticBvh, vehicleBvh;
+	std::vector<core::aabbox3df> staticBounds, vehicleBounds;
+	int patchesPerRow = 0, patchCount = 0; // static primitives below patchCount are terrain patches
+
+	float terrainAbove(float x, float y, float z) const {
+		return y - terrain->getHeight(x, z);
+	}
+
+	// Distance to the terrain surface inside one patch, or tMax
+	float intersectPatch(int patch, const float* o, const float* d, float tMax) const {
+		const core::aabbox3df& box = staticBounds[patch];
+		float t0 = 0.f, t1 = tMax;
+		for (int k = 0; k < 3; ++k) {
+			float inv = inverseDirection(d[k]);
+			float a = ((&box.MinEdge.X)[k] - o[k]) * inv, b = ((&box.MaxEdge.X)[k] - o[k]) * inv;
+			t0 = core::max_(t0, core::min_(a, b));
+			t1 = core::min_(t1, core::max_(a, b));
+		}
+		if (t0 > t1)
+			return tMax;
+
+		// Cell walk (DDA) on the X/Z plane from the patch entry to its exit
+		float cellSize = terrain->getCellSize();
+		core::vector2df origin = terrain->getOrigin();
+		int px = patch % patchesPerRow, pz = patch / patchesPerRow;
+		int lastCell = terrain->getSize() - 2;
+		int minX = px * PATCH, maxX = core::min_(minX + PATCH - 1, lastCell);
+		int minZ = pz * PATCH, maxZ = core::min_(minZ + PATCH - 1, lastCell);
+		float startX = o[0] + d[0] * t0, startZ = o[2] + d[2] * t0;
+		int ix = core::clamp((int)floorf((startX - origin.X) / cellSize), minX, maxX);
+		int iz = core::clamp((int)floorf((startZ - origin.Y) / cellSize), minZ, maxZ);
+		int stepX = d[0] >= 0 ? 1 : -1, stepZ = d[2] >= 0 ? 1 : -1;
+		float deltaX = d[0] != 0 ? cellSize / fabsf(d[0]) : 1e30f, deltaZ = d[2] != 0 ? cellSize / fabsf(d[2]) : 1e30f;
+		float nextX = d[0] != 0 ? (origin.X + (ix + (stepX > 0)) * cellSize - o[0]) / d[0] : 1e30f;
+		float nextZ = d[2] != 0 ? (origin.Y + (iz + (stepZ > 0)) * cellSize - o[2]) / d[2] : 1e30f;
+
+		float ta = t0;
+		if (terrainAbove(o[0] + d[0] * ta, o[1] + d[1] * ta, o[2] + d[2] * ta) <= 0)
+			return ta;
+		for (;;) {
+			float tb = core::min_(core::min_(nextX, nextZ), t1);
+			float fb = terrainAbove(o[0] + d[0] * tb, o[1] + d[1] * tb, o[2] + d[2] * tb);
+			if (fb <= 0) {
+				for (int i = 0; i < BISECTIONS; ++i) {
+					float tm = (ta + tb) / 2;
+					if (terrainAbove(o[0] + d[0] * tm, o[1] + d[1] * tm, o[2] + d[2] * tm) > 0)
+						ta = tm;
+					else
+						tb = tm;
+				}
+				return tb;
+			}
+			if (tb >= t1)
+				return tMax;
+			if (nextX < nextZ) {
+				ix += stepX;
+				nextX += deltaX;
+			}
+			else {
+				iz += stepZ;
+				nextZ += deltaZ;
+			}
+			if (ix < minX || ix > maxX || iz < minZ || iz > maxZ)
+				return tMax;
+			ta = tb;
+		}
+	}
+
+	static float intersectSphere(const core::vector3df& center, float radius, const float* o, const float* d, float tMax) {
+		float cx = o[0] - center.X, cy = o[1] - center.Y, cz = o[2] - center.Z;
+		float a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+		float b = cx * d[0] + cy * d[1] + cz * d[2];
+		float c = cx * cx + cy * cy + cz * cz - radius * radius;
+		float discriminant = b * b - a * c;
+		if (discriminant < 0)
+			return tMax;
+		float t = (-b - sqrtf(discriminant)) / a;
+		return t >= 0 && t < tMax ? t : tMax;
+	}
+
+	static float intersectBox(const core::aabbox3df& box, const float* o, const float* d, float tMax) {
+		float t0 = 0.f, t1 = tMax;
+		for (int k = 0; k < 3; ++k) {
+			float inv = inverseDirection(d[k]);
+			float a = ((&box.MinEdge.X)[k] - o[k]) * inv, b = ((&box.MaxEdge.X)[k] - o[k]) * inv;
+			t0 = core::max_(t0, core::min_(a, b));
+			t1 = core::min_(t1, core::max_(a, b));
+		}
+		return t0 <= t1 ? t0 : tMax;
+	}
+
+	float intersectStatic(int primitive, const float* o, const float* d, float tMax) const {
+		if (primitive < patchCount)
+			return intersectPatch(primitive, o, d, tMax);
+		const Obstacle& obstacle = world->getObstacle(primitive - patchCount);
+		if (obstacle.type == OT_SPHERE)
+			return intersectSphere(obstacle.center, obstacle.radius, o, d, tMax);
+		return intersectBox(obstacle.box, o, d, tMax);
+	}
+
+	float intersectVehicle(int vehicle, const Quadrotor* ignore, const float* o, const float* d, float tMax) const {
+		Quadrotor* q = world->getVehicle(vehicle);
+		if (q == ignore)
+			return tMax;
+		return intersectSphere(q->getPosition(), q->getRadius(), o, d, tMax);
+	}
+
+	void updateVehicleBounds() {
+		int n = world->getNumVehicles();
+		vehicleBounds.resize(n);
+		for (int i = 0; i < n; ++i) {
+			Quadrotor* q = world->getVehicle(i);
+			float r = q->getRadius();
+			vehicleBounds[i] = core::aabbox3df(q->getPosition() - core::vector3df(r, r, r), q->getPosition() + core::vector3df(r, r, r));
+		}
+	}
+
+public:
+	RayCaster(const HeightMap* terrain, CollisionWorld* world) : terrain(terrain), world(world) {}
+
+	// Builds both trees; again when obstacles or vehicles were added. Reads every terrain sample once.
+	void build() {
+		staticBounds.clear();
+		patchesPerRow = patchCount = 0;
+		if (terrain != NULL && terrain->isValid()) {
+			int cells = terrain->getSize() - 1;
+			patchesPerRow = (cells + PATCH - 1) / PATCH;
+			float cellSize = terrain->getCellSize();
+			core::vector2df origin = terrain->getOrigin();
+			for (int pz = 0; pz < patchesPerRow; ++pz)
+				for (int px = 0; px < patchesPerRow; ++px) {
+					int x1 = core::min_((px + 1) * PATCH, cells), z1 = core::min_((pz + 1) * PATCH, cells);
+					float low = terrain->getSampleHeight(px * PATCH, pz * PATCH), high = low;
+					for (int z = pz * PATCH; z <= z1; ++z)
+						for (int x = px * PATCH; x <= x1; ++x) {
+							float h = terrain->getSampleHeight(x, z);
+							low = core::min_(low, h);
+							high = core::max_(high, h);
+						}
+					// Padded, a flat patch would give a box without height that rounding lets rays slip through
+					float pad = 0.01f * cellSize;
+					staticBounds.push_back(core::aabbox3df(origin.X + px * PATCH * cellSize - pad, low - pad, origin.Y + pz * PATCH * cellSize - pad,
+						origin.X + x1 * cellSize + pad, high + pad, origin.Y + z1 * cellSize + pad));
+				}
+			patchCount = (int)staticBounds.size();
+		}
+		for (int i = 0; i < world->getNumObstacles(); ++i)
+			staticBounds.push_back(world->getObstacle(i).box);
+		staticBvh.build(staticBounds);
+		updateVehicleBounds();
+		vehicleBvh.build(vehicleBounds, 2);
+	}
+
+	// Moves the vehicle bounds to the current positions; call after the vehicles were updated
+	void refit() {
+		updateVehicleBounds();
+		vehicleBvh.refit(vehicleBounds);
+	}
+
+	// Distance along a unit direction to the first hit, or maxRange; ignore is the vehicle carrying the sensor
+	float cast(const core::vector3df& origin, const core::vector3df& direction, float maxRange, const Quadrotor* ignore = NULL) const {
+		float o[3] = { origin.X, origin.Y, origin.Z }, d[3] = { direction.X, direction.Y, direction.Z };
+		float inv[3] = { inverseDirection(d[0]), inverseDirection(d[1]), inverseDirection(d[2]) };
+		float tMax = maxRange;
+		auto staticLeaf = [&](int primitive, float& t) { t = intersectStatic(primitive, o, d, t); };
+		auto vehicleLeaf = [&](int vehicle, float& t) { t = intersectVehicle(vehicle, ignore, o, d, t); };
+		staticBvh.intersect(o, inv, tMax, staticLeaf);
+		vehicleBvh.intersect(o, inv, tMax, vehicleLeaf);
+		return tMax;
+	}
+
+	// Four rays at once from one origin; distances receives 4 values
+	void castPacket(const core::vector3df& origin, const core::vector3df* directions, float maxRange,
+		const Quadrotor* ignore, float* distances) const {
+		RayPacket packet;
+		float d[4][3];
+		for (int r = 0; r < 4; ++r) {
+			packet.origin[0][r] = origin.X;
+			packet.origin[1][r] = origin.Y;
+			packet.origin[2][r] = origin.Z;
+			d[r][0] = directions[r].X;
+			d[r][1] = directions[r].Y;
+			d[r][2] = directions[r].Z;
+			for (int k = 0; k < 3; ++k)
+				packet.invDirection[k][r] = inverseDirection(d[r][k]);
+			packet.tMax[r] = maxRange;
+		}
+		packet.active = 15;
+		float o[3] = { origin.X, origin.Y, origin.Z };
+		auto staticLeaf = [&](int primitive, int r, float& t) { t = intersectStatic(primitive, o, d[r], t); };
+		auto vehicleLeaf = [&](int vehicle, int r, float& t) { t = intersectVehicle(vehicle, ignore, o, d[r], t); };
+		staticBvh.intersect(packet, staticLeaf);
+		vehicleBvh.intersect(packet, vehicleLeaf);
+		for (int r = 0; r < 4; ++r)
+			distances[r] = packet.tMax[r];
+	}
+};
+
+// Beam layouts in body axes (X forward, Y up, Z across)
+enum BeamPattern {
+	BP_LIDAR_2D,	  // one horizontal fan
+	BP_LIDAR_3D,	  // channels fans stacked over the vertical field of view
+	BP_DEPTH_CAMERA // pinhole camera looking forward, values are depths along the optical axis
+};
+
+// A range sensor on a vehicle. The beams are cast in packets of four neighbours on a thread pool and
+// written into a buffer that is allocated once; a scan does not allocate.
+class RangeSensor {
+private:
+	Quadrotor* quadrotor;
+	BeamPattern pattern;
+	float maxRange;
+	int beamCount = 0;
+	std::vector<core::vector3df> directions; // body axes, padded to a multiple of 4
+	std::vector<core::vector3df> worldDirections;
+	std::vector<float> ranges;
+	core::vector3df scanOrigin;
+
+	void resize(int count) {
+		beamCount = count;
+		int padded = (count + 3) & ~3;
+		directions.resize(padded);
+		worldDirections.resize(padded);
+		ranges.assign(padded, maxRange);
+	}
+
+public:
+	// columns x rows beams: for BP_LIDAR_2D rows is 1, for BP_LIDAR_3D rows are the channels, for
+	// BP_DEPTH_CAMERA the image size. horizontalFov and verticalFov are in degrees.
+	RangeSensor(Quadrotor* quadrotor, BeamPattern pattern, int columns, int rows, float horizontalFov,
+		float verticalFov, float maxRange = 50 _METER) :
+		quadrotor(quadrotor), pattern(pattern), maxRange(maxRange) {
+		if (pattern == BP_LIDAR_2D)
+			rows = 1;
+		resize(columns * rows);
+		float tanX = tanf(horizontalFov * core::DEGTORAD / 2), tanY = tanf(verticalFov * core::DEGTORAD / 2);
+		for (int row = 0; row < rows; ++row)
+			for (int column = 0; column < columns; ++column) {
+				core::vector3df& dir = directions[row * columns + column];
+				// Beam centers, symmetric around the forward axis
+				float u = (column + 0.5f) / columns * 2 - 1, v = (row + 0.5f) / rows * 2 - 1;
+				if (pattern == BP_DEPTH_CAMERA)
+					dir.set(1, -v * tanY, u * tanX);
+				else {
+					float azimuth = u * horizontalFov / 2 * core::DEGTORAD;
+					float elevation = rows > 1 ? -v * verticalFov / 2 * core::DEGTORAD : 0.f;
+					dir.set(cosf(elevation) * cosf(azimuth), sinf(elevation), cosf(elevation) * sinf(azimuth));
+				}
+				dir.normalize();
+			}
+		for (int i = beamCount; i < (int)directions.size(); ++i)
+			directions[i] = directions[beamCount - 1];
+	}
+
+	// Casts all beams from the vehicle's current pose; pool may be NULL
+	void scan(const RayCaster& caster, ThreadPool* pool) {
+		PROFILE_SCOPE("range sensor");
+		core::matrix4 rotMatrix;
+		rotMatrix.setRotationDegrees(quadrotor->getRotation());
+		for (size_t i = 0; i < directions.size(); ++i) {
+			worldDirections[i] = directions[i];
+			rotMatrix.rotateVect(worldDirections[i]);
+		}
+		scanOrigin = quadrotor->getPosition();
+		int packets = (int)directions.size() / 4;
+		auto castRange = [&](int begin, int end) {
+			for (int p = begin; p < end; ++p) {
+				caster.castPacket(scanOrigin, &worldDirections[4 * p], maxRange, quadrotor, &ranges[4 * p]);
+				if (pattern == BP_DEPTH_CAMERA)
+					for (int i = 4 * p; i < 4 * p + 4; ++i)
+						ranges[i] *= directions[i].X;
+			}
+		};
+		if (pool != NULL)
+			pool->parallelFor(packets, 16, castRange);
+		else
+			castRange(0, packets);
+	}
+
+	int getBeamCount() const {
+		return beamCount;
+	}
+
+	// Distances of the last scan, maxRange where nothing was hit; depths for BP_DEPTH_CAMERA
+	const float* getRanges() const {
+		return ranges.data();
+	}
+
+	float getMaxRange() const {
+		return maxRange;
+	}
+
+	// World position the last scan was taken from
+	core::vector3df getOrigin() const {
+		return scanOrigin;
+	}
+
+	// True if beam i of the last scan hit something within maxRange
+	bool isHit(int i) const {
+		float range = pattern == BP_DEPTH_CAMERA ? ranges[i] / directions[i].X : ranges[i];
+		return range < maxRange * 0.9999f;
+	}
+
+	// World position of beam i of the last scan
+	core::vector3df getHitPoint(int i) const {
+		float range = pattern == BP_DEPTH_CAMERA ? ranges[i] / directions[i].X : ranges[i];
+		return scanOrigin + worldDirections[i] * range;
+	}
+};
@@ -16,8 +16,7 @@ public:
 	}
 
 	~RingBuffer() {
-		printf("free called\n");
-		delete list;
+		delete[] list;
 	}
 
 	void push(T item) {
@@ -26,7 +25,7 @@ public:
 		if (numElements < size)
 			numElements++;
 		else
-			startIdx++; // Vorheriger Start wurde berschrieben
+			startIdx = (startIdx + 1) % size; // Vorheriger Start wurde berschrieben
 	}
 
 	T get(int i) {
@@ -36,7 +35,24 @@ public:
 		return list[i];
 	}
 
+	// Direct access to an element; i has to be smaller than getNumElements()
+	T& at(int i) {
+		return list[(i + startIdx) % size];
+	}
+
+	T& last() {
+		return list[(nextWrite + size - 1) % size];
+	}
+
+	void clear() {
+		startIdx = nextWrite = numElements = 0;
+	}
+
 	int getNumElements() {
 		return numElements;
 	}
-};
\ No newline at end of file
+
+	int getCapacity() {
+		return size;
+	}
+};
@@ -0,0 +1,216 @@
+#pragma once
+#include <irrlicht.h>
+#include <cmath>
+#include "Quadrotor.h"
+#include "RingBuffer.h"
+#include "SimulationClock.h"
+
+using namespace irr;
+
+#define _METER *100
+
+// Counter-based random numbers: the n-th number of a stream is a hash of the stream and n.
+// Nothing is carried from one draw to the next, so vehicles simulated on any number of threads
+// and in any order get the same noise for the same seed.
+struct CounterRng {
+	// SplitMix64 finalizer
+	static u64 hash(u64 x) {
+		x += 0x9e3779b97f4a7c15ull;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+
+	static u64 makeStream(u64 seed, u32 id) {
+		return hash(seed ^ ((u64)id << 32));
+	}
+
+	// In (0, 1)
+	static float uniform(u64 stream, u64 counter) {
+		return ((hash(stream ^ hash(counter)) >> 40) + 0.5f) * (1.f / 16777216.f);
+	}
+
+	// Standard normal distribution (Box-Muller)
+	static float normal(u64 stream, u64 counter) {
+		float u = uniform(stream, 2 * counter), v = uniform(stream, 2 * counter + 1);
+		return sqrtf(-2 * logf(u)) * cosf(2 * core::PI * v);
+	}
+};
+
+// Error model of a sensor; noise and bias are standard deviations per axis, in the sensor's unit
+struct SensorSpec {
+	float rate;			// samples per second
+	float delay;		// from sampling until the value is available, in seconds
+	float noise;
+	float bias;			// drawn once per sensor
+	float quantization; // resolution, 0 for none
+};
+
+// One sensor with three axes. Samples are taken at the sensor's rate (at most once per simulation
+// step) and travel through a delay line of fixed capacity; the output is the newest sample whose
+// transport delay has passed, held until the next one arrives. Sample times are simulation clock
+// ticks, so the schedule stays exact in runs of any length.
+class Sensor {
+private:
+	struct TimedSample {
+		s64 time;
+		core::vector3df value;
+	};
+
+	SensorSpec spec;
+	RingBuffer<TimedSample> delayLine;
+	u64 stream;
+	u64 counter = 0;
+	core::vector3df bias;
+	s64 nextSample = 0;
+	core::vector3df output;
+	s64 outputTime = -1;
+	bool valid = false;
+
+	float quantize(float v) const {
+		return spec.quantization > 0 ? floorf(v / spec.quantization + 0.5f) * spec.quantization : v;
+	}
+
+public:
+	Sensor(const SensorSpec& spec, u64 stream) :
+		spec(spec), delayLine((int)ceilf(spec.rate * spec.delay) + 2), stream(stream) {
+		bias.set(CounterRng::normal(stream, counter), CounterRng::normal(stream, counter + 1), CounterRng::normal(stream, counter + 2));
+		bias *= spec.bias;
+		counter += 3;
+	}
+
+	// truth is the exact value at the clock's current time
+	void update(const SimulationClock& clock, const core::vector3df& truth) {
+		s64 time = clock.getTicks();
+		if (time >= nextSample) {
+			TimedSample sample;
+			sample.time = time;
+			sample.value.X = quantize(truth.X + bias.X + spec.noise * CounterRng::normal(stream, counter));
+			sample.value.Y = quantize(truth.Y + bias.Y + spec.noise * CounterRng::normal(stream, counter + 1));
+			sample.value.Z = quantize(truth.Z + bias.Z + spec.noise * CounterRng::normal(stream, counter + 2));
+			counter += 3;
+			delayLine.push(sample);
+			// Keep the grid of sample times, unless the simulation step is longer than the period
+			nextSample = core::max_(nextSample + clock.fromSeconds(1.0 / spec.rate), time);
+		}
+		s64 delay = clock.fromSeconds(spec.delay);
+		for (int i = delayLine.getNumElements() - 1; i >= 0; --i) {
+			const TimedSample& sample = delayLine.at(i);
+			if (sample.time + delay <= time) {
+				output = sample.value;
+				outputTime = sample.time;
+				valid = true;
+				break;
+			}
+		}
+	}
+
+	const core::vector3df& getValue() const {
+		return output;
+	}
+
+	// Clock ticks when the current output was sampled, -1 before the first one
+	s64 getTime() const {
+		return outputTime;
+	}
+
+	// False until the first sample has passed the delay
+	bool isValid() const {
+		return valid;
+	}
+
+	const SensorSpec& getSpec() const {
+		return spec;
+	}
+};
+
+// Accelerometer and gyroscope in body axes, barometric height and GPS position of one vehicle.
+// The accelerometer measures the specific force (acceleration minus gravity) in cm/s^2, the gyroscope
+// the rotation speed in degrees per second, the barometer the height in Y and GPS the position in cm.
+// update() has to follow the vehicle's update in every step, with the clock already advanced.
+class SensorSuite {
+private:
+	Quadrotor* quadrotor;
+	Sensor accelerometer, gyroscope, barometer, gps;
+	s64 time = 0;
+	s64 ticksPerSecond = SIM_TICKS_PER_SECOND;
+	core::vector3df lastSpeed;
+	bool hasLastSpeed = false;
+
+public:
+	static SensorSpec getDefaultAccelerometer() {
+		SensorSpec spec = { 200.f, 0.005f, 0.05f _METER, 0.1f _METER, 0.005f _METER };
+		return spec;
+	}
+
+	static SensorSpec getDefaultGyroscope() {
+		SensorSpec spec = { 200.f, 0.005f, 0.3f, 0.5f, 0.06f };
+		return spec;
+	}
+
+	static SensorSpec getDefaultBarometer() {
+		SensorSpec spec = { 25.f, 0.04f, 0.3f _METER, 0.5f _METER, 0.01f _METER };
+		return spec;
+	}
+
+	static SensorSpec getDefaultGps() {
+		SensorSpec spec = { 5.f, 0.2f, 1.5f _METER, 0.f, 0.01f _METER };
+		return spec;
+	}
+
+	// Every vehicle needs its own seed for independent noise
+	SensorSuite(Quadrotor* quadrotor, u64 seed,
+		const SensorSpec& accelerometer = getDefaultAccelerometer(), const SensorSpec& gyroscope = getDefaultGyroscope(),
+		const SensorSpec& barometer = getDefaultBarometer(), const SensorSpec& gps = getDefaultGps()) :
+		quadrotor(quadrotor),
+		accelerometer(accelerometer, CounterRng::makeStream(seed, 0)), gyroscope(gyroscope, CounterRng::makeStream(seed, 1)),
+		barometer(barometer, CounterRng::makeStream(seed, 2)), gps(gps, CounterRng::makeStream(seed, 3)) {
+	}
+
+	void update(const SimulationClock& clock, float elapsedTime, float gravity = 9.81f _METER) {
+		time = clock.getTicks();
+		ticksPerSecond = clock.getTicksPerSecond();
+		core::vector3df speed = quadrotor->getSpeed();
+		core::vector3df acceleration = hasLastSpeed && elapsedTime > 0 ? (speed - lastSpeed) / elapsedTime : core::vector3df(0, 0, 0);
+		lastSpeed = speed;
+		hasLastSpeed = true;
+
+		// Into body axes by the transposed rotation
+		core::matrix4 rotMatrix;
+		rotMatrix.setRotationDegrees(quadrotor->getRotation());
+		core::vector3df specificForce = acceleration + core::vector3df(0, gravity, 0);
+		rotMatrix.inverseRotateVect(specificForce);
+
+		core::vector3df pos = quadrotor->getPosition();
+		accelerometer.update(clock, specificForce);
+		gyroscope.update(clock, quadrotor->getAngularSpeed());
+		barometer.update(clock, core::vector3df(0, pos.Y, 0));
+		gps.update(clock, pos);
+	}
+
+	// Clock ticks of the last update
+	s64 getTime() const {
+		return time;
+	}
+
+	// For turning differences of sample times into seconds
+	float toSeconds(s64 ticks) const {
+		return (float)((double)ticks / ticksPerSecond);
+	}
+
+	const Sensor& getAccelerometer() const {
+		return accelerometer;
+	}
+
+	const Sensor& getGyroscope() const {
+		return gyroscope;
+	}
+
+	const Sensor& getBarometer() const {
+		return barometer;
+	}
+
+	const Sensor& getGps() const {
+		return gps;
+	}
+};
@@ -3,84 +3,136 @@
 
 using namespace irr;
 
+// Sets the constants of the example shaders in ../media.
+// Products of view and projection are cached until those matrices change, the world dependent
+// matrices until the world transform changes, and every constant is only uploaded when its
+// value differs from the last upload. Constants keep their values between draws as long as
+// no other shader writes them, which holds for the single shader material of this program;
+// call invalidate() otherwise.
 class MyShaderCallBack : public video::IShaderConstantSetCallBack
 {
 private:
 	bool UseHighLevelShaders = false;
 	IrrlichtDevice* device;
+
+	// Constant locations of the high level shader, resolved on the first call
+	bool idsResolved = false;
+	s32 invWorldID, worldViewProjID, lightPosID, lightColorID, transWorldID, textureID;
+
+	bool valid = false;
+	core::matrix4 lastView, lastProjection, viewProj;
+	core::matrix4 lastWorld;
+	core::vector3df lastLightPos;
+
+	u32 uploads = 0, lastFrameUploads = 0;
+
+	void resolveIDs(video::IMaterialRendererServices* services) {
+		invWorldID = services->getVertexShaderConstantID("mInvWorld");
+		worldViewProjID = services->getVertexShaderConstantID("mWorldViewProj");
+		lightPosID = services->getVertexShaderConstantID("mLightPos");
+		lightColorID = services->getVertexShaderConstantID("mLightColor");
+		transWorldID = services->getVertexShaderConstantID("mTransWorld");
+		textureID = services->getPixelShaderConstantID("myTexture");
+		idsResolved = true;
+	}
+
+	// Uploads by location for high level shaders, by register for assembly shaders
+	void setVertexConstant(video::IMaterialRendererServices* services, s32 id, s32 startRegister,
+		const f32* data, int count) {
+		if (UseHighLevelShaders)
+			services->setVertexShaderConstant(id, data, count);
+		else
+			services->setVertexShaderConstant(data, startRegister, (count + 3) / 4);
+		uploads++;
+	}
+
 public:
+	MyShaderCallBack(IrrlichtDevice* device, bool UseHighLevelShaders)
+		: UseHighLevelShaders(UseHighLevelShaders), device(device) {}
+
+	// Call once per frame before drawing
+	void beginFrame() {
+		lastFrameUploads = uploads;
+		uploads = 0;
+	}
+
+	// Number of constant uploads during the last frame
+	u32 getUploadsLastFrame() {
+		return lastFrameUploads;
+	}
+
+	// Forces all constants to be uploaded again, e.g. after another shader used them
+	void invalidate() {
+		valid = false;
+	}
 
 	virtual void OnSetConstants(video::IMaterialRendererServices* services,
 		s32 userData)
 	{
 		video::IVideoDriver* driver = services->getVideoDriver();
+		if (UseHighLevelShaders && !idsResolved)
+			resolveIDs(services);
+
+		const core::matrix4& world = driver->getTransform(video::ETS_WORLD);
+		const core::matrix4& view = driver->getTransform(video::ETS_VIEW);
+		const core::matrix4& projection = driver->getTransform(video::ETS_PROJECTION);
+
+		bool viewProjChanged = !valid || view != lastView || projection != lastProjection;
+		if (viewProjChanged) {
+			viewProj = projection * view;
+			lastView = view;
+			lastProjection = projection;
+		}
 
-		// set inverted world matrix
-		// if we are using highlevel shaders (the user can select this when
-		// starting the program), we must set the constants by name.
-
-		core::matrix4 invWorld = driver->getTransform(video::ETS_WORLD);
-		invWorld.makeInverse();
-
-		if (UseHighLevelShaders)
-			services->setVertexShaderConstant("mInvWorld", invWorld.pointer(), 16);
-		else
-			services->setVertexShaderConstant(invWorld.pointer(), 0, 4);
+		bool worldChanged = !valid || world != lastWorld;
+		if (worldChanged) {
+			// set inverted world matrix
+			core::matrix4 invWorld = world;
+			invWorld.makeInverse();
+			setVertexConstant(services, invWorldID, 0, invWorld.pointer(), 16);
+
+			// set transposed world matrix
+			core::matrix4 transWorld = world.getTransposed();
+			setVertexConstant(services, transWorldID, 10, transWorld.pointer(), 16);
+			lastWorld = world;
+		}
 
 		// set clip matrix
-
-		core::matrix4 worldViewProj;
-		worldViewProj = driver->getTransform(video::ETS_PROJECTION);
-		worldViewProj *= driver->getTransform(video::ETS_VIEW);
-		worldViewProj *= driver->getTransform(video::ETS_WORLD);
-
-		if (UseHighLevelShaders)
-			services->setVertexShaderConstant("mWorldViewProj", worldViewProj.pointer(), 16);
-		else
-			services->setVertexShaderConstant(worldViewProj.pointer(), 4, 4);
+		if (worldChanged || viewProjChanged) {
+			core::matrix4 worldViewProj = viewProj * world;
+			setVertexConstant(services, worldViewProjID, 4, worldViewProj.pointer(), 16);
+		}
 
 		// set camera position
-
 		core::vector3df pos = device->getSceneManager()->
 			getActiveCamera()->getAbsolutePosition();
+		if (!valid || pos != lastLightPos) {
+			setVertexConstant(services, lightPosID, 8, reinterpret_cast<f32*>(&pos), 3);
+			lastLightPos = pos;
+		}
 
-		if (UseHighLevelShaders)
-			services->setVertexShaderConstant("mLightPos", reinterpret_cast<f32*>(&pos), 3);
-		else
-			services->setVertexShaderConstant(reinterpret_cast<f32*>(&pos), 8, 1);
-
-		// set light color
-
-		video::SColorf col(0.0f, 1.0f, 1.0f, 0.0f);
-
-		if (UseHighLevelShaders)
-			services->setVertexShaderConstant("mLightColor",
-				reinterpret_cast<f32*>(&col), 4);
-		else
-			services->setVertexShaderConstant(reinterpret_cast<f32*>(&col), 9, 1);
-
-		// set transposed world matrix
-
-		core::matrix4 world = driver->getTransform(video::ETS_WORLD);
-		world = world.getTransposed();
-
-		if (UseHighLevelShaders)
-		{
-			services->setVertexShaderConstant("mTransWorld", world.pointer(), 16);
+		if (!valid) {
+			// set light color
+			video::SColorf col(0.0f, 1.0f, 1.0f, 0.0f);
+			setVertexConstant(services, lightColorID, 9, reinterpret_cast<f32*>(&col), 4);
 
 			// set texture, for textures you can use both an int and a float setPixelShaderConstant interfaces (You need it only for an OpenGL driver).
-			s32 TextureLayerID = 0;
-			if (UseHighLevelShaders)
-				services->setPixelShaderConstant("myTexture", &TextureLayerID, 1);
+			if (UseHighLevelShaders) {
+				s32 TextureLayerID = 0;
+				services->setPixelShaderConstant(textureID, &TextureLayerID, 1);
+				uploads++;
+			}
 		}
-		else
-			services->setVertexShaderConstant(world.pointer(), 10, 4);
+		valid = true;
 	}
 };
 
-void setupShader(IrrlichtDevice* device, bool UseHighLevelShaders, 
+// Chooses the shader files for the driver and creates the shader material from them.
+// Returns video::EMT_SOLID when the driver cannot run them, e.g. the software renderers,
+// so the result can always be used as material type.
+s32 setupShader(IrrlichtDevice* device, bool UseHighLevelShaders, 
 	video::IVideoDriver* driver, video::E_DRIVER_TYPE driverType,
-	io::path& psFileName, io::path& vsFileName) {
+	io::path& psFileName, io::path& vsFileName, MyShaderCallBack* callback) {
 
 	switch (driverType)
 	{
@@ -132,4 +184,21 @@ void setupShader(IrrlichtDevice* device, bool UseHighLevelShaders,
 			"because of missing driver/hardware support.");
 		vsFileName = "";
 	}
-}
\ No newline at end of file
+
+	s32 materialType = -1;
+	video::IGPUProgrammingServices* gpu = driver->getGPUProgrammingServices();
+	if (gpu != NULL && (psFileName.size() > 0 || vsFileName.size() > 0)) {
+		if (UseHighLevelShaders)
+			materialType = gpu->addHighLevelShaderMaterialFromFiles(
+				vsFileName, "vertexMain", video::EVST_VS_1_1,
+				psFileName, "pixelMain", video::EPST_PS_1_1,
+				callback, video::EMT_SOLID);
+		else
+			materialType = gpu->addShaderMaterialFromFiles(vsFileName, psFileName, callback, video::EMT_SOLID);
+	}
+	if (materialType < 0) {
+		device->getLogger()->log("WARNING: Shader material could not be created, using the fixed function pipeline.");
+		return video::EMT_SOLID;
+	}
+	return materialType;
+}
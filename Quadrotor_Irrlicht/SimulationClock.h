@@ -0,0 +1,69 @@
+#pragma once
+#include <irrlicht.h>
+
+using namespace irr;
+
+#define SIM_TICKS_PER_SECOND 1000000 // default resolution: microseconds
+
+// Simulation time as 64-bit integer ticks, so it never loses precision no matter how long
+// a run takes. Convert to seconds only for differences or relative to an epoch.
+class SimulationClock {
+private:
+	s64 ticks = 0;
+	s64 ticksPerSecond;
+	double carry = 0.0; // fractions of a tick not yet added
+	s64 msCarry = 0;	// remainder of advanceMs in thousandths of a tick
+
+public:
+	SimulationClock(s64 ticksPerSecond = SIM_TICKS_PER_SECOND) : ticksPerSecond(ticksPerSecond) {}
+
+	void reset() {
+		ticks = 0;
+		carry = 0.0;
+		msCarry = 0;
+	}
+
+	// Advances by a time step in seconds; fractional ticks are carried over to the next step
+	void advance(double seconds) {
+		double t = seconds * ticksPerSecond + carry;
+		s64 whole = (s64)t;
+		carry = t - whole;
+		ticks += whole;
+	}
+
+	void advanceTicks(s64 dTicks) {
+		ticks += dTicks;
+	}
+
+	// Exact for any resolution: the remainder of the division is carried over to the next step
+	void advanceMs(u32 ms) {
+		s64 scaled = (s64)ms * ticksPerSecond + msCarry;
+		ticks += scaled / 1000;
+		msCarry = scaled % 1000;
+	}
+
+	s64 getTicks() const {
+		return ticks;
+	}
+
+	s64 getTicksPerSecond() const {
+		return ticksPerSecond;
+	}
+
+	double getSeconds() const {
+		return (double)ticks / ticksPerSecond;
+	}
+
+	// Seconds elapsed since the given tick count, safe to store as f32 for short spans
+	double secondsSince(s64 epoch) const {
+		return toSeconds(ticks - epoch);
+	}
+
+	double toSeconds(s64 dTicks) const {
+		return (double)dTicks / ticksPerSecond;
+	}
+
+	s64 fromSeconds(double seconds) const {
+		return (s64)(seconds * ticksPerSecond);
+	}
+};
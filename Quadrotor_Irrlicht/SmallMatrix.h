@@ -0,0 +1,195 @@
+#pragma once
+#include <irrlicht.h>
+#include <cmath>
+
+using namespace irr;
+
+// Fixed-size row-major matrix for small linear algebra in the simulation step.
+// It is an aggregate without constructors, so it lives on the stack, is trivially copyable and
+// can be built in constant expressions: SMatrix<float, 3, 3> m = { { 1, 0, 0, 0, 1, 0, 0, 0, 1 } };
+// All loops have compile-time bounds, which lets the compiler unroll and vectorize them.
+template <typename T, int R, int C>
+struct SMatrix {
+	T m[R * C];
+
+	constexpr T& operator()(int r, int c) {
+		return m[r * C + c];
+	}
+
+	constexpr const T& operator()(int r, int c) const {
+		return m[r * C + c];
+	}
+
+	// Element access for vectors
+	constexpr T& operator[](int i) {
+		return m[i];
+	}
+
+	constexpr const T& operator[](int i) const {
+		return m[i];
+	}
+
+	static constexpr SMatrix zero() {
+		SMatrix r = {};
+		return r;
+	}
+
+	static constexpr SMatrix identity() {
+		SMatrix r = {};
+		for (int i = 0; i < (R < C ? R : C); ++i)
+			r(i, i) = 1;
+		return r;
+	}
+
+	static constexpr SMatrix diagonal(T a, T b, T c) {
+		SMatrix r = {};
+		r(0, 0) = a;
+		r(1, 1) = b;
+		r(2, 2) = c;
+		return r;
+	}
+
+	constexpr SMatrix operator+(const SMatrix& o) const {
+		SMatrix r = {};
+		for (int i = 0; i < R * C; ++i)
+			r.m[i] = m[i] + o.m[i];
+		return r;
+	}
+
+	constexpr SMatrix operator-(const SMatrix& o) const {
+		SMatrix r = {};
+		for (int i = 0; i < R * C; ++i)
+			r.m[i] = m[i] - o.m[i];
+		return r;
+	}
+
+	constexpr SMatrix operator-() const {
+		SMatrix r = {};
+		for (int i = 0; i < R * C; ++i)
+			r.m[i] = -m[i];
+		return r;
+	}
+
+	constexpr SMatrix operator*(T s) const {
+		SMatrix r = {};
+		for (int i = 0; i < R * C; ++i)
+			r.m[i] = m[i] * s;
+		return r;
+	}
+
+	constexpr SMatrix& operator+=(const SMatrix& o) {
+		for (int i = 0; i < R * C; ++i)
+			m[i] += o.m[i];
+		return *this;
+	}
+
+	constexpr SMatrix& operator-=(const SMatrix& o) {
+		for (int i = 0; i < R * C; ++i)
+			m[i] -= o.m[i];
+		return *this;
+	}
+
+	template <int K>
+	constexpr SMatrix<T, R, K> operator*(const SMatrix<T, C, K>& o) const {
+		SMatrix<T, R, K> r = {};
+		for (int i = 0; i < R; ++i)
+			for (int k = 0; k < C; ++k)
+				for (int j = 0; j < K; ++j)
+					r(i, j) += (*this)(i, k) * o(k, j);
+		return r;
+	}
+
+	constexpr SMatrix<T, C, R> transposed() const {
+		SMatrix<T, C, R> r = {};
+		for (int i = 0; i < R; ++i)
+			for (int j = 0; j < C; ++j)
+				r(j, i) = (*this)(i, j);
+		return r;
+	}
+};
+
+typedef SMatrix<float, 3, 3> SMatrix3f;
+typedef SMatrix<float, 3, 1> SVector3f;
+
+template <typename T>
+constexpr SMatrix<T, 3, 1> makeVector(T x, T y, T z) {
+	SMatrix<T, 3, 1> v = { { x, y, z } };
+	return v;
+}
+
+template <typename T>
+constexpr T dot(const SMatrix<T, 3, 1>& a, const SMatrix<T, 3, 1>& b) {
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+template <typename T>
+constexpr SMatrix<T, 3, 1> cross(const SMatrix<T, 3, 1>& a, const SMatrix<T, 3, 1>& b) {
+	return makeVector(a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]);
+}
+
+// Inverse of a 3x3 matrix by its adjugate; the matrix has to be regular
+template <typename T>
+constexpr SMatrix<T, 3, 3> inverse(const SMatrix<T, 3, 3>& a) {
+	SMatrix<T, 3, 3> r = {};
+	r(0, 0) = a(1, 1) * a(2, 2) - a(1, 2) * a(2, 1);
+	r(0, 1) = a(0, 2) * a(2, 1) - a(0, 1) * a(2, 2);
+	r(0, 2) = a(0, 1) * a(1, 2) - a(0, 2) * a(1, 1);
+	r(1, 0) = a(1, 2) * a(2, 0) - a(1, 0) * a(2, 2);
+	r(1, 1) = a(0, 0) * a(2, 2) - a(0, 2) * a(2, 0);
+	r(1, 2) = a(0, 2) * a(1, 0) - a(0, 0) * a(1, 2);
+	r(2, 0) = a(1, 0) * a(2, 1) - a(1, 1) * a(2, 0);
+	r(2, 1) = a(0, 1) * a(2, 0) - a(0, 0) * a(2, 1);
+	r(2, 2) = a(0, 0) * a(1, 1) - a(0, 1) * a(1, 0);
+	T det = a(0, 0) * r(0, 0) + a(0, 1) * r(1, 0) + a(0, 2) * r(2, 0);
+	return r * (1 / det);
+}
+
+inline SVector3f toSVector(const core::vector3df& v) {
+	return makeVector(v.X, v.Y, v.Z);
+}
+
+inline core::vector3df toVector(const SVector3f& v) {
+	return core::vector3df(v[0], v[1], v[2]);
+}
+
+// Rotation part of an Irrlicht matrix, which transforms row vectors: R(i, j) = M[4 * j + i]
+inline SMatrix3f toSMatrix(const core::matrix4& matrix) {
+	SMatrix3f r;
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			r(i, j) = matrix[4 * j + i];
+	return r;
+}
+
+inline core::matrix4 toMatrix4(const SMatrix3f& r) {
+	core::matrix4 matrix;
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			matrix[4 * j + i] = r(i, j);
+	return matrix;
+}
+
+// Rotation by the angle |w| around w (Rodrigues)
+inline SMatrix3f rotationFromVector(const SVector3f& w) {
+	float angle = sqrtf(dot(w, w));
+	if (angle < 1e-9f)
+		return SMatrix3f::identity();
+	SVector3f k = w * (1 / angle);
+	float s = sinf(angle), c = 1 - cosf(angle);
+	SMatrix3f K = { { 0, -k[2], k[1], k[2], 0, -k[0], -k[1], k[0], 0 } };
+	return SMatrix3f::identity() + K * s + K * K * c;
+}
+
+// Makes the columns of a rotation matrix orthonormal again after integration drift
+inline void orthonormalize(SMatrix3f& r) {
+	SVector3f x = makeVector(r(0, 0), r(1, 0), r(2, 0)), y = makeVector(r(0, 1), r(1, 1), r(2, 1));
+	x = x * (1 / sqrtf(dot(x, x)));
+	y = y - x * dot(x, y);
+	y = y * (1 / sqrtf(dot(y, y)));
+	SVector3f z = cross(x, y);
+	for (int i = 0; i < 3; ++i) {
+		r(i, 0) = x[i];
+		r(i, 1) = y[i];
+		r(i, 2) = z[i];
+	}
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <irrlicht.h>
+#include "Quadrotor.h"
+#include "Sensors.h"
+#include "SmallMatrix.h"
+
+using namespace irr;
+
+// Updates Euler angles in degrees to an orientation, continuing from the last ones instead of wrapping
+inline void continueEulerAngles(core::vector3df& rotation, const SMatrix3f& orientation) {
+	core::vector3df newRot = toMatrix4(orientation).getRotationDegrees();
+	for (int a = 0; a < 3; ++a) {
+		float change = (&newRot.X)[a] - (&rotation.X)[a];
+		(&rotation.X)[a] += change - 360 * floorf((change + 180) / 360);
+	}
+}
+
+// Vehicle state as seen by a controller: either the simulation's truth or an estimate from sensors.
+// Rotations are Euler angles in degrees, continued instead of wrapped like Quadrotor's.
+class StateProvider {
+public:
+	virtual ~StateProvider() {}
+
+	// Called once per step after the vehicle and its sensors have been updated
+	virtual void update(float elapsedTime) {}
+
+	virtual core::vector3df getPosition() = 0;
+	virtual core::vector3df getSpeed() = 0;
+	virtual core::vector3df getRotation() = 0;
+};
+
+class TruthStateProvider : public StateProvider {
+private:
+	Quadrotor* quadrotor;
+
+public:
+	TruthStateProvider(Quadrotor* quadrotor) : quadrotor(quadrotor) {}
+
+	virtual core::vector3df getPosition() {
+		return quadrotor->getAbsolutePosition();
+	}
+
+	virtual core::vector3df getSpeed() {
+		return quadrotor->getSpeed();
+	}
+
+	virtual core::vector3df getRotation() {
+		return quadrotor->getRotation();
+	}
+};
+
+// Complementary filters on the sensors of a SensorSuite:
+// - attitude: the integrated gyroscope, pulled towards the tilt that makes the accelerometer point up
+//   (Mahony); the yaw has no reference and drifts with the gyroscope bias,
+// - height and climb rate: the vertical acceleration integrated twice, pulled towards the barometer,
+// - horizontal position and speed: the horizontal acceleration integrated twice, pulled towards the GPS.
+class ComplementaryStateProvider : public StateProvider {
+private:
+	const SensorSuite* sensors;
+	float gravity;
+	float tiltGain = 1.f;		   // 1/s
+	float heightGain = 2.f;		   // 1/s
+	float climbGain = 1.f;		   // 1/s^2
+	float gpsGain = 1.f;		   // 1/s, GPS fixes are noisier and come later than barometer samples
+	float gpsSpeedGain = .3f;	   // 1/s^2
+
+	SMatrix3f orientation = SMatrix3f::identity();
+	core::vector3df rotation;
+	float height = 0.f, climbRate = 0.f;
+	core::vector3df position, speed; // horizontal only
+	bool initialized = false, hasGps = false;
+
+public:
+	ComplementaryStateProvider(const SensorSuite* sensors, float gravity = 9.81f _METER) :
+		sensors(sensors), gravity(gravity) {
+	}
+
+	void setGains(float tilt, float height, float climb, float gps = 1.f, float gpsSpeed = .3f) {
+		tiltGain = tilt;
+		heightGain = height;
+		climbGain = climb;
+		gpsGain = gps;
+		gpsSpeedGain = gpsSpeed;
+	}
+
+	virtual void update(float elapsedTime) {
+		const Sensor& accelerometer = sensors->getAccelerometer();
+		const Sensor& gyroscope = sensors->getGyroscope();
+		const Sensor& barometer = sensors->getBarometer();
+		if (!accelerometer.isValid() || !gyroscope.isValid() || !barometer.isValid())
+			return;
+		if (!initialized) {
+			height = barometer.getValue().Y;
+			initialized = true;
+		}
+
+		// Attitude: the tilt error is the rotation from the measured up direction to the estimated one
+		SVector3f measuredUp = toSVector(accelerometer.getValue());
+		float length = sqrtf(dot(measuredUp, measuredUp));
+		SVector3f rate = toSVector(gyroscope.getValue()) * core::DEGTORAD;
+		if (length > 0) {
+			SVector3f estimatedUp = makeVector(orientation(1, 0), orientation(1, 1), orientation(1, 2));
+			rate += cross(measuredUp * (1 / length), estimatedUp) * tiltGain;
+		}
+		orientation = orientation * rotationFromVector(rate * elapsedTime);
+		orthonormalize(orientation);
+		continueEulerAngles(rotation, orientation);
+
+		// Height: vertical acceleration in world axes, corrected by the barometer
+		SVector3f force = orientation * toSVector(accelerometer.getValue());
+		float error = barometer.getValue().Y - height;
+		climbRate += (force[1] - gravity + climbGain * error) * elapsedTime;
+		height += (climbRate + heightGain * error) * elapsedTime;
+
+		// Horizontal: the same on the other two axes with the GPS as the reference
+		const Sensor& gps = sensors->getGps();
+		if (!gps.isValid())
+			return;
+		core::vector3df gpsPosition = gps.getValue();
+		if (!hasGps) {
+			position = gpsPosition;
+			hasGps = true;
+		}
+		core::vector3df gpsError = gpsPosition - position;
+		speed.X += (force[0] + gpsSpeedGain * gpsError.X) * elapsedTime;
+		speed.Z += (force[2] + gpsSpeedGain * gpsError.Z) * elapsedTime;
+		position.X += (speed.X + gpsGain * gpsError.X) * elapsedTime;
+		position.Z += (speed.Z + gpsGain * gpsError.Z) * elapsedTime;
+	}
+
+	virtual core::vector3df getPosition() {
+		return core::vector3df(position.X, height, position.Z);
+	}
+
+	virtual core::vector3df getSpeed() {
+		return core::vector3df(speed.X, climbRate, speed.Z);
+	}
+
+	virtual core::vector3df getRotation() {
+		return rotation;
+	}
+};
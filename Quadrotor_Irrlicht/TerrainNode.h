@@ -0,0 +1,341 @@
+#pragma once
+#include <irrlicht.h>
+#include <vector>
+#include "HeightMap.h"
+
+using namespace irr;
+
+#define TERRAIN_MAX_LODS 8
+
+// Draws a HeightMap as square chunks of chunkCells x chunkCells cells.
+// Each chunk has levels of detail that skip 2^lod samples; the level follows the distance from
+// the camera to the chunk, doubling the step every time the distance doubles beyond
+// lodDistance chunk sizes. Neighbouring chunks of different levels do not share their border
+// vertices, so every chunk has a skirt hanging down from its border that hides the cracks.
+// Chunks are culled in regions of 8 x 8 chunks first, then one by one.
+// Chunk geometry is built on demand into static hardware buffers, at most maxBuildsPerFrame per
+// frame, and freed again when it has not been drawn for a while, so memory follows the view
+// and not the size of the map. Until a wanted level is built, the nearest cached one is drawn.
+// The vertices are in world coordinates; the node has to stay at the origin.
+class TerrainNode : public scene::ISceneNode
+{
+private:
+	struct Chunk {
+		core::aabbox3df box;
+		scene::SMeshBuffer* lods[TERRAIN_MAX_LODS];
+		u32 lastUsed[TERRAIN_MAX_LODS];
+	};
+
+	struct Region {
+		core::aabbox3df box;
+		int firstX, firstZ, endX, endZ; // chunk range
+	};
+
+	struct CachedLod {
+		int chunk, lod;
+	};
+
+	const HeightMap* heightMap;
+	core::aabbox3d<f32> Box;
+	video::SMaterial Material;
+	std::vector<Chunk> chunks;
+	std::vector<Region> regions;
+	std::vector<CachedLod> cached;
+	int chunkCells;
+	int chunksPerSide;
+	int numLods;
+	float textureSize;
+
+	float lodDistance = 2.f; // in chunk sizes
+	int maxBuildsPerFrame = 16;
+	u32 evictAfterFrames = 300;
+
+	u32 frame = 0;
+	int builtLastFrame = 0;
+	int drawnLastFrame = 0;
+	u32 trianglesLastFrame = 0;
+
+	static bool isBoxCulled(const core::aabbox3df& box, const scene::SViewFrustum* frustum) {
+		for (int p = 0; p < scene::SViewFrustum::VF_PLANE_COUNT; ++p) {
+			const core::plane3df& plane = frustum->planes[p];
+			// Corner of the box furthest inside the plane
+			core::vector3df inner(plane.Normal.X > 0 ? box.MinEdge.X : box.MaxEdge.X,
+				plane.Normal.Y > 0 ? box.MinEdge.Y : box.MaxEdge.Y,
+				plane.Normal.Z > 0 ? box.MinEdge.Z : box.MaxEdge.Z);
+			if (plane.getDistanceTo(inner) > 0)
+				return true;
+		}
+		return false;
+	}
+
+	static float getDistance(const core::aabbox3df& box, const core::vector3df& p) {
+		core::vector3df closest(core::clamp(p.X, box.MinEdge.X, box.MaxEdge.X),
+			core::clamp(p.Y, box.MinEdge.Y, box.MaxEdge.Y), core::clamp(p.Z, box.MinEdge.Z, box.MaxEdge.Z));
+		return closest.getDistanceFrom(p);
+	}
+
+	int selectLod(float distance) const {
+		float threshold = lodDistance * chunkCells * heightMap->getCellSize();
+		int lod = 0;
+		while (distance > threshold && lod < numLods - 1) {
+			threshold *= 2;
+			lod++;
+		}
+		return lod;
+	}
+
+	scene::SMeshBuffer* buildChunk(int chunkIdx, int lod) {
+		int cx = chunkIdx % chunksPerSide, cz = chunkIdx / chunksPerSide;
+		int step = 1 << lod;
+		int n = chunkCells / step + 1; // vertices per side
+		int last = heightMap->getSize() - 1;
+		float cellSize = heightMap->getCellSize();
+		core::vector2df origin = heightMap->getOrigin();
+		const Chunk& chunk = chunks[chunkIdx];
+
+		scene::SMeshBuffer* buffer = new scene::SMeshBuffer();
+		buffer->Vertices.reallocate(n * n + 4 * n);
+		buffer->Indices.reallocate(6 * (n - 1) * (n - 1) + 24 * (n - 1));
+		video::SColor white(255, 255, 255, 255);
+		for (int j = 0; j < n; ++j)
+			for (int i = 0; i < n; ++i) {
+				// The last chunks of a map whose size is no multiple of chunkCells end in degenerate cells
+				int ix = core::min_(cx * chunkCells + i * step, last), iz = core::min_(cz * chunkCells + j * step, last);
+				core::vector3df pos(origin.X + ix * cellSize, heightMap->getSampleHeight(ix, iz), origin.Y + iz * cellSize);
+				buffer->Vertices.push_back(video::S3DVertex(pos, heightMap->getSampleNormal(ix, iz), white,
+					core::vector2df(pos.X / textureSize, pos.Z / textureSize)));
+			}
+		for (int j = 0; j < n - 1; ++j)
+			for (int i = 0; i < n - 1; ++i) {
+				u16 a = (u16)(j * n + i), b = (u16)(a + 1), c = (u16)(a + n), d = (u16)(c + 1);
+				u16 quad[6] = { a, c, b, b, c, d };
+				for (int k = 0; k < 6; ++k)
+					buffer->Indices.push_back(quad[k]);
+			}
+
+		// Skirt: a copy of the border lowered by more than any crack can be deep, drawn from both sides
+		float depth = chunk.box.MaxEdge.Y - chunk.box.MinEdge.Y + step * cellSize;
+		int border[4][2] = { { 0, 1 }, { n - 1, n }, { 0, n }, { n * (n - 1), 1 } }; // first vertex, stride
+		for (int e = 0; e < 4; ++e) {
+			u16 first = (u16)buffer->Vertices.size();
+			for (int k = 0; k < n; ++k) {
+				video::S3DVertex v = buffer->Vertices[border[e][0] + k * border[e][1]];
+				v.Pos.Y -= depth;
+				buffer->Vertices.push_back(v);
+			}
+			for (int k = 0; k < n - 1; ++k) {
+				u16 a = (u16)(border[e][0] + k * border[e][1]), b = (u16)(a + border[e][1]);
+				u16 c = (u16)(first + k), d = (u16)(c + 1);
+				u16 quads[12] = { a, c, b, b, c, d, a, b, c, b, d, c };
+				for (int q = 0; q < 12; ++q)
+					buffer->Indices.push_back(quads[q]);
+			}
+		}
+		buffer->BoundingBox = chunk.box;
+		buffer->BoundingBox.MinEdge.Y -= depth;
+		buffer->setHardwareMappingHint(scene::EHM_STATIC);
+		return buffer;
+	}
+
+	void freeLod(int chunkIdx, int lod) {
+		scene::SMeshBuffer*& buffer = chunks[chunkIdx].lods[lod];
+		SceneManager->getVideoDriver()->removeHardwareBuffer(buffer);
+		buffer->drop();
+		buffer = NULL;
+	}
+
+	// Returns the buffer to draw for a chunk, building it if the budget allows
+	scene::SMeshBuffer* getLod(int chunkIdx, int lod) {
+		Chunk& chunk = chunks[chunkIdx];
+		if (chunk.lods[lod] == NULL) {
+			if (builtLastFrame >= maxBuildsPerFrame) {
+				// Nearest cached level, preferring coarser ones
+				for (int d = 1; d < numLods; ++d) {
+					if (lod + d < numLods && chunk.lods[lod + d] != NULL) {
+						lod += d;
+						break;
+					}
+					if (lod - d >= 0 && chunk.lods[lod - d] != NULL) {
+						lod -= d;
+						break;
+					}
+				}
+				// Nothing cached yet: the coarsest level is cheap enough to build anyway
+				if (chunk.lods[lod] == NULL)
+					lod = numLods - 1;
+			}
+			if (chunk.lods[lod] == NULL) {
+				chunk.lods[lod] = buildChunk(chunkIdx, lod);
+				CachedLod entry = { chunkIdx, lod };
+				cached.push_back(entry);
+				builtLastFrame++;
+			}
+		}
+		chunk.lastUsed[lod] = frame;
+		return chunk.lods[lod];
+	}
+
+	void evictUnused() {
+		for (size_t i = 0; i < cached.size();) {
+			CachedLod entry = cached[i];
+			if (frame - chunks[entry.chunk].lastUsed[entry.lod] > evictAfterFrames) {
+				freeLod(entry.chunk, entry.lod);
+				cached[i] = cached.back();
+				cached.pop_back();
+			}
+			else
+				++i;
+		}
+	}
+
+public:
+	// chunkCells is rounded down to a power of two between 2 and 128; textureSize is the world size of one texture tile
+	TerrainNode(const HeightMap* heightMap, video::ITexture* texture, scene::ISceneNode* parent, scene::ISceneManager* smgr,
+		s32 id, int chunkCells = 32, float textureSize = 500.f)
+		: scene::ISceneNode(parent, smgr, id), heightMap(heightMap), textureSize(textureSize)
+	{
+		Material.Lighting = true;
+		Material.AmbientColor = video::SColor(255, 100, 100, 100);
+		this->setMaterialTexture(0, texture);
+		setAutomaticCulling(scene::EAC_OFF);
+
+		this->chunkCells = 2;
+		numLods = 2;
+		while (this->chunkCells * 2 <= core::min_(chunkCells, 128) && numLods < TERRAIN_MAX_LODS) {
+			this->chunkCells *= 2;
+			numLods++;
+		}
+		int cells = heightMap->getSize() - 1;
+		chunksPerSide = (cells + this->chunkCells - 1) / this->chunkCells;
+		float cellSize = heightMap->getCellSize();
+		core::vector2df origin = heightMap->getOrigin();
+
+		// Chunk bounds from their samples, once
+		chunks.resize(chunksPerSide * chunksPerSide);
+		for (int cz = 0; cz < chunksPerSide; ++cz)
+			for (int cx = 0; cx < chunksPerSide; ++cx) {
+				Chunk& chunk = chunks[cz * chunksPerSide + cx];
+				int x0 = cx * this->chunkCells, z0 = cz * this->chunkCells;
+				int x1 = core::min_(x0 + this->chunkCells, cells), z1 = core::min_(z0 + this->chunkCells, cells);
+				float minY = heightMap->getSampleHeight(x0, z0), maxY = minY;
+				for (int iz = z0; iz <= z1; ++iz)
+					for (int ix = x0; ix <= x1; ++ix) {
+						float h = heightMap->getSampleHeight(ix, iz);
+						minY = core::min_(minY, h);
+						maxY = core::max_(maxY, h);
+					}
+				chunk.box = core::aabbox3df(origin.X + x0 * cellSize, minY, origin.Y + z0 * cellSize,
+					origin.X + x1 * cellSize, maxY, origin.Y + z1 * cellSize);
+				for (int l = 0; l < TERRAIN_MAX_LODS; ++l) {
+					chunk.lods[l] = NULL;
+					chunk.lastUsed[l] = 0;
+				}
+			}
+
+		for (int rz = 0; rz < chunksPerSide; rz += 8)
+			for (int rx = 0; rx < chunksPerSide; rx += 8) {
+				Region region;
+				region.firstX = rx;
+				region.firstZ = rz;
+				region.endX = core::min_(rx + 8, chunksPerSide);
+				region.endZ = core::min_(rz + 8, chunksPerSide);
+				region.box = chunks[rz * chunksPerSide + rx].box;
+				for (int cz = region.firstZ; cz < region.endZ; ++cz)
+					for (int cx = region.firstX; cx < region.endX; ++cx)
+						region.box.addInternalBox(chunks[cz * chunksPerSide + cx].box);
+				regions.push_back(region);
+			}
+
+		Box.reset(chunks.empty() ? core::vector3df(0, 0, 0) : chunks[0].box.MinEdge);
+		for (size_t r = 0; r < regions.size(); ++r)
+			Box.addInternalBox(regions[r].box);
+	}
+
+	~TerrainNode() {
+		for (size_t i = 0; i < cached.size(); ++i)
+			freeLod(cached[i].chunk, cached[i].lod);
+	}
+
+	const HeightMap* getHeightMap() {
+		return heightMap;
+	}
+
+	// Distance in chunk sizes up to which chunks are drawn at full resolution
+	void setLodDistance(float lodDistance) {
+		this->lodDistance = lodDistance;
+	}
+
+	void setMaxBuildsPerFrame(int maxBuildsPerFrame) {
+		this->maxBuildsPerFrame = maxBuildsPerFrame;
+	}
+
+	int getDrawnChunks() {
+		return drawnLastFrame;
+	}
+
+	u32 getDrawnTriangles() {
+		return trianglesLastFrame;
+	}
+
+	int getCachedBuffers() {
+		return (int)cached.size();
+	}
+
+	virtual void OnRegisterSceneNode()
+	{
+		if (IsVisible && !chunks.empty())
+			SceneManager->registerNodeForRendering(this);
+
+		ISceneNode::OnRegisterSceneNode();
+	}
+
+	virtual void render()
+	{
+		video::IVideoDriver* driver = SceneManager->getVideoDriver();
+		scene::ICameraSceneNode* camera = SceneManager->getActiveCamera();
+		if (camera == NULL)
+			return;
+		const scene::SViewFrustum* frustum = camera->getViewFrustum();
+		core::vector3df cameraPos = camera->getAbsolutePosition();
+
+		frame++;
+		builtLastFrame = 0;
+		drawnLastFrame = 0;
+		trianglesLastFrame = 0;
+		driver->setTransform(video::ETS_WORLD, core::IdentityMatrix);
+		driver->setMaterial(Material);
+		for (size_t r = 0; r < regions.size(); ++r) {
+			const Region& region = regions[r];
+			if (isBoxCulled(region.box, frustum))
+				continue;
+			for (int cz = region.firstZ; cz < region.endZ; ++cz)
+				for (int cx = region.firstX; cx < region.endX; ++cx) {
+					int chunkIdx = cz * chunksPerSide + cx;
+					const Chunk& chunk = chunks[chunkIdx];
+					if (isBoxCulled(chunk.box, frustum))
+						continue;
+					scene::SMeshBuffer* buffer = getLod(chunkIdx, selectLod(getDistance(chunk.box, cameraPos)));
+					driver->drawMeshBuffer(buffer);
+					drawnLastFrame++;
+					trianglesLastFrame += buffer->Indices.size() / 3;
+				}
+		}
+		if (frame % 64 == 0)
+			evictUnused();
+	}
+
+	virtual const core::aabbox3d<f32>& getBoundingBox() const
+	{
+		return Box;
+	}
+
+	virtual u32 getMaterialCount() const
+	{
+		return 1;
+	}
+
+	virtual video::SMaterial& getMaterial(u32 i)
+	{
+		return Material;
+	}
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+// Fixed set of worker threads for data-parallel loops.
+// parallelFor splits [0, count) into chunks of grain items, which the workers and the calling thread
+// take from a shared counter until none are left; it returns when all chunks are done. The loop body
+// is passed on as a function pointer and a context pointer, so starting a loop does not allocate.
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	unsigned generation = 0; // counts the loops, a worker runs every loop once
+	bool quit = false;
+
+	void (*job)(const void*, int, int) = nullptr;
+	const void* context = nullptr;
+	int count = 0, grain = 1;
+	std::atomic<int> next;
+	int busy = 0; // workers that have not finished the current loop
+
+	void runChunks() {
+		for (;;) {
+			int begin = next.fetch_add(grain);
+			if (begin >= count)
+				return;
+			job(context, begin, std::min(begin + grain, count));
+		}
+	}
+
+	void run() {
+		unsigned seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return quit || generation != seen; });
+				if (quit)
+					return;
+				seen = generation;
+			}
+			runChunks();
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busy == 0)
+				done.notify_one();
+		}
+	}
+
+	template <class F>
+	static void invoke(const void* f, int begin, int end) {
+		(*(const F*)f)(begin, end);
+	}
+
+public:
+	// By default one worker less than there are hardware threads, the caller is the last one
+	explicit ThreadPool(int threads = -1) : next(0) {
+		if (threads < 0)
+			threads = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+		for (int i = 0; i < threads; ++i)
+			workers.push_back(std::thread(&ThreadPool::run, this));
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+	}
+
+	// Including the calling thread
+	int getThreadCount() const {
+		return (int)workers.size() + 1;
+	}
+
+	// Calls f(begin, end) for consecutive ranges of at most grain items; not reentrant
+	template <class F>
+	void parallelFor(int count, int grain, const F& f) {
+		if (workers.empty() || count <= grain) {
+			if (count > 0)
+				f(0, count);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = &invoke<F>;
+			context = &f;
+			this->count = count;
+			this->grain = grain;
+			next = 0;
+			busy = (int)workers.size();
+			++generation;
+		}
+		wake.notify_all();
+		runChunks();
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [&] { return busy == 0; });
+	}
+};
@@ -0,0 +1,243 @@
+#pragma once
+#include <irrlicht.h>
+#include <vector>
+
+using namespace irr;
+
+// Draws the flight paths of any number of vehicles as two crossed ribbons, so a trail is
+// visible from the side and from above without rebuilding it for the camera.
+// Each trail is a ring of chunks of chunkPoints points. Only the chunk that is being filled
+// is sent from memory every frame; a full chunk is uploaded once into a static hardware
+// buffer and stays there until its slot is reused for new points. The per-frame cost
+// therefore depends on the number of new samples and chunks, not on the trail length.
+// Trails fade out by age chunk by chunk through the material color with additive blending.
+class TrailNode : public scene::ISceneNode
+{
+private:
+	struct Chunk {
+		scene::SMeshBuffer* buffer;
+		u32 numPoints = 0;
+		bool uploaded = false; // complete and kept in a hardware buffer
+	};
+
+	struct Trail {
+		video::SColor color;
+		std::vector<Chunk> chunks; // ring, chunks[newest] is being filled
+		int newest = 0;
+		int numChunks = 0;		   // chunks holding points
+		core::vector3df lastPoint;
+		bool hasPoint = false;
+		bool visible = true;
+	};
+
+	core::aabbox3d<f32> Box;
+	std::vector<Trail> trails;
+	u32 chunkPoints;
+	int chunksPerTrail;
+	float width;
+	float minSpacing;
+	video::SMaterial material;
+
+	// Four vertices per point: two for the vertical ribbon, two for the horizontal one
+	void appendPoint(Chunk& chunk, const core::vector3df& pos, const core::vector3df& dir) {
+		core::vector3df up(0, width / 2, 0);
+		core::vector3df side = dir.crossProduct(core::vector3df(0, 1, 0));
+		if (side.getLengthSQ() < 1e-6f)
+			side.set(1, 0, 0);
+		side.setLength(width / 2);
+		core::array<video::S3DVertex>& v = chunk.buffer->Vertices;
+		video::SColor white(255, 255, 255, 255);
+		v.push_back(video::S3DVertex(pos + up, core::vector3df(0, 0, 1), white, core::vector2df(0, 0)));
+		v.push_back(video::S3DVertex(pos - up, core::vector3df(0, 0, 1), white, core::vector2df(0, 1)));
+		v.push_back(video::S3DVertex(pos + side, core::vector3df(0, 1, 0), white, core::vector2df(0, 0)));
+		v.push_back(video::S3DVertex(pos - side, core::vector3df(0, 1, 0), white, core::vector2df(0, 1)));
+
+		if (chunk.numPoints == 0)
+			chunk.buffer->BoundingBox.reset(pos);
+		else {
+			chunk.buffer->BoundingBox.addInternalPoint(pos);
+			u16 b0 = (u16)(4 * (chunk.numPoints - 1)), b1 = (u16)(4 * chunk.numPoints);
+			u16 quads[12] = { b0, b1, (u16)(b0 + 1), (u16)(b0 + 1), b1, (u16)(b1 + 1),
+				(u16)(b0 + 2), (u16)(b1 + 2), (u16)(b0 + 3), (u16)(b0 + 3), (u16)(b1 + 2), (u16)(b1 + 3) };
+			for (int k = 0; k < 12; ++k)
+				chunk.buffer->Indices.push_back(quads[k]);
+		}
+		chunk.numPoints++;
+	}
+
+	void resetChunk(Chunk& chunk) {
+		// Drops the hardware buffer until the chunk is complete again
+		chunk.buffer->setHardwareMappingHint(scene::EHM_NEVER);
+		chunk.buffer->Vertices.set_used(0);
+		chunk.buffer->Indices.set_used(0);
+		chunk.numPoints = 0;
+		chunk.uploaded = false;
+	}
+
+	void updateBoundingBox() {
+		bool first = true;
+		for (size_t t = 0; t < trails.size(); ++t)
+			for (int c = 0; c < trails[t].numChunks; ++c) {
+				const Chunk& chunk = trails[t].chunks[(trails[t].newest - c + chunksPerTrail) % chunksPerTrail];
+				if (chunk.numPoints == 0)
+					continue;
+				if (first)
+					Box = chunk.buffer->BoundingBox;
+				else
+					Box.addInternalBox(chunk.buffer->BoundingBox);
+				first = false;
+			}
+		if (first)
+			Box.reset(0, 0, 0);
+	}
+
+	bool isChunkCulled(const Chunk& chunk, const scene::SViewFrustum* frustum) {
+		const core::aabbox3df& box = chunk.buffer->BoundingBox;
+		core::vector3df center = box.getCenter();
+		float radius = box.getExtent().getLength() / 2 + width;
+		for (int p = 0; p < scene::SViewFrustum::VF_PLANE_COUNT; ++p)
+			if (frustum->planes[p].getDistanceTo(center) > radius)
+				return true;
+		return false;
+	}
+
+public:
+	// Every trail keeps up to maxPoints points; a new point is only added after moving minSpacing
+	TrailNode(scene::ISceneNode* parent, scene::ISceneManager* smgr, s32 id, int maxPoints = 4096,
+		float width = 3.f, float minSpacing = 5.f, u32 chunkPoints = 256)
+		: scene::ISceneNode(parent, smgr, id), chunkPoints(chunkPoints), width(width), minSpacing(minSpacing)
+	{
+		// 4 vertices per point have to fit 16 bit indices
+		this->chunkPoints = core::clamp(chunkPoints, (u32)2, (u32)16384);
+		chunksPerTrail = core::max_((maxPoints + (int)this->chunkPoints - 1) / (int)this->chunkPoints, 2);
+		material.Lighting = true;
+		material.ColorMaterial = video::ECM_NONE;
+		material.AmbientColor = video::SColor(255, 0, 0, 0);
+		material.DiffuseColor = video::SColor(255, 0, 0, 0);
+		material.MaterialType = video::EMT_TRANSPARENT_ADD_COLOR;
+		material.BackfaceCulling = false;
+		material.ZWriteEnable = false;
+		setAutomaticCulling(scene::EAC_OFF);
+		Box.reset(0, 0, 0);
+	}
+
+	~TrailNode() {
+		for (size_t t = 0; t < trails.size(); ++t)
+			for (size_t c = 0; c < trails[t].chunks.size(); ++c)
+				trails[t].chunks[c].buffer->drop();
+	}
+
+	// Returns the index of the new trail
+	int addTrail(video::SColor color) {
+		trails.push_back(Trail());
+		Trail& trail = trails.back();
+		trail.color = color;
+		trail.chunks.resize(chunksPerTrail);
+		for (int c = 0; c < chunksPerTrail; ++c) {
+			trail.chunks[c].buffer = new scene::SMeshBuffer();
+			trail.chunks[c].buffer->Vertices.reallocate(4 * chunkPoints);
+			trail.chunks[c].buffer->Indices.reallocate(12 * (chunkPoints - 1));
+		}
+		return (int)trails.size() - 1;
+	}
+
+	int getTrailCount() {
+		return (int)trails.size();
+	}
+
+	void addPoint(int idx, const core::vector3df& pos) {
+		Trail& trail = trails[idx];
+		if (trail.hasPoint && pos.getDistanceFromSQ(trail.lastPoint) < minSpacing * minSpacing)
+			return;
+		core::vector3df dir = trail.hasPoint ? pos - trail.lastPoint : core::vector3df(1, 0, 0);
+
+		if (trail.numChunks == 0)
+			trail.numChunks = 1;
+		Chunk* chunk = &trail.chunks[trail.newest];
+		if (chunk->numPoints == chunkPoints) {
+			// The full chunk goes to a static hardware buffer once
+			chunk->buffer->setHardwareMappingHint(scene::EHM_STATIC);
+			chunk->buffer->setDirty();
+			chunk->uploaded = true;
+
+			trail.newest = (trail.newest + 1) % chunksPerTrail;
+			trail.numChunks = core::min_(trail.numChunks + 1, chunksPerTrail);
+			chunk = &trail.chunks[trail.newest];
+			resetChunk(*chunk);
+			updateBoundingBox();
+			// Repeat the last point so the chunks connect
+			appendPoint(*chunk, trail.lastPoint, dir);
+		}
+		appendPoint(*chunk, pos, dir);
+		trail.lastPoint = pos;
+		trail.hasPoint = true;
+		Box.addInternalPoint(pos);
+	}
+
+	void clear(int idx) {
+		Trail& trail = trails[idx];
+		for (int c = 0; c < chunksPerTrail; ++c)
+			resetChunk(trail.chunks[c]);
+		trail.newest = 0;
+		trail.numChunks = 0;
+		trail.hasPoint = false;
+		updateBoundingBox();
+	}
+
+	void setTrailVisible(int idx, bool visible) {
+		trails[idx].visible = visible;
+	}
+
+	virtual void OnRegisterSceneNode()
+	{
+		if (IsVisible && !trails.empty())
+			SceneManager->registerNodeForRendering(this, scene::ESNRP_TRANSPARENT);
+
+		ISceneNode::OnRegisterSceneNode();
+	}
+
+	virtual void render()
+	{
+		video::IVideoDriver* driver = SceneManager->getVideoDriver();
+		scene::ICameraSceneNode* camera = SceneManager->getActiveCamera();
+		const scene::SViewFrustum* frustum = camera ? camera->getViewFrustum() : NULL;
+		driver->setTransform(video::ETS_WORLD, core::IdentityMatrix);
+
+		for (size_t t = 0; t < trails.size(); ++t) {
+			Trail& trail = trails[t];
+			if (!trail.visible)
+				continue;
+			for (int age = 0; age < trail.numChunks; ++age) {
+				Chunk& chunk = trail.chunks[(trail.newest - age + chunksPerTrail) % chunksPerTrail];
+				if (chunk.numPoints < 2 || (frustum && isChunkCulled(chunk, frustum)))
+					continue;
+				// Older chunks are darker, which is more transparent when added
+				float fade = 1.f - (float)age / chunksPerTrail;
+				material.EmissiveColor.set(255, (u32)(trail.color.getRed() * fade),
+					(u32)(trail.color.getGreen() * fade), (u32)(trail.color.getBlue() * fade));
+				driver->setMaterial(material);
+				if (chunk.uploaded)
+					driver->drawMeshBuffer(chunk.buffer);
+				else
+					driver->drawVertexPrimitiveList(chunk.buffer->Vertices.const_pointer(), chunk.buffer->Vertices.size(),
+						chunk.buffer->Indices.const_pointer(), chunk.buffer->Indices.size() / 3,
+						video::EVT_STANDARD, scene::EPT_TRIANGLES, video::EIT_16BIT);
+			}
+		}
+	}
+
+	virtual const core::aabbox3d<f32>& getBoundingBox() const
+	{
+		return Box;
+	}
+
+	virtual u32 getMaterialCount() const
+	{
+		return 1;
+	}
+
+	virtual video::SMaterial& getMaterial(u32 i)
+	{
+		return material;
+	}
+};
@@ -0,0 +1,445 @@
+#pragma once
+#include <irrlicht.h>
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+#include "HeightMap.h"
+#include "CollisionWorld.h"
+#include "RayCaster.h"
+#include "Profiler.h"
+
+using namespace irr;
+
+#define _METER *100
+
+// Occupancy grid with a Euclidean signed distance field, for planners and collision checks.
+// Space is divided into cubic voxels, 8x8x8 voxels make a block, and blocks are only allocated where
+// something was inserted or where the distance field reaches, so memory grows with the surface of
+// the obstacles instead of the volume of the map. At most maxBlocks blocks of 4 KB are allocated;
+// beyond that, insertions are dropped and the field ends there.
+// Every voxel keeps a log-odds occupancy and, for either sign of the field, the offset to the nearest
+// voxel of the other kind: the nearest occupied voxel for free ones, the nearest free voxel for
+// occupied ones, up to maxDistance. update() brings the field up to date after occupancy changes with
+// a dynamic brushfire: voxels whose nearest voxel changed kind are cleared outwards first, then the
+// fronts around them and around the new sources spread again, so the work depends on the size of the
+// change and not of the map. Distances are then a lookup, which makes queries O(1).
+// Unknown voxels count as free.
+class VoxelMap {
+public:
+	enum { BLOCK = 8, BLOCK_VOXELS = BLOCK * BLOCK * BLOCK };
+
+private:
+	enum { NONE = -128, LOG_ODDS_HIT = 6, LOG_ODDS_MISS = 2, LOG_ODDS_MAX = 40 };
+	enum { FLAG_OCCUPIED = 1, FLAG_DIRTY = 2 };
+
+	struct Voxel {
+		s8 logOdds;
+		u8 flags;		  // FLAG_OCCUPIED is the state the field was built for
+		s8 nearest[2][3]; // offsets to the nearest occupied (0) and free (1) voxel, x is NONE if too far
+	};
+
+	struct Block {
+		Voxel voxels[BLOCK_VOXELS];
+	};
+
+	struct Index {
+		int x, y, z;
+	};
+
+	float voxelSize, invVoxelSize;
+	int maxDistance; // in voxels
+	int maxBlocks;
+	std::unordered_map<s64, Block*> blocks;
+	s64 lastKey = -1;
+	Block* lastBlock = NULL;
+	u32 droppedBlocks = 0;
+
+	std::vector<Index> dirty;						 // voxels whose log-odds crossed zero since update()
+	std::vector<Index> raiseQueue[2], lowerQueue[2]; // per field
+
+	// 21 bits per axis like the collision grid, blocks wrap around after about 2 million blocks
+	static s64 packBlock(int x, int y, int z) {
+		return ((s64)((x >> 3) & 0x1fffff) << 42) | ((s64)((y >> 3) & 0x1fffff) << 21) | (s64)((z >> 3) & 0x1fffff);
+	}
+
+	static Voxel& at(Block* block, int x, int y, int z) {
+		return block->voxels[(x & 7) + BLOCK * ((y & 7) + BLOCK * (z & 7))];
+	}
+
+	static const Voxel& at(const Block* block, int x, int y, int z) {
+		return block->voxels[(x & 7) + BLOCK * ((y & 7) + BLOCK * (z & 7))];
+	}
+
+	static int lengthSq(const s8* offset) {
+		return offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2];
+	}
+
+	// Queries may run on several threads, so only the updates cache the last block
+	const Block* findBlock(int x, int y, int z) const {
+		std::unordered_map<s64, Block*>::const_iterator it = blocks.find(packBlock(x, y, z));
+		return it != blocks.end() ? it->second : NULL;
+	}
+
+	Block* findBlock(int x, int y, int z) {
+		s64 key = packBlock(x, y, z);
+		if (key != lastKey) {
+			std::unordered_map<s64, Block*>::iterator it = blocks.find(key);
+			if (it == blocks.end())
+				return NULL;
+			lastKey = key;
+			lastBlock = it->second;
+		}
+		return lastBlock;
+	}
+
+	// NULL if the map is full
+	Block* allocateBlock(int x, int y, int z) {
+		Block* block = findBlock(x, y, z);
+		if (block != NULL)
+			return block;
+		if ((int)blocks.size() >= maxBlocks) {
+			++droppedBlocks;
+			return NULL;
+		}
+		// Unknown, far from any obstacle and its own nearest free voxel
+		block = new Block;
+		for (int i = 0; i < BLOCK_VOXELS; ++i) {
+			Voxel& v = block->voxels[i];
+			v.logOdds = 0;
+			v.flags = 0;
+			v.nearest[0][0] = NONE;
+			v.nearest[1][0] = v.nearest[1][1] = v.nearest[1][2] = 0;
+		}
+		lastKey = packBlock(x, y, z);
+		lastBlock = block;
+		blocks[lastKey] = block;
+		return block;
+	}
+
+	void addLogOdds(int x, int y, int z, int delta, bool allocate) {
+		Block* block = allocate ? allocateBlock(x, y, z) : findBlock(x, y, z);
+		if (block == NULL)
+			return;
+		Voxel& v = at(block, x, y, z);
+		v.logOdds = (s8)core::clamp(v.logOdds + delta, (int)-LOG_ODDS_MAX, (int)LOG_ODDS_MAX);
+		bool occupied = v.logOdds > 0;
+		if (occupied != ((v.flags & FLAG_OCCUPIED) != 0) && !(v.flags & FLAG_DIRTY)) {
+			v.flags |= FLAG_DIRTY;
+			Index index = { x, y, z };
+			dirty.push_back(index);
+		}
+	}
+
+	void setOccupied(int x, int y, int z) {
+		addLogOdds(x, y, z, 2 * LOG_ODDS_MAX, true);
+	}
+
+	// Occupied voxels are the sources of field 0, free ones of field 1; outside the blocks all is free
+	bool isSource(int field, int x, int y, int z) {
+		Block* block = findBlock(x, y, z);
+		if (block == NULL)
+			return field == 1;
+		return ((at(block, x, y, z).flags & FLAG_OCCUPIED) != 0) == (field == 0);
+	}
+
+	// Clears every voxel whose nearest voxel is no source anymore, and queues the voxels around them
+	// that still have a valid one to fill the gap again
+	void raise(int field) {
+		static const int NEIGHBORS[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+		std::vector<Index>& queue = raiseQueue[field];
+		for (size_t i = 0; i < queue.size(); ++i) {
+			Index u = queue[i];
+			for (int n = 0; n < 6; ++n) {
+				Index p = { u.x + NEIGHBORS[n][0], u.y + NEIGHBORS[n][1], u.z + NEIGHBORS[n][2] };
+				Block* block = findBlock(p.x, p.y, p.z);
+				if (block == NULL)
+					continue;
+				Voxel& v = at(block, p.x, p.y, p.z);
+				const s8* offset = v.nearest[field];
+				if (offset[0] == NONE)
+					continue;
+				if (isSource(field, p.x + offset[0], p.y + offset[1], p.z + offset[2]))
+					lowerQueue[field].push_back(p);
+				else {
+					v.nearest[field][0] = NONE;
+					queue.push_back(p);
+				}
+			}
+		}
+		queue.clear();
+	}
+
+	// Spreads the nearest sources outwards as long as they are nearer than what the neighbours have
+	void lower(int field) {
+		static const int NEIGHBORS[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+		std::vector<Index>& queue = lowerQueue[field];
+		int maxDistanceSq = maxDistance * maxDistance;
+		for (size_t i = 0; i < queue.size(); ++i) {
+			Index u = queue[i];
+			const s8* offset = at(findBlock(u.x, u.y, u.z), u.x, u.y, u.z).nearest[field];
+			if (offset[0] == NONE)
+				continue;
+			Index source = { u.x + offset[0], u.y + offset[1], u.z + offset[2] };
+			if (!isSource(field, source.x, source.y, source.z))
+				continue;
+			for (int n = 0; n < 6; ++n) {
+				Index p = { u.x + NEIGHBORS[n][0], u.y + NEIGHBORS[n][1], u.z + NEIGHBORS[n][2] };
+				int dx = source.x - p.x, dy = source.y - p.y, dz = source.z - p.z;
+				int distanceSq = dx * dx + dy * dy + dz * dz;
+				if (distanceSq > maxDistanceSq)
+					continue;
+				// The free field only matters inside obstacles, which are always allocated
+				Block* block = field == 0 ? allocateBlock(p.x, p.y, p.z) : findBlock(p.x, p.y, p.z);
+				if (block == NULL)
+					continue;
+				Voxel& v = at(block, p.x, p.y, p.z);
+				if (v.nearest[field][0] != NONE && lengthSq(v.nearest[field]) <= distanceSq)
+					continue;
+				v.nearest[field][0] = (s8)dx;
+				v.nearest[field][1] = (s8)dy;
+				v.nearest[field][2] = (s8)dz;
+				queue.push_back(p);
+			}
+		}
+		queue.clear();
+	}
+
+	int toVoxel(float v) const {
+		return (int)floorf(v * invVoxelSize);
+	}
+
+	float getVoxelDistance(const Block* block, int x, int y, int z) const {
+		if (block == NULL)
+			return (maxDistance - 0.5f) * voxelSize;
+		const Voxel& v = at(block, x, y, z);
+		int field = (v.flags & FLAG_OCCUPIED) ? 1 : 0;
+		const s8* offset = v.nearest[field];
+		// Centers of neighbouring free and occupied voxels are one voxel apart, the surface is halfway
+		float distance = offset[0] == NONE ? maxDistance - 0.5f : sqrtf((float)lengthSq(offset)) - 0.5f;
+		return (field == 0 ? distance : -distance) * voxelSize;
+	}
+
+public:
+	// maxDistance is where the field is cut off; it is at most 126 voxels
+	VoxelMap(float voxelSize = 0.5f _METER, float maxDistance = 3 _METER, int maxBlocks = 32768) :
+		voxelSize(voxelSize), invVoxelSize(1 / voxelSize), maxBlocks(maxBlocks) {
+		this->maxDistance = core::clamp((int)ceilf(maxDistance * invVoxelSize), 1, 126);
+	}
+
+	~VoxelMap() {
+		clear();
+	}
+
+	void clear() {
+		for (std::unordered_map<s64, Block*>::iterator it = blocks.begin(); it != blocks.end(); ++it)
+			delete it->second;
+		blocks.clear();
+		lastKey = -1;
+		lastBlock = NULL;
+		dirty.clear();
+		for (int field = 0; field < 2; ++field) {
+			raiseQueue[field].clear();
+			lowerQueue[field].clear();
+		}
+	}
+
+	// Every voxel the box overlaps
+	void insertBox(const core::aabbox3df& box) {
+		int x0 = toVoxel(box.MinEdge.X), x1 = toVoxel(box.MaxEdge.X);
+		int y0 = toVoxel(box.MinEdge.Y), y1 = toVoxel(box.MaxEdge.Y);
+		int z0 = toVoxel(box.MinEdge.Z), z1 = toVoxel(box.MaxEdge.Z);
+		for (int z = z0; z <= z1; ++z)
+			for (int y = y0; y <= y1; ++y)
+				for (int x = x0; x <= x1; ++x)
+					setOccupied(x, y, z);
+	}
+
+	// Every voxel the box overlaps becomes free, e.g. where an obstacle moved away
+	void clearBox(const core::aabbox3df& box) {
+		int x0 = toVoxel(box.MinEdge.X), x1 = toVoxel(box.MaxEdge.X);
+		int y0 = toVoxel(box.MinEdge.Y), y1 = toVoxel(box.MaxEdge.Y);
+		int z0 = toVoxel(box.MinEdge.Z), z1 = toVoxel(box.MaxEdge.Z);
+		for (int z = z0; z <= z1; ++z)
+			for (int y = y0; y <= y1; ++y)
+				for (int x = x0; x <= x1; ++x)
+					addLogOdds(x, y, z, -2 * LOG_ODDS_MAX, false);
+	}
+
+	// Every voxel the sphere overlaps
+	void insertSphere(const core::vector3df& center, float radius) {
+		int x0 = toVoxel(center.X - radius), x1 = toVoxel(center.X + radius);
+		int y0 = toVoxel(center.Y - radius), y1 = toVoxel(center.Y + radius);
+		int z0 = toVoxel(center.Z - radius), z1 = toVoxel(center.Z + radius);
+		for (int z = z0; z <= z1; ++z)
+			for (int y = y0; y <= y1; ++y)
+				for (int x = x0; x <= x1; ++x) {
+					core::vector3df nearest(core::clamp(center.X, x * voxelSize, (x + 1) * voxelSize),
+						core::clamp(center.Y, y * voxelSize, (y + 1) * voxelSize),
+						core::clamp(center.Z, z * voxelSize, (z + 1) * voxelSize));
+					if (nearest.getDistanceFromSQ(center) <= radius * radius)
+						setOccupied(x, y, z);
+				}
+	}
+
+	void insertObstacles(CollisionWorld* world) {
+		for (int i = 0; i < world->getNumObstacles(); ++i) {
+			const Obstacle& obstacle = world->getObstacle(i);
+			if (obstacle.type == OT_SPHERE)
+				insertSphere(obstacle.center, obstacle.radius);
+			else
+				insertBox(obstacle.box);
+		}
+	}
+
+	// The terrain surface inside the region's X and Z range, as a shell reaching one voxel below the
+	// lowest neighbouring height so steep slopes have no holes. Negative distances further down are
+	// not meaningful.
+	void insertTerrain(const HeightMap* heightMap, const core::aabbox3df& region) {
+		PROFILE_SCOPE("voxel map terrain");
+		int x0 = toVoxel(region.MinEdge.X), x1 = toVoxel(region.MaxEdge.X);
+		int z0 = toVoxel(region.MinEdge.Z), z1 = toVoxel(region.MaxEdge.Z);
+		for (int z = z0; z <= z1; ++z)
+			for (int x = x0; x <= x1; ++x) {
+				float cx = (x + 0.5f) * voxelSize, cz = (z + 0.5f) * voxelSize;
+				float height = heightMap->getHeight(cx, cz);
+				float lowest = core::min_(core::min_(heightMap->getHeight(cx - voxelSize, cz), heightMap->getHeight(cx + voxelSize, cz)),
+					core::min_(heightMap->getHeight(cx, cz - voxelSize), heightMap->getHeight(cx, cz + voxelSize)));
+				int top = toVoxel(height), bottom = core::min_(toVoxel(lowest), top) - 1;
+				for (int y = bottom; y <= top; ++y)
+					setOccupied(x, y, z);
+			}
+	}
+
+	// One range measurement: the voxels along the ray become more likely free, the end voxel more
+	// likely occupied if something was hit there. Free space is only recorded in allocated blocks.
+	void integrateRay(const core::vector3df& origin, const core::vector3df& end, bool hit) {
+		core::vector3df a = origin * invVoxelSize, b = end * invVoxelSize, d = b - a;
+		int voxel[3] = { (int)floorf(a.X), (int)floorf(a.Y), (int)floorf(a.Z) };
+		int last[3] = { (int)floorf(b.X), (int)floorf(b.Y), (int)floorf(b.Z) };
+		int step[3];
+		float tNext[3], tDelta[3];
+		for (int k = 0; k < 3; ++k) {
+			float dk = (&d.X)[k];
+			step[k] = dk > 0 ? 1 : -1;
+			tDelta[k] = dk != 0 ? fabsf(1 / dk) : 1e30f;
+			tNext[k] = dk != 0 ? ((dk > 0 ? voxel[k] + 1 : voxel[k]) - (&a.X)[k]) / dk : 1e30f;
+		}
+		// Amanatides-Woo traversal up to the end voxel
+		while (voxel[0] != last[0] || voxel[1] != last[1] || voxel[2] != last[2]) {
+			addLogOdds(voxel[0], voxel[1], voxel[2], -LOG_ODDS_MISS, false);
+			int k = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+			if (tNext[k] > 1)
+				break;
+			voxel[k] += step[k];
+			tNext[k] += tDelta[k];
+		}
+		if (hit)
+			addLogOdds(last[0], last[1], last[2], LOG_ODDS_HIT, true);
+		else
+			addLogOdds(last[0], last[1], last[2], -LOG_ODDS_MISS, false);
+	}
+
+	void integrateScan(const RangeSensor& sensor) {
+		PROFILE_SCOPE("voxel map scan");
+		core::vector3df origin = sensor.getOrigin();
+		for (int i = 0; i < sensor.getBeamCount(); ++i)
+			integrateRay(origin, sensor.getHitPoint(i), sensor.isHit(i));
+	}
+
+	// Brings the distance field up to date with the occupancy changes since the last call
+	void update() {
+		PROFILE_SCOPE("voxel map update");
+		for (size_t i = 0; i < dirty.size(); ++i) {
+			Index p = dirty[i];
+			Voxel& v = at(findBlock(p.x, p.y, p.z), p.x, p.y, p.z);
+			v.flags &= ~FLAG_DIRTY;
+			bool occupied = v.logOdds > 0;
+			if (occupied == ((v.flags & FLAG_OCCUPIED) != 0))
+				continue;
+			v.flags ^= FLAG_OCCUPIED;
+			// The voxel becomes a source of one field and stops being one of the other
+			int field = occupied ? 0 : 1;
+			v.nearest[field][0] = v.nearest[field][1] = v.nearest[field][2] = 0;
+			lowerQueue[field].push_back(p);
+			v.nearest[1 - field][0] = NONE;
+			raiseQueue[1 - field].push_back(p);
+		}
+		dirty.clear();
+		for (int field = 0; field < 2; ++field) {
+			raise(field);
+			lower(field);
+		}
+	}
+
+	bool isOccupied(const core::vector3df& position) const {
+		int x = toVoxel(position.X), y = toVoxel(position.Y), z = toVoxel(position.Z);
+		const Block* block = findBlock(x, y, z);
+		return block != NULL && (at(block, x, y, z).flags & FLAG_OCCUPIED) != 0;
+	}
+
+	// Signed distance to the nearest obstacle surface, negative inside obstacles, interpolated between
+	// the voxel centers; gradient is optional. Up to getMaxDistance().
+	float getDistance(const core::vector3df& position, core::vector3df* gradient = NULL) const {
+		core::vector3df g = position * invVoxelSize - core::vector3df(0.5f, 0.5f, 0.5f);
+		int x = (int)floorf(g.X), y = (int)floorf(g.Y), z = (int)floorf(g.Z);
+		float fx = g.X - x, fy = g.Y - y, fz = g.Z - z;
+		// Corners 0..7 with bit 0 for x + 1, bit 1 for y + 1 and bit 2 for z + 1
+		float d[8];
+		const Block* block = findBlock(x, y, z);
+		bool sameBlock = (x & 7) < 7 && (y & 7) < 7 && (z & 7) < 7;
+		for (int i = 0; i < 8; ++i) {
+			int cx = x + (i & 1), cy = y + ((i >> 1) & 1), cz = z + (i >> 2);
+			d[i] = getVoxelDistance(sameBlock || i == 0 ? block : findBlock(cx, cy, cz), cx, cy, cz);
+		}
+		float d00 = d[0] + (d[1] - d[0]) * fx, d10 = d[2] + (d[3] - d[2]) * fx;
+		float d01 = d[4] + (d[5] - d[4]) * fx, d11 = d[6] + (d[7] - d[6]) * fx;
+		float d0 = d00 + (d10 - d00) * fy, d1 = d01 + (d11 - d01) * fy;
+		if (gradient != NULL) {
+			float gx0 = (d[1] - d[0]) + ((d[3] - d[2]) - (d[1] - d[0])) * fy;
+			float gx1 = (d[5] - d[4]) + ((d[7] - d[6]) - (d[5] - d[4])) * fy;
+			gradient->X = (gx0 + (gx1 - gx0) * fz) * invVoxelSize;
+			gradient->Y = ((d10 - d00) + ((d11 - d01) - (d10 - d00)) * fz) * invVoxelSize;
+			gradient->Z = (d1 - d0) * invVoxelSize;
+		}
+		return d0 + (d1 - d0) * fz;
+	}
+
+	// True if a sphere of the given radius moves from a to b without touching an obstacle. Steps by the
+	// clearance, less half a voxel for the interpolation error, so open space takes few lookups.
+	bool isSegmentFree(const core::vector3df& a, const core::vector3df& b, float radius) const {
+		core::vector3df direction = b - a;
+		float length = direction.getLength();
+		if (length > 0)
+			direction /= length;
+		float t = 0.f;
+		for (;;) {
+			float clearance = getDistance(a + direction * t) - radius;
+			if (clearance <= 0)
+				return false;
+			if (t >= length)
+				return true;
+			t = core::min_(t + core::max_(clearance - 0.5f * voxelSize, 0.25f * voxelSize), length);
+		}
+	}
+
+	float getVoxelSize() const {
+		return voxelSize;
+	}
+
+	float getMaxDistance() const {
+		return (maxDistance - 0.5f) * voxelSize;
+	}
+
+	int getBlockCount() const {
+		return (int)blocks.size();
+	}
+
+	size_t getMemoryBytes() const {
+		return blocks.size() * sizeof(Block);
+	}
+
+	// Blocks that were needed while the map was full
+	u32 getDroppedBlocks() const {
+		return droppedBlocks;
+	}
+};
@@ -0,0 +1,250 @@
+#pragma once
+#include <irrlicht.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <random>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define WIND_SSE
+#include <xmmintrin.h>
+#endif
+
+using namespace irr;
+
+// Wind velocity on a regular 3D grid, sampled trilinearly at any position.
+// The grid is either generated turbulence or loaded from a file (e.g. converted CFD output).
+// Generated turbulence is a periodic tile of unit variance gusts with Dryden-like exponential
+// correlation, scaled by the gust intensity. It is frozen and carried along by the mean wind
+// (Taylor's hypothesis), which makes it vary in time without storing more than one grid.
+// Loaded grids hold absolute wind and are clamped at their borders; the mean wind still adds to them.
+//
+// Samples are stored as 4 floats (x, y, z, unused) in bricks of 4 x 4 x 4 points, so the eight
+// corners of a lookup are mostly in one or two cache lines and are interpolated with SSE.
+//
+// File format, little endian: "WND1", u32 nx, ny, nz, f32 spacing, f32 origin[3],
+// then nx * ny * nz velocities as f32 x, y, z with x running fastest. Lengths in m, speeds in m/s.
+class WindField {
+private:
+	std::vector<float> data; // 4 floats per sample, bricked
+	int size[3] = { 0, 0, 0 };		 // samples per axis, multiples of 4
+	int bricks[3] = { 0, 0, 0 };
+	bool periodic = false;
+	float spacing = 1.f, invSpacing = 1.f;
+	core::vector3df origin;
+	float intensity = 1.f;
+	core::vector3df mean;
+	core::vector3df drift; // distance the frozen field has moved with the mean wind
+	float scale = 1.f;	   // of the grid values, intensity for turbulence
+
+	int index(int x, int y, int z) const {
+		return ((((z >> 2) * bricks[1] + (y >> 2)) * bricks[0] + (x >> 2)) * 64 + ((z & 3) * 4 + (y & 3)) * 4 + (x & 3)) * 4;
+	}
+
+	void allocate(int nx, int ny, int nz) {
+		int n[3] = { nx, ny, nz };
+		for (int a = 0; a < 3; ++a) {
+			size[a] = (n[a] + 3) & ~3;
+			bricks[a] = size[a] / 4;
+		}
+		data.assign((size_t)size[0] * size[1] * size[2] * 4, 0.f);
+	}
+
+	// First-order recursive filter along one axis of one component, run forward and backward
+	// around the periodic grid so that the correlation is symmetric. The two passes give a
+	// correlation of (1 + r / l) * exp(-r / l), which falls to 1 / e at r = 2.15 l.
+	void filterAxis(int component, int axis, float lengthScale) {
+		float a = expf(-spacing * 2.15f / lengthScale);
+		float b = sqrtf(1 - a * a);
+		int n = size[axis];
+		std::vector<float> line(n);
+		int other1 = (axis + 1) % 3, other2 = (axis + 2) % 3;
+		int p[3];
+		for (p[other1] = 0; p[other1] < size[other1]; ++p[other1])
+			for (p[other2] = 0; p[other2] < size[other2]; ++p[other2]) {
+				for (p[axis] = 0; p[axis] < n; ++p[axis])
+					line[p[axis]] = data[index(p[0], p[1], p[2]) + component];
+				for (int pass = 0; pass < 2; ++pass) {
+					int first = pass == 0 ? 0 : n - 1, step = pass == 0 ? 1 : -1;
+					// Settle the filter state on one lap before writing, this makes the result periodic
+					float state = 0.f;
+					for (int i = 0, k = first; i < n; ++i, k = (k + step + n) % n)
+						state = a * state + b * line[k];
+					for (int i = 0, k = first; i < n; ++i, k = (k + step + n) % n)
+						line[k] = state = a * state + b * line[k];
+				}
+				for (p[axis] = 0; p[axis] < n; ++p[axis])
+					data[index(p[0], p[1], p[2]) + component] = line[p[axis]];
+			}
+	}
+
+	int wrap(int i, int axis) const {
+		return periodic ? i & (size[axis] - 1) : core::clamp(i, 0, size[axis] - 1);
+	}
+
+public:
+	WindField() {}
+
+	// Turbulence tile of nx * ny * nz points, each rounded up to a power of two of at least 4.
+	// lengthScale is the correlation length of the gusts along X; along the other axes it is half as long.
+	void generate(int nx, int ny, int nz, float spacing, float lengthScale, u32 seed = 1) {
+		int n[3] = { 4, 4, 4 };
+		while (n[0] < nx)
+			n[0] *= 2;
+		while (n[1] < ny)
+			n[1] *= 2;
+		while (n[2] < nz)
+			n[2] *= 2;
+		allocate(n[0], n[1], n[2]);
+		periodic = true;
+		this->spacing = spacing;
+		invSpacing = 1.f / spacing;
+		origin.set(0, 0, 0);
+		scale = intensity;
+
+		std::mt19937 random(seed);
+		std::normal_distribution<float> normal;
+		for (size_t i = 0; i < data.size(); ++i)
+			data[i] = (i & 3) == 3 ? 0.f : normal(random);
+		float lengthScales[3] = { lengthScale, lengthScale / 2, lengthScale / 2 };
+		for (int c = 0; c < 3; ++c)
+			for (int axis = 0; axis < 3; ++axis)
+				filterAxis(c, axis, lengthScales[c]);
+
+		// Back to unit variance per component
+		for (int c = 0; c < 3; ++c) {
+			double sum = 0, sumSQ = 0;
+			size_t n = data.size() / 4;
+			for (size_t i = 0; i < n; ++i) {
+				sum += data[4 * i + c];
+				sumSQ += (double)data[4 * i + c] * data[4 * i + c];
+			}
+			double avg = sum / n, dev = sqrt(core::max_(sumSQ / n - avg * avg, 1e-12));
+			for (size_t i = 0; i < n; ++i)
+				data[4 * i + c] = (float)((data[4 * i + c] - avg) / dev);
+		}
+	}
+
+	// unitScale converts the file's metres to world units
+	bool load(const char* fileName, float unitScale) {
+		FILE* file = fopen(fileName, "rb");
+		if (file == NULL) {
+			printf("WindField: could not open %s\n", fileName);
+			return false;
+		}
+		char magic[4];
+		u32 n[3];
+		float header[4];
+		bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, "WND1", 4) == 0 &&
+			fread(n, sizeof(u32), 3, file) == 3 && fread(header, sizeof(float), 4, file) == 4 &&
+			n[0] > 0 && n[1] > 0 && n[2] > 0 && header[0] > 0;
+		if (ok) {
+			allocate(n[0], n[1], n[2]);
+			periodic = false;
+			spacing = header[0] * unitScale;
+			invSpacing = 1.f / spacing;
+			origin.set(header[1] * unitScale, header[2] * unitScale, header[3] * unitScale);
+			scale = unitScale;
+			std::vector<float> row(3 * n[0]);
+			for (u32 z = 0; z < n[2] && ok; ++z)
+				for (u32 y = 0; y < n[1] && ok; ++y) {
+					ok = fread(row.data(), sizeof(float), row.size(), file) == row.size();
+					for (u32 x = 0; x < n[0] && ok; ++x)
+						memcpy(&data[index(x, y, z)], &row[3 * x], 3 * sizeof(float));
+				}
+			// Pad to whole bricks by repeating the last samples
+			for (int z = 0; z < size[2]; ++z)
+				for (int y = 0; y < size[1]; ++y)
+					for (int x = 0; x < size[0]; ++x)
+						if (x >= (int)n[0] || y >= (int)n[1] || z >= (int)n[2])
+							memcpy(&data[index(x, y, z)], &data[index(core::min_(x, (int)n[0] - 1),
+								core::min_(y, (int)n[1] - 1), core::min_(z, (int)n[2] - 1))], 4 * sizeof(float));
+			size[0] = n[0];
+			size[1] = n[1];
+			size[2] = n[2];
+		}
+		fclose(file);
+		if (!ok) {
+			printf("WindField: %s is no valid wind grid\n", fileName);
+			data.clear();
+		}
+		return ok;
+	}
+
+	bool isValid() const {
+		return !data.empty();
+	}
+
+	void setMean(const core::vector3df& mean) {
+		this->mean = mean;
+	}
+
+	core::vector3df getMean() const {
+		return mean;
+	}
+
+	// Standard deviation of the generated gusts per component
+	void setIntensity(float intensity) {
+		this->intensity = intensity;
+		if (periodic)
+			scale = intensity;
+	}
+
+	// Moves generated turbulence along with the mean wind; call once per step
+	void advance(float elapsedTime) {
+		if (!periodic)
+			return;
+		drift += mean * elapsedTime;
+		// Keep the drift within one period so positions do not lose precision
+		for (int a = 0; a < 3; ++a) {
+			float period = size[a] * spacing;
+			float& d = (&drift.X)[a];
+			d -= period * floorf(d / period);
+		}
+	}
+
+	core::vector3df getWind(const core::vector3df& pos) const {
+		if (data.empty())
+			return mean;
+		core::vector3df g = (pos - origin - drift) * invSpacing;
+		float fx = floorf(g.X), fy = floorf(g.Y), fz = floorf(g.Z);
+		int x0 = (int)fx, y0 = (int)fy, z0 = (int)fz;
+		float tx = g.X - fx, ty = g.Y - fy, tz = g.Z - fz;
+		int x1 = wrap(x0 + 1, 0), y1 = wrap(y0 + 1, 1), z1 = wrap(z0 + 1, 2);
+		x0 = wrap(x0, 0);
+		y0 = wrap(y0, 1);
+		z0 = wrap(z0, 2);
+		const float* d = data.data();
+#ifdef WIND_SSE
+		__m128 c000 = _mm_loadu_ps(d + index(x0, y0, z0)), c100 = _mm_loadu_ps(d + index(x1, y0, z0));
+		__m128 c010 = _mm_loadu_ps(d + index(x0, y1, z0)), c110 = _mm_loadu_ps(d + index(x1, y1, z0));
+		__m128 c001 = _mm_loadu_ps(d + index(x0, y0, z1)), c101 = _mm_loadu_ps(d + index(x1, y0, z1));
+		__m128 c011 = _mm_loadu_ps(d + index(x0, y1, z1)), c111 = _mm_loadu_ps(d + index(x1, y1, z1));
+		__m128 vx = _mm_set1_ps(tx), vy = _mm_set1_ps(ty), vz = _mm_set1_ps(tz);
+		__m128 c00 = _mm_add_ps(c000, _mm_mul_ps(vx, _mm_sub_ps(c100, c000)));
+		__m128 c10 = _mm_add_ps(c010, _mm_mul_ps(vx, _mm_sub_ps(c110, c010)));
+		__m128 c01 = _mm_add_ps(c001, _mm_mul_ps(vx, _mm_sub_ps(c101, c001)));
+		__m128 c11 = _mm_add_ps(c011, _mm_mul_ps(vx, _mm_sub_ps(c111, c011)));
+		__m128 c0 = _mm_add_ps(c00, _mm_mul_ps(vy, _mm_sub_ps(c10, c00)));
+		__m128 c1 = _mm_add_ps(c01, _mm_mul_ps(vy, _mm_sub_ps(c11, c01)));
+		__m128 c = _mm_mul_ps(_mm_add_ps(c0, _mm_mul_ps(vz, _mm_sub_ps(c1, c0))), _mm_set1_ps(scale));
+		float result[4];
+		_mm_storeu_ps(result, c);
+		return mean + core::vector3df(result[0], result[1], result[2]);
+#else
+		int corners[8] = { index(x0, y0, z0), index(x1, y0, z0), index(x0, y1, z0), index(x1, y1, z0),
+			index(x0, y0, z1), index(x1, y0, z1), index(x0, y1, z1), index(x1, y1, z1) };
+		float result[3];
+		for (int c = 0; c < 3; ++c) {
+			float c00 = d[corners[0] + c] + tx * (d[corners[1] + c] - d[corners[0] + c]);
+			float c10 = d[corners[2] + c] + tx * (d[corners[3] + c] - d[corners[2] + c]);
+			float c01 = d[corners[4] + c] + tx * (d[corners[5] + c] - d[corners[4] + c]);
+			float c11 = d[corners[6] + c] + tx * (d[corners[7] + c] - d[corners[6] + c]);
+			float c0 = c00 + ty * (c10 - c00), c1 = c01 + ty * (c11 - c01);
+			result[c] = (c0 + tz * (c1 - c0)) * scale;
+		}
+		return mean + core::vector3df(result[0], result[1], result[2]);
+#endif
+	}
+};
@@ -2,14 +2,30 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <Windows.h>
+#include <chrono>
 #include "driverChoice.h"
 #include "ShaderSetup.h"
 #include "MyEventReceiver.h"
 #include "Quadrotor.h"
-#include "PlatformNode.h"
+#include "TerrainNode.h"
+#include "CollisionWorld.h"
+#include "WindField.h"
+#include "BatteryBank.h"
+#include "StateProvider.h"
+#include "ErrorStateEkf.h"
+#include "RayCaster.h"
+#include "OnboardCamera.h"
+#include "VoxelMap.h"
+#include "Planner.h"
+#include "QuadrotorSwarmNode.h"
+#include "TrailNode.h"
 #include "Graph.h"
 #include "FuzzyGraph.h"
+#include "SimulationClock.h"
+#include "HudText.h"
+#include "FrameCapture.h"
+#include "FramePacer.h"
+#include "Profiler.h"
 
 #include "FuzzyPDController.h"
 #include "QuadrotorController.h"
@@ -25,21 +41,170 @@ using namespace irr;
 
 
 void drawCoordinateSystem(Quadrotor* quadrotor, video::IVideoDriver *driver);
+void benchmarkEkf(int vehicles);
+void drawRangeSensor(const RangeSensor* sensor, video::IVideoDriver *driver);
+void drawWaypoints(const std::vector<TimedWaypoint>& waypoints, video::IVideoDriver *driver);
+
+template <class Airframe>
+AttitudeController* createAttitudeController(Quadrotor* quadrotor) {
+	return new MultirotorController<Airframe>(PDController(1, .8f), PDController(1, .1f, .01f), PDController(1, .1f, .02f), quadrotor);
+}
 
 IrrlichtDevice* device = 0;
 bool UseHighLevelShaders = false;
 float fpsMax = 200;
+float graphHistorySec = 180;
 
 int gScreenWidth = 1366, gScreenHeight = 740;
+int gSwarmSize = 0;
+
+// Capture mode: renders offscreen with the software driver and advances the simulation in fixed steps
+const char* gCaptureOutput = NULL;
+int gCaptureFrames = 0; // 0 runs until the device is closed
+float gCaptureFps = 25;
+
+// Terrain from a square 16-bit raw raster; without a file rolling hills are generated
+const char* gTerrainFile = NULL;
+float gTerrainCellSize = 1 _METER;
+float gTerrainHeightScale = 0.01f _METER; // height per raster unit
+
+// Pillars on the terrain west of the start, where the swarm does not fly
+int gObstacleCount = 8;
+
+// Wind along +X with gusts of the given standard deviation, or a wind grid from a file; still air by default
+float gWindSpeed = 0;
+float gGustIntensity = 0;
+const char* gWindFile = NULL;
+
+// Measured propeller (rpm, airspeed m/s, thrust N, torque Nm) and motor (throttle, current A) tables as CSV
+const char* gPropellerFile = NULL;
+const char* gMotorFile = NULL;
+
+// Airframe of the main vehicle: quad-x, quad-plus, hexa, octo or coaxial; the swarm flies quad-x
+const char* gAirframe = "quad-x";
+
+// Capacity of every vehicle's 4S pack in Ah, e.g. 2.2; 0 for unlimited power. Off by default,
+// an empty pack cuts the motors off after about 13 minutes with 2.2 Ah
+float gBatteryCapacity = 0.f;
+
+// Controllers fly on estimates from simulated IMU, barometer and GPS instead of the true state;
+// the estimator is "complementary" or "ekf"
+bool gSensors = false;
+const char* gEstimator = "complementary";
+
+// Range sensor on the main vehicle: "2d" or "3d" lidar or "depth" camera, scanned gRangeSensorRate times a second
+const char* gRangeSensor = NULL;
+float gRangeSensorRate = 10;
+
+// Forward camera on the main vehicle, and with gSwarmCameras on every swarm vehicle, rendered offscreen;
+// no camera if the width is 0
+core::dimension2d<u32> gCameraSize(0, 0);
+float gCameraRate = 15;
+bool gSwarmCameras = false;
+
+// Occupancy voxels and distance field around the start with voxels of this size, updated from the
+// range sensor; 0 disables the map
+float gVoxelSize = 0;
+
+// Plans a path for the main vehicle to this point (m) in the voxel map, which it then follows;
+// the planner is "rrt" (informed RRT*) or "astar" (voxel grid)
+bool gPlan = false;
+core::vector3df gPlanGoal;
+const char* gPlanner = "rrt";
+float gPlanTime = 1; // seconds
+
+// Runs the EKF for this many vehicles on synthetic data, prints the timings and exits
+int gBenchEkf = 0;
+
+// Records all profiled scopes and writes them at exit; .json gives a Chrome trace, anything else the binary format
+const char* gProfileOutput = NULL;
 
 int main(int argc, char **argv)
 {
-	if (argc > 1) {
-		gScreenWidth = atoi(argv[1]);
-		gScreenHeight = atoi(argv[2]);
+	// Options start with "--", the remaining arguments are width, height and swarm size
+	std::vector<char*> args;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+			gCaptureOutput = argv[++i];
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			gCaptureFrames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--capture-fps") == 0 && i + 1 < argc)
+			gCaptureFps = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+			gProfileOutput = argv[++i];
+		else if (strcmp(argv[i], "--terrain") == 0 && i + 1 < argc)
+			gTerrainFile = argv[++i];
+		else if (strcmp(argv[i], "--terrain-cell") == 0 && i + 1 < argc)
+			gTerrainCellSize = (float)atof(argv[++i]) _METER;
+		else if (strcmp(argv[i], "--terrain-scale") == 0 && i + 1 < argc)
+			gTerrainHeightScale = (float)atof(argv[++i]) _METER;
+		else if (strcmp(argv[i], "--obstacles") == 0 && i + 1 < argc)
+			gObstacleCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--wind") == 0 && i + 1 < argc)
+			gWindSpeed = (float)atof(argv[++i]) _METER;
+		else if (strcmp(argv[i], "--gusts") == 0 && i + 1 < argc)
+			gGustIntensity = (float)atof(argv[++i]) _METER;
+		else if (strcmp(argv[i], "--wind-file") == 0 && i + 1 < argc)
+			gWindFile = argv[++i];
+		else if (strcmp(argv[i], "--propeller") == 0 && i + 1 < argc)
+			gPropellerFile = argv[++i];
+		else if (strcmp(argv[i], "--motor") == 0 && i + 1 < argc)
+			gMotorFile = argv[++i];
+		else if (strcmp(argv[i], "--airframe") == 0 && i + 1 < argc)
+			gAirframe = argv[++i];
+		else if (strcmp(argv[i], "--battery") == 0 && i + 1 < argc)
+			gBatteryCapacity = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--sensors") == 0)
+			gSensors = true;
+		else if (strcmp(argv[i], "--estimator") == 0 && i + 1 < argc)
+			gEstimator = argv[++i];
+		else if (strcmp(argv[i], "--lidar") == 0 && i + 1 < argc)
+			gRangeSensor = argv[++i];
+		else if (strcmp(argv[i], "--lidar-rate") == 0 && i + 1 < argc)
+			gRangeSensorRate = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--camera") == 0 && i + 1 < argc)
+			sscanf(argv[++i], "%ux%u", &gCameraSize.Width, &gCameraSize.Height);
+		else if (strcmp(argv[i], "--camera-rate") == 0 && i + 1 < argc)
+			gCameraRate = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--swarm-cameras") == 0)
+			gSwarmCameras = true;
+		else if (strcmp(argv[i], "--voxel-map") == 0 && i + 1 < argc)
+			gVoxelSize = (float)atof(argv[++i]) _METER;
+		else if (strcmp(argv[i], "--plan") == 0 && i + 1 < argc) {
+			gPlan = sscanf(argv[++i], "%f,%f,%f", &gPlanGoal.X, &gPlanGoal.Y, &gPlanGoal.Z) == 3;
+			gPlanGoal *= 1 _METER;
+		}
+		else if (strcmp(argv[i], "--planner") == 0 && i + 1 < argc)
+			gPlanner = argv[++i];
+		else if (strcmp(argv[i], "--plan-time") == 0 && i + 1 < argc)
+			gPlanTime = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--bench-ekf") == 0 && i + 1 < argc)
+			gBenchEkf = atoi(argv[++i]);
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() > 1) {
+		gScreenWidth = atoi(args[0]);
+		gScreenHeight = atoi(args[1]);
+	}
+	if (args.size() > 2)
+		gSwarmSize = atoi(args[2]);
+	const char* airframes[] = { "quad-x", "quad-plus", "hexa", "octo", "coaxial" };
+	bool knownAirframe = false;
+	for (const char* name : airframes)
+		knownAirframe |= strcmp(gAirframe, name) == 0;
+	if (!knownAirframe) {
+		printf("Unknown airframe %s, use quad-x, quad-plus, hexa, octo or coaxial\n", gAirframe);
+		return 1;
+	}
+	bool capture = gCaptureOutput != NULL;
+	if (gBenchEkf > 0) {
+		benchmarkEkf(gBenchEkf);
+		return 0;
 	}
+
 	// ask user for driver
-	video::E_DRIVER_TYPE driverType = video::EDT_DIRECT3D9;// driverChoiceConsole();
+	video::E_DRIVER_TYPE driverType = capture ? video::EDT_BURNINGSVIDEO : video::EDT_DIRECT3D9;// driverChoiceConsole();
 	if (driverType == video::EDT_COUNT)
 		return 1;
 
@@ -48,8 +213,19 @@ int main(int argc, char **argv)
 	MyEventReceiver receiver;
 
 	// create device
-	device = createDevice(driverType, core::dimension2d<u32>(gScreenWidth, gScreenHeight),
-		32, false, false, false, &receiver);
+	if (capture) {
+		// The console device needs no window system, so this also runs on machines without a display or GPU
+		SIrrlichtCreationParameters params;
+		params.DeviceType = EIDT_CONSOLE;
+		params.DriverType = driverType;
+		params.WindowSize = core::dimension2d<u32>(gScreenWidth, gScreenHeight);
+		params.Bits = 32;
+		params.EventReceiver = &receiver;
+		device = createDeviceEx(params);
+	}
+	else
+		device = createDevice(driverType, core::dimension2d<u32>(gScreenWidth, gScreenHeight),
+			32, false, false, false, &receiver);
 
 	if (device == 0)
 		return 1; // could not create selected driver.
@@ -61,8 +237,9 @@ int main(int argc, char **argv)
 	io::path vsFileName; // filename for the vertex shader
 	io::path psFileName; // filename for the pixel shader
 
-	setupShader(device, UseHighLevelShaders, driver, driverType,
-		psFileName, vsFileName);
+	MyShaderCallBack* shaderCallback = new MyShaderCallBack(device, UseHighLevelShaders);
+	s32 shaderMaterial = setupShader(device, UseHighLevelShaders, driver, driverType,
+		psFileName, vsFileName, shaderCallback);
 
 	// add a nice skybox
 	driver->setTextureCreationFlag(video::ETCF_CREATE_MIP_MAPS, false);
@@ -86,16 +263,229 @@ int main(int argc, char **argv)
 
 
 	// add other objects
-	Quadrotor quadrotor(0.4 _METER, 0.7f, 12000 / 60.f, 9.81f _METER, smgr->getRootSceneNode(), smgr, 1001);
-	float speed[] = { 0.01f, 0.01f, 0.01f, 0.01f };
+	AirframeGeometry airframe = makeAirframeGeometry<QuadX>();
+	AttitudeController* (*createController)(Quadrotor*) = createAttitudeController<QuadX>;
+	if (strcmp(gAirframe, "quad-plus") == 0) {
+		airframe = makeAirframeGeometry<QuadPlus>();
+		createController = createAttitudeController<QuadPlus>;
+	}
+	else if (strcmp(gAirframe, "hexa") == 0) {
+		airframe = makeAirframeGeometry<Hexa>();
+		createController = createAttitudeController<Hexa>;
+	}
+	else if (strcmp(gAirframe, "octo") == 0) {
+		airframe = makeAirframeGeometry<Octo>();
+		createController = createAttitudeController<Octo>;
+	}
+	else if (strcmp(gAirframe, "coaxial") == 0) {
+		airframe = makeAirframeGeometry<CoaxialQuad>();
+		createController = createAttitudeController<CoaxialQuad>;
+	}
+	Quadrotor quadrotor(0.4 _METER, 0.7f, 12000 / 60.f, 9.81f _METER, smgr->getRootSceneNode(), smgr, 1001, true, airframe);
+	float speed[AIRFRAME_MAX_MOTORS];
+	for (int i = 0; i < AIRFRAME_MAX_MOTORS; ++i)
+		speed[i] = 0.01f;
 	quadrotor.setMotorSpeed(speed);
 
-	QuadrotorController quadrotorControllerPD(PDController(1, .8f), PDController(1, .1f, .05f), PDController(1, .1f, .2f), &quadrotor);
-	QuadrotorTrajectoryController trajectoryController(&quadrotorControllerPD, &quadrotor);
+	AttitudeController* quadrotorControllerPD = createController(&quadrotor);
+	QuadrotorTrajectoryController trajectoryController(quadrotorControllerPD, &quadrotor);
 	receiver.setTrajectoryController(&trajectoryController);
 
-	PlatformNode* platform = new PlatformNode(20 _METER, 20 _METER,
-		driver->getTexture("../media/wall.bmp"), smgr->getRootSceneNode(), smgr, 1000);
+	// Additional vehicles hovering in a grid; they have no scene nodes of their own and are drawn by one swarm node
+	std::vector<Quadrotor*> swarm;
+	std::vector<QuadrotorController*> swarmControllers;
+	std::vector<QuadrotorTrajectoryController*> swarmTrajectoryControllers;
+	QuadrotorSwarmNode* swarmNode = new QuadrotorSwarmNode(0.4 _METER, smgr->getRootSceneNode(), smgr, 1002);
+	int swarmRowLength = (int)ceil(sqrt((double)gSwarmSize));
+	for (int i = 0; i < gSwarmSize; ++i) {
+		Quadrotor* q = new Quadrotor(0.4 _METER, 0.7f, 12000 / 60.f, 9.81f _METER, 0, smgr, -1, false);
+		q->setPosition(core::vector3df((i % swarmRowLength + 1) * 2 _METER, 0, (i / swarmRowLength + 1) * 2 _METER));
+		QuadrotorController* controller = new QuadrotorController(PDController(1, .8f), PDController(1, .1f, .01f), PDController(1, .1f, .02f), q);
+		QuadrotorTrajectoryController* trajectory = new QuadrotorTrajectoryController(controller, q);
+		trajectory->setTrajectory(QT_STABLE_MEDIUM);
+		swarm.push_back(q);
+		swarmControllers.push_back(controller);
+		swarmTrajectoryControllers.push_back(trajectory);
+	}
+
+	// Flight paths; trail 0 belongs to the main vehicle, trail i + 1 to swarm vehicle i
+	TrailNode* trailNode = new TrailNode(smgr->getRootSceneNode(), smgr, 1003, 8192);
+	trailNode->addTrail(video::SColor(255, 255, 200, 50));
+	for (int i = 0; i < gSwarmSize; ++i)
+		trailNode->addTrail(video::SColor(255, 50, 150, 255));
+
+	// Ground; the vehicles start on a flat area at the origin of the generated terrain
+	HeightMap heightMap;
+	if (gTerrainFile == NULL || !heightMap.load(gTerrainFile, gTerrainCellSize, gTerrainHeightScale))
+		heightMap.generate(1025, 2 _METER, 150 _METER);
+	TerrainNode* terrain = new TerrainNode(&heightMap, driver->getTexture("../media/wall.bmp"),
+		smgr->getRootSceneNode(), smgr, 1000, 32, 20 _METER);
+	terrain->setMaterialType((video::E_MATERIAL_TYPE)shaderMaterial);
+	quadrotor.setGround(&heightMap);
+	for (int i = 0; i < gSwarmSize; ++i)
+		swarm[i]->setGround(&heightMap);
+
+	// A 256 x 64 x 256 m turbulence tile with 30 m gusts, moving with the mean wind
+	WindField wind;
+	bool hasWind = gWindSpeed != 0 || gGustIntensity != 0 || gWindFile != NULL;
+	if (gWindFile == NULL || !wind.load(gWindFile, 1 _METER)) {
+		wind.setIntensity(gGustIntensity);
+		if (gGustIntensity > 0)
+			wind.generate(64, 16, 64, 4 _METER, 30 _METER);
+	}
+	wind.setMean(core::vector3df(gWindSpeed, 0, 0));
+	if (hasWind) {
+		quadrotor.setWind(&wind);
+		for (int i = 0; i < gSwarmSize; ++i)
+			swarm[i]->setWind(&wind);
+	}
+
+	// Measured tables replace the generated ones of the main vehicle, which all vehicles then share
+	PropulsionModel* propulsion = quadrotor.getPropulsion();
+	if (gPropellerFile != NULL)
+		propulsion->loadPropellerCsv(gPropellerFile);
+	if (gMotorFile != NULL)
+		propulsion->loadMotorCsv(gMotorFile);
+	if (gPropellerFile != NULL || gMotorFile != NULL)
+		for (int i = 0; i < gSwarmSize; ++i)
+			swarm[i]->setPropulsion(propulsion);
+
+	// One pack per vehicle, pack 0 powers the main vehicle
+	BatteryBank batteries;
+	if (gBatteryCapacity > 0) {
+		quadrotor.setBattery(&batteries, batteries.addPack(gBatteryCapacity, 4, 0.04f));
+		for (int i = 0; i < gSwarmSize; ++i)
+			swarm[i]->setBattery(&batteries, batteries.addPack(gBatteryCapacity, 4, 0.04f));
+	}
+
+	// Sensors and estimators; 0 belongs to the main vehicle, i + 1 to swarm vehicle i
+	std::vector<SensorSuite*> sensorSuites;
+	std::vector<StateProvider*> estimators;
+	if (gSensors) {
+		for (int i = 0; i <= gSwarmSize; ++i) {
+			Quadrotor* q = i == 0 ? &quadrotor : swarm[i - 1];
+			SensorSuite* sensors = new SensorSuite(q, 1 + i);
+			StateProvider* estimator;
+			if (strcmp(gEstimator, "ekf") == 0)
+				estimator = new EkfStateProvider(sensors);
+			else
+				estimator = new ComplementaryStateProvider(sensors);
+			sensorSuites.push_back(sensors);
+			estimators.push_back(estimator);
+		}
+		quadrotorControllerPD->setStateProvider(estimators[0]);
+		for (int i = 0; i < gSwarmSize; ++i)
+			swarmControllers[i]->setStateProvider(estimators[i + 1]);
+	}
+
+	// Mid-air collisions between all vehicles; cells fit the largest vehicle
+	CollisionWorld collisions(2 * quadrotor.getRadius(), 10 _METER);
+	collisions.addVehicle(&quadrotor, quadrotor.getRadius());
+	for (int i = 0; i < gSwarmSize; ++i)
+		collisions.addVehicle(swarm[i], swarm[i]->getRadius());
+	// Static obstacles, which the range sensors, the voxel map and the planner see as well
+	for (int i = 0; i < gObstacleCount; ++i) {
+		u64 stream = CounterRng::makeStream(7, i);
+		float width = (2 + 2 * CounterRng::uniform(stream, 0)) _METER, height = (10 + 15 * CounterRng::uniform(stream, 1)) _METER;
+		float x = -(15 + 45 * CounterRng::uniform(stream, 2)) _METER, z = (80 * CounterRng::uniform(stream, 3) - 40) _METER;
+		float y = heightMap.getHeight(x, z) - 2 _METER; // sunk in, so that slopes leave no gap
+		core::aabbox3df box(x - width / 2, y, z - width / 2, x + width / 2, y + height, z + width / 2);
+		collisions.addBox(box);
+		scene::ISceneNode* pillar = smgr->addCubeSceneNode(1, 0, -1, box.getCenter(), core::vector3df(0, 0, 0), box.getExtent());
+		pillar->setMaterialTexture(0, driver->getTexture("../media/wall.jpg"));
+		pillar->setMaterialFlag(video::EMF_LIGHTING, false);
+	}
+
+	// Ray casts against the terrain and everything in the collision world, spread over all cores
+	RayCaster rayCaster(&heightMap, &collisions);
+	RangeSensor* rangeSensor = NULL;
+	ThreadPool* threadPool = NULL;
+	s64 nextRangeScan = 0; // in simulation clock ticks
+	if (gRangeSensor != NULL) {
+		rayCaster.build();
+		threadPool = new ThreadPool();
+		if (strcmp(gRangeSensor, "3d") == 0)
+			rangeSensor = new RangeSensor(&quadrotor, BP_LIDAR_3D, 1024, 32, 360, 30, 100 _METER);
+		else if (strcmp(gRangeSensor, "depth") == 0)
+			rangeSensor = new RangeSensor(&quadrotor, BP_DEPTH_CAMERA, 160, 120, 90, 73.7f, 30 _METER);
+		else
+			rangeSensor = new RangeSensor(&quadrotor, BP_LIDAR_2D, 1080, 1, 360, 0, 30 _METER);
+	}
+
+	// Terrain within 100 m of the start and the static obstacles; scans add what the sensor sees
+	VoxelMap* voxelMap = NULL;
+	if (gPlan && gVoxelSize <= 0)
+		gVoxelSize = 0.5f _METER;
+	if (gVoxelSize > 0) {
+		voxelMap = new VoxelMap(gVoxelSize, 3 _METER);
+		core::vector3df start = quadrotor.getPosition();
+		core::vector3df extent(100 _METER, 0, 100 _METER);
+		voxelMap->insertTerrain(&heightMap, core::aabbox3df(start - extent, start + extent));
+		voxelMap->insertObstacles(&collisions);
+		voxelMap->update();
+		printf("VoxelMap: %d blocks, %.1f MB\n", voxelMap->getBlockCount(), voxelMap->getMemoryBytes() / 1048576.f);
+	}
+
+	// Takes off straight up to 5 m above the terrain, from there the planned path leads to the goal
+	if (gPlan) {
+		core::vector3df position = quadrotor.getPosition();
+		core::vector3df start(position.X, heightMap.getHeight(position.X, position.Z) + 5 _METER, position.Z);
+		core::aabbox3df bounds(start);
+		bounds.addInternalPoint(gPlanGoal);
+		bounds.MinEdge -= core::vector3df(30 _METER, 10 _METER, 30 _METER);
+		bounds.MaxEdge += core::vector3df(30 _METER, 30 _METER, 30 _METER);
+		float radius = quadrotor.getRadius() + 0.3f _METER;
+		std::vector<core::vector3df> path;
+		std::chrono::steady_clock::time_point planStart = std::chrono::steady_clock::now();
+		bool found;
+		if (strcmp(gPlanner, "astar") == 0) {
+			GridAStar planner(voxelMap, radius);
+			found = planner.plan(start, gPlanGoal, bounds, path);
+			printf("Planner: A* expanded %d voxels\n", planner.getExpanded());
+		}
+		else {
+			if (threadPool == NULL)
+				threadPool = new ThreadPool();
+			RrtStarSettings settings;
+			settings.radius = radius;
+			RrtStarPlanner planner(voxelMap, threadPool, settings);
+			planner.reset(start, gPlanGoal, bounds);
+			found = planner.solve(gPlanTime);
+			planner.getPath(path);
+			printf("Planner: RRT* with %d nodes from %llu samples on %d threads\n", planner.getNodeCount(),
+				(unsigned long long)planner.getSampleCount(), threadPool->getThreadCount());
+		}
+		float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - planStart).count();
+		if (found) {
+			shortcutPath(voxelMap, radius, path);
+			path.insert(path.begin(), position);
+			float length = 0;
+			for (size_t i = 1; i < path.size(); ++i)
+				length += path[i].getDistanceFrom(path[i - 1]);
+			std::vector<TimedWaypoint> waypoints;
+			makeTimedWaypoints(path, 3 _METER, 2, waypoints);
+			trajectoryController.setWaypoints(waypoints);
+			printf("Planner: %.1f m in %d waypoints after %.2f s\n", length / (1 _METER), (int)waypoints.size(), seconds);
+		}
+		else
+			printf("Planner: no path found after %.2f s\n", seconds);
+	}
+
+	// Onboard cameras; camera vehicle 0 is the main vehicle, i + 1 swarm vehicle i
+	std::vector<Quadrotor*> cameraVehicles(1, &quadrotor);
+	cameraVehicles.insert(cameraVehicles.end(), swarm.begin(), swarm.end());
+	CameraRenderer* cameraRenderer = NULL;
+	OnboardCamera* onboardCamera = NULL;
+	video::ITexture* onboardTexture = NULL;
+	if (gCameraSize.Width > 0 && gCameraSize.Height > 0) {
+		cameraRenderer = new CameraRenderer(driver, smgr, 0.4 _METER);
+		onboardCamera = cameraRenderer->addCamera(0, gCameraSize, 90, gCameraRate);
+		if (gSwarmCameras)
+			for (int i = 0; i < gSwarmSize; ++i)
+				cameraRenderer->addCamera(i + 1, gCameraSize, 90, gCameraRate);
+		cameraRenderer->start();
+		onboardTexture = driver->addTexture(gCameraSize, "onboard camera", video::ECF_A8R8G8B8);
+	}
 
 	// add a light source
 	scene::ILightSceneNode* light = smgr->addLightSceneNode(0, core::vector3df(1000 _METER, 1000 _METER, 1000 _METER),
@@ -106,7 +496,14 @@ int main(int argc, char **argv)
 	//smgr->addSphereSceneNode(20, 16, &quadrotor, -1, core::vector3df(0, 0, 100))->getMaterial(0).EmissiveColor = video::SColor(150, 0, 0, 255);
 	// setup Graphs and GUI
 	gui::IGUIFont* font = gui->getFont("../media/fonthaettenschweiler.bmp");
-
+	HudText hud(font);
+	int hudPosLine = hud.addLine(core::rect<s32>(gScreenWidth / 2 - 500, 0, gScreenWidth / 2 + 500, 30),
+		video::SColor(255, 255, 255, 255), true, true);
+	int hudRotLine = hud.addLine(core::rect<s32>(gScreenWidth / 2 - 500, 20, gScreenWidth / 2 + 500, 50),
+		video::SColor(255, 255, 255, 255), true, true);
+
+	// The graphs hold every physics step of the last graphHistorySec seconds
+	int graphHistory = (int)(graphHistorySec * fpsMax);
 	Graph* motorGraphLin[4];
 	FuzzyGraph* motorGraphFuzzy[4];
 	for (int i = 0; i < 4; ++i) {
@@ -117,19 +514,22 @@ int main(int argc, char **argv)
 		pos.LowerRightCorner = core::vector2d<s32>(x*(gScreenWidth - sizeWidth) + sizeWidth, y*(gScreenHeight - sizeHeight - 1) + sizeHeight);
 		std::wstring caption = L"Motor ";
 		caption += std::to_wstring(i);
-		motorGraphLin[i] = new Graph(caption.c_str(), pos, 1.f, 0.f, 2, 30, font);
+		motorGraphLin[i] = new Graph(caption.c_str(), pos, 1.f, 0.f, 2, graphHistory, font);
+		motorGraphLin[i]->setHud(&hud);
 		//motorGraphFuzzy[i] = FuzzyGraph(caption.c_str(), pos, 2, smgr, -1);
 	}
 
 	Graph* quadrotorGraph[4];
 	quadrotorGraph[0] = new Graph(L"Height", core::rect<s32>(0, 0.252*gScreenHeight, 0.25*gScreenWidth, 0.5*gScreenHeight),
-		50.f _METER, 0.f, 2, 30, font);
+		50.f _METER, 0.f, 2, graphHistory, font);
 	quadrotorGraph[1] = new Graph(L"Roll", core::rect<s32>(0.75*gScreenWidth, 0.252*gScreenHeight, gScreenWidth, 0.5*gScreenHeight),
-		180.f, -180.f, 2, 30, font);
+		180.f, -180.f, 2, graphHistory, font);
 	quadrotorGraph[2] = new Graph(L"Yaw", core::rect<s32>(0, 0.502*gScreenHeight, 0.25*gScreenWidth, 0.748*gScreenHeight),
-		180.f, -180.f, 2, 30, font);
+		180.f, -180.f, 2, graphHistory, font);
 	quadrotorGraph[3] = new Graph(L"Pitch", core::rect<s32>(0.75*gScreenWidth, 0.502*gScreenHeight, gScreenWidth, 0.748*gScreenHeight),
-		180.f, -180.f, 2, 30, font);
+		180.f, -180.f, 2, graphHistory, font);
+	for (int i = 0; i < 4; ++i)
+		quadrotorGraph[i]->setHud(&hud);
 
 
 
@@ -148,66 +548,135 @@ int main(int argc, char **argv)
 	receiver.registerSwap(' ', &isPaused);
 	receiver.registerSwap('c', &drawCoordSys);
 
+	bool showTrails = true;
+	receiver.registerSwap('t', &showTrails);
+
+	bool useLTTB = false;
+	receiver.registerSwap('g', &useLTTB);
+
 	bool showFuzzySets = false;
 	receiver.registerSwap('f', &showFuzzySets);
+
+	bool showProfiler = false;
+	receiver.registerSwap('p', &showProfiler);
+	std::vector<int> profilerLines;
+	int numProfilerScopes = 0;
+	Profiler::get().setThreadName("main");
+	Profiler::get().setRecording(gProfileOutput != NULL);
 	receiver.setQuadrotor(&quadrotor);
 
 
 	u32 lastFPS = -1;
-	u32 maxElapsedTimeMs = (u32)round(1000.f / fpsMax);
+	FramePacer pacer(fpsMax);
+
+	FrameCapture* frameCapture = NULL;
+	int captureStepsPerFrame = 1, captureStep = 0;
+	if (capture) {
+		frameCapture = new FrameCapture(driver, core::dimension2d<u32>(gScreenWidth, gScreenHeight), gCaptureOutput);
+		captureStepsPerFrame = core::max_((int)round(fpsMax / gCaptureFps), 1);
+	}
 
-	u32 now, then;
-	now = device->getTimer()->getTime();
-	u32 lastUpdate = 0;
-	u32 timeWorld = 0;
+	s64 lastUpdate = 0;
+	SimulationClock worldClock;
 
 	core::vector3df delayedPos, delayedRot, delayedSpeed, delayedRotSpeed;
 	while (device->run())
-		if (device->isWindowActive())
+		if (capture || device->isWindowActive())
 		{
-			then = now;
-			now = device->getTimer()->getTime();
-			u32 elapsedTimeMs = now - then;
-			f32 elapsedTime = elapsedTimeMs / 1000.f;
+			Profiler::get().setEnabled(showProfiler || gProfileOutput != NULL);
+			Profiler::get().collect();
+			PROFILE_SCOPE("frame");
+
+			// Length of the previous frame including the wait for the frame cap
+			f32 elapsedTime = pacer.getLastFrameTime() / 1000.f;
+			// Captured runs advance in fixed steps independent of how long rendering takes
+			if (capture)
+				elapsedTime = 1.f / fpsMax;
 
 			// World updates
 			if (!isPaused) {
-				timeWorld += elapsedTimeMs;
+				PROFILE_SCOPE("world update");
+				worldClock.advance(elapsedTime);
+				s64 timeWorld = worldClock.getTicks();
+				wind.advance(elapsedTime);
 				// Continuous updates
-			
-				trajectoryController.update(elapsedTime);
+				{
+					PROFILE_SCOPE("trajectory");
+					trajectoryController.update(elapsedTime);
+				}
 				quadrotor.update(elapsedTime);
-
-				// Delayed updates
-				if (now - lastUpdate > 150) {
-					lastUpdate = now;
-					for (int i = 0; i < 4; ++i) {
-						motorGraphLin[i]->addVal(0, core::vector2df((f32)timeWorld, quadrotor.getMotorSpeed(i)));
-						motorGraphLin[i]->addVal(1, core::vector2df((f32)timeWorld, quadrotor.getWantedMotorSpeed(i)));
+				{
+					PROFILE_SCOPE("swarm");
+					for (int i = 0; i < gSwarmSize; ++i) {
+						swarmTrajectoryControllers[i]->update(elapsedTime);
+						swarm[i]->update(elapsedTime);
 					}
+				}
+				batteries.update(elapsedTime);
+				collisions.update();
+				collisions.resolve();
+				if (cameraRenderer != NULL)
+					cameraRenderer->update(worldClock);
+				if (rangeSensor != NULL) {
+					if (timeWorld >= nextRangeScan) {
+						// Stay on the grid of scan times; scans missed in a long step are dropped
+						do
+							nextRangeScan += worldClock.fromSeconds(1.0 / gRangeSensorRate);
+						while (nextRangeScan <= timeWorld);
+						rayCaster.refit();
+						rangeSensor->scan(rayCaster, threadPool);
+						if (voxelMap != NULL) {
+							voxelMap->integrateScan(*rangeSensor);
+							voxelMap->update();
+						}
+					}
+				}
+				for (size_t i = 0; i < sensorSuites.size(); ++i) {
+					sensorSuites[i]->update(worldClock, elapsedTime);
+					estimators[i]->update(elapsedTime);
+				}
+				swarmNode->syncFrom(swarm.data(), gSwarmSize);
+				trailNode->addPoint(0, quadrotor.getAbsolutePosition());
+				for (int i = 0; i < gSwarmSize; ++i)
+					trailNode->addPoint(i + 1, swarm[i]->getAbsolutePosition());
+
+				// Graphs are fed every step
+				PROFILE_SCOPE("graph feed");
+				for (int i = 0; i < 4; ++i) {
+					motorGraphLin[i]->addVal(0, timeWorld, quadrotor.getMotorSpeed(i));
+					motorGraphLin[i]->addVal(1, timeWorld, quadrotor.getWantedMotorSpeed(i));
+				}
 
-					float quadrotorRot[3];
-					quadrotor.getRotation().getAs3Values(quadrotorRot);
-					const float *const trajectoryParams = trajectoryController.getParams();
-
-					quadrotorGraph[0]->addVal(0, core::vector2df((f32)timeWorld, quadrotor.getAbsolutePosition().Y));
+				float quadrotorRot[3];
+				quadrotor.getRotation().getAs3Values(quadrotorRot);
+				const float *const trajectoryParams = trajectoryController.getParams();
+
+				quadrotorGraph[0]->addVal(0, timeWorld, quadrotor.getAbsolutePosition().Y);
+				if (trajectoryController.getTrajectory() != QT_NONE)
+					quadrotorGraph[0]->addVal(1, timeWorld, trajectoryParams[0]);
+				for (int i = 0; i < 3; ++i) {
+					quadrotorRot[i] -= 360 * (int)(quadrotorRot[i] / 360);
+					if (fabs(quadrotorRot[i]) > 180)
+						quadrotorRot[i] = (quadrotorRot[i] > 0 ? -360 : 360) + quadrotorRot[i];
+					quadrotorGraph[i+1]->addVal(0, timeWorld, quadrotorRot[i]);
 					if (trajectoryController.getTrajectory() != QT_NONE)
-						quadrotorGraph[0]->addVal(1, core::vector2df((f32)timeWorld, trajectoryParams[0]));
-					for (int i = 0; i < 3; ++i) {
-						quadrotorRot[i] -= 360 * (int)(quadrotorRot[i] / 360);
-						if (fabs(quadrotorRot[i]) > 180)
-							quadrotorRot[i] = (quadrotorRot[i] > 0 ? -360 : 360) + quadrotorRot[i];
-						quadrotorGraph[i+1]->addVal(0, core::vector2df((f32)timeWorld, quadrotorRot[i]));
-						if (trajectoryController.getTrajectory() != QT_NONE)
-							quadrotorGraph[i+1]->addVal(1, core::vector2df((f32)timeWorld, trajectoryParams[i+1]));
-					}
+						quadrotorGraph[i+1]->addVal(1, timeWorld, trajectoryParams[i+1]);
+				}
 
+				// Delayed updates
+				if (timeWorld - lastUpdate > worldClock.fromSeconds(0.15)) {
+					lastUpdate = timeWorld;
 					delayedPos = quadrotor.getAbsolutePosition();
 					delayedRot = quadrotor.getRotation();
 					delayedSpeed = quadrotor.getSpeed();
 					delayedRotSpeed = quadrotor.getAngularSpeed();
 				}
 			} 
+
+			// Only every captureStepsPerFrame-th step is rendered into the video
+			if (capture && ++captureStep < captureStepsPerFrame)
+				continue;
+			captureStep = 0;
 			
 			// Drawing stuff:
 			// Update camera
@@ -221,27 +690,102 @@ int main(int argc, char **argv)
 				cameras[1]->setPosition(camPos);
 				cameras[1]->updateAbsolutePosition();*/
 			}
+			trailNode->setVisible(showTrails);
 			// Draw scene
+			shaderCallback->beginFrame();
 			driver->beginScene(true, true, video::SColor(255, 0, 0, 0));
-			smgr->drawAll();
+			if (cameraRenderer != NULL)
+				cameraRenderer->render(worldClock, cameraVehicles.data(), (int)cameraVehicles.size());
+			if (capture)
+				frameCapture->begin(driver);
+			{
+				PROFILE_SCOPE("drawAll");
+				smgr->drawAll();
+			}
 
 			if (drawCoordSys)
 				drawCoordinateSystem(&quadrotor, driver);
+			if (rangeSensor != NULL)
+				drawRangeSensor(rangeSensor, driver);
+			if (trajectoryController.getTrajectory() == QT_WAYPOINTS)
+				drawWaypoints(trajectoryController.getWaypoints(), driver);
+
+			// Newest frame of the main vehicle's camera in the top right corner
+			if (onboardTexture != NULL) {
+				if (onboardCamera->acquire()) {
+					const CameraFrame& frame = onboardCamera->getFrame();
+					u8* pixels = (u8*)onboardTexture->lock();
+					if (pixels != NULL) {
+						for (u32 y = 0; y < frame.size.Height; ++y) {
+							u32* row = (u32*)(pixels + y * onboardTexture->getPitch());
+							const u8* rgb = &frame.rgb[3 * frame.size.Width * y];
+							for (u32 x = 0; x < frame.size.Width; ++x)
+								row[x] = video::SColor(255, rgb[3 * x], rgb[3 * x + 1], rgb[3 * x + 2]).color;
+						}
+					}
+					onboardTexture->unlock();
+				}
+				driver->draw2DImage(onboardTexture, core::position2d<s32>(gScreenWidth - gCameraSize.Width - 10, 60));
+			}
 
 			// Draw info graphics + text
-			for (int i = 0; i < 4; ++i) {
-				motorGraphLin[i]->render(driver);
-				quadrotorGraph[i]->render(driver);
+			{
+				PROFILE_SCOPE("graphs");
+				for (int i = 0; i < 4; ++i) {
+					motorGraphLin[i]->setDecimation(useLTTB ? GD_LTTB : GD_MINMAX);
+					quadrotorGraph[i]->setDecimation(useLTTB ? GD_LTTB : GD_MINMAX);
+					motorGraphLin[i]->render(driver);
+					quadrotorGraph[i]->render(driver);
+				}
+			}
+			{
+				PROFILE_SCOPE("HUD");
+				float posVals[] = { delayedPos.X, delayedPos.Y, delayedPos.Z, delayedSpeed.X, delayedSpeed.Y, delayedSpeed.Z };
+				float rotVals[] = { delayedRot.X, delayedRot.Y, delayedRot.Z, delayedRotSpeed.X, delayedRotSpeed.Y, delayedRotSpeed.Z };
+				hud.setValues(hudPosLine, L"Position: (%.2f, %.2f, %.2f),\tSpeed: (%.2f, %.2f, %.2f)", posVals, 6, 2);
+				hud.setValues(hudRotLine, L"Rotation: (%.2f, %.2f, %.2f),\tAngularSpeed: (%.2f, %.2f, %.2f)", rotVals, 6, 2);
+
+				// Rolling per-scope timings, one line per scope
+				if (showProfiler) {
+					Profiler& profiler = Profiler::get();
+					bool newScopes = profiler.getNumScopes() != numProfilerScopes;
+					numProfilerScopes = profiler.getNumScopes();
+					for (int i = 0; i < numProfilerScopes; ++i) {
+						if (i == (int)profilerLines.size())
+							profilerLines.push_back(hud.addLine(core::rect<s32>(gScreenWidth / 4 + 10, 60 + 17 * i,
+								3 * gScreenWidth / 4, 77 + 17 * i)));
+						// The order may have changed and the scope name is part of the format
+						if (newScopes)
+							hud.setText(profilerLines[i], L"");
+						const Profiler::ScopeStats& scope = profiler.getScope(i);
+						core::stringw format;
+						for (int d = 0; d < scope.depth; ++d)
+							format += L"    ";
+						format += scope.name;
+						format += L": %.2f ms avg, %.2f ms peak, %.0f calls";
+						float values[] = { scope.avgMs, scope.peakMs, (float)scope.calls };
+						hud.setValues(profilerLines[i], format.c_str(), values, 3, 2);
+					}
+				}
+				for (size_t i = 0; i < profilerLines.size(); ++i)
+					hud.setVisible(profilerLines[i], showProfiler);
+				hud.draw(driver);
 			}
-			wchar_t posStr[100], rotStr[100];
-			swprintf(posStr, 100, L"Position: (%.2f, %.2f, %.2f),\tSpeed: (%.2f, %.2f, %.2f)", 
-				delayedPos.X, delayedPos.Y, delayedPos.Z, delayedSpeed.X, delayedSpeed.Y, delayedSpeed.Z);
-			swprintf(rotStr, 100, L"Rotation: (%.2f, %.2f, %.2f),\tAngularSpeed: (%.2f, %.2f, %.2f)", 
-				delayedRot.X, delayedRot.Y, delayedRot.Z, delayedRotSpeed.X, delayedRotSpeed.Y, delayedRotSpeed.Z);
-			font->draw(posStr, core::rect<s32>(gScreenWidth / 2 - 500, 0, gScreenWidth / 2 + 500, 30), video::SColor(255, 255, 255, 255), true, true);
-			font->draw(rotStr, core::rect<s32>(gScreenWidth / 2 - 500, 20, gScreenWidth / 2 + 500, 50), video::SColor(255, 255, 255, 255), true, true);
 
-			driver->endScene();
+			if (capture) {
+				PROFILE_SCOPE("capture");
+				frameCapture->end(driver);
+				if (frameCapture->hasFailed() ||
+					(gCaptureFrames > 0 && (int)frameCapture->getFrameCount() >= gCaptureFrames))
+					device->closeDevice();
+				// Presenting on the console device would print an ASCII rendering of every frame
+				continue;
+			}
+
+			{
+				PROFILE_SCOPE("endScene");
+				driver->endScene();
+			}
 
 
 
@@ -251,23 +795,87 @@ int main(int argc, char **argv)
 				str += driver->getName();
 				str += "] FPS:";
 				str += fps;
+				wchar_t frameTimes[100];
+				swprintf(frameTimes, 100, L" frame ms p50 %.2f p99 %.2f max %.2f, overruns %u",
+					pacer.getMedian(), pacer.getPercentile(0.99f), pacer.getMax(), pacer.getOverruns());
+				str += frameTimes;
+				str += L", shader constant uploads ";
+				str += (s32)shaderCallback->getUploadsLastFrame();
+				str += L", terrain chunks ";
+				str += terrain->getDrawnChunks();
+				str += L", contacts ";
+				str += (s32)collisions.getContacts().size();
+				if (voxelMap != NULL) {
+					wchar_t clearance[100];
+					swprintf(clearance, 100, L", clearance %.1f m, voxel blocks %d",
+						voxelMap->getDistance(quadrotor.getPosition()) / (1 _METER), voxelMap->getBlockCount());
+					str += clearance;
+				}
+				if (batteries.getPackCount() > 0) {
+					wchar_t battery[120];
+					int remaining = (int)batteries.getRemainingTime(0);
+					swprintf(battery, 120, L", battery %.0f%% %.1f V %.1f A (peak %.1f A) %.2f Wh, %d:%02d left",
+						batteries.getStateOfCharge(0) * 100, batteries.getVoltage(0), batteries.getCurrent(0),
+						batteries.getPeakCurrent(0), batteries.getEnergy(0), remaining / 60, remaining % 60);
+					str += battery;
+				}
 
 				device->setWindowCaption(str.c_str());
 				lastFPS = fps;
 			}
 			
 			// cap FPS
-			u32 restTime = maxElapsedTimeMs - (device->getTimer()->getTime() - now);
-			if (restTime > 0) {
-				Sleep(restTime);
-			}
+			PROFILE_SCOPE("frame cap");
+			pacer.wait();
 			
 		}
 	
+	if (pacer.getFrameCount() > 0)
+		printf("Frame time ms: p50 %.2f, p99 %.2f, max %.2f; %u of %u frames overran\n", pacer.getMedian(),
+			pacer.getPercentile(0.99f), pacer.getMax(), pacer.getOverruns(), pacer.getFrameCount());
+	if (batteries.getPackCount() > 0) {
+		float energy = 0.f, peakCurrent = 0.f, minCharge = 1.f;
+		for (int i = 0; i < batteries.getPackCount(); ++i) {
+			energy += batteries.getEnergy(i);
+			peakCurrent = core::max_(peakCurrent, batteries.getPeakCurrent(i));
+			minCharge = core::min_(minCharge, batteries.getStateOfCharge(i));
+		}
+		printf("Battery: %.2f Wh per vehicle, peak current %.1f A, lowest charge %.0f%%\n",
+			energy / batteries.getPackCount(), peakCurrent, minCharge * 100);
+	}
+	if (gProfileOutput != NULL) {
+		Profiler::get().collect();
+		if (!Profiler::get().exportTrace(gProfileOutput))
+			printf("Could not write profile to %s\n", gProfileOutput);
+		else if (Profiler::get().getDroppedEvents() > 0)
+			printf("Profile is missing the last %llu events, the recording limit was reached\n",
+				(unsigned long long)Profiler::get().getDroppedEvents());
+	}
+	if (capture) {
+		printf("Captured %u frames, waited for the writer %u times\n", frameCapture->getFrameCount(), frameCapture->getStalls());
+		delete frameCapture;
+	}
 	for (int i = 0; i < 4; ++i)
 		delete motorGraphLin[i];
+	delete quadrotorControllerPD;
+	delete rangeSensor;
+	delete cameraRenderer;
+	delete voxelMap;
+	delete threadPool;
+	for (size_t i = 0; i < sensorSuites.size(); ++i) {
+		delete estimators[i];
+		delete sensorSuites[i];
+	}
+	for (int i = 0; i < gSwarmSize; ++i) {
+		delete swarmTrajectoryControllers[i];
+		delete swarmControllers[i];
+		swarm[i]->drop();
+	}
+	swarmNode->drop();
+	trailNode->drop();
+	terrain->drop();
 	smgr->drop();
-	platform->drop();
+	shaderCallback->drop();
 	device->drop();
 	return 0;
 }
@@ -285,4 +893,67 @@ void drawCoordinateSystem(Quadrotor* quadrotor, video::IVideoDriver *driver) {
  		endPos.set(i == 0 ? 1.f _METER : 0.f, i == 1 ? 1.f _METER : 0.f, i == 2 ? 1.f _METER : 0.f);
 		driver->draw3DLine(startPos, endPos, color);
 	}
-}
\ No newline at end of file
+}
+
+// Hits of the last scan as short vertical marks, at most 4096 of them
+void drawRangeSensor(const RangeSensor* sensor, video::IVideoDriver *driver) {
+	video::SMaterial material;
+	material.Lighting = false;
+	driver->setMaterial(material);
+	driver->setTransform(video::ETS_WORLD, core::matrix4());
+	int stride = sensor->getBeamCount() / 4096 + 1;
+	for (int i = 0; i < sensor->getBeamCount(); i += stride) {
+		if (!sensor->isHit(i))
+			continue;
+		core::vector3df hit = sensor->getHitPoint(i);
+		driver->draw3DLine(hit, hit + core::vector3df(0, 0.1f _METER, 0), video::SColor(255, 255, 60, 60));
+	}
+}
+
+void drawWaypoints(const std::vector<TimedWaypoint>& waypoints, video::IVideoDriver *driver) {
+	video::SMaterial material;
+	material.Lighting = false;
+	driver->setMaterial(material);
+	driver->setTransform(video::ETS_WORLD, core::matrix4());
+	for (size_t i = 1; i < waypoints.size(); ++i)
+		driver->draw3DLine(waypoints[i - 1].position, waypoints[i].position, video::SColor(255, 60, 220, 60));
+}
+
+// Filters for many vehicles in one array, as a batch job would keep them: every vehicle gets an IMU
+// sample per 200 Hz step, and a GPS and barometer fix every 40 steps
+void benchmarkEkf(int vehicles) {
+	typedef std::chrono::steady_clock Clock;
+	const int steps = 2000, fixInterval = 40;
+	const float dt = 1 / 200.f;
+	std::vector<ErrorStateEkf> filters(vehicles);
+	for (int i = 0; i < vehicles; ++i)
+		filters[i].reset(makeVector(i * 2.f _METER, 15.f _METER, 0.f), SMatrix3f::identity());
+
+	double predictNs = 0, updateNs = 0;
+	int updates = 0;
+	for (int step = 0; step < steps; ++step) {
+		float phase = step * dt;
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < vehicles; ++i) {
+			SVector3f force = makeVector(0.1f _METER * sinf(phase + i), 9.81f _METER, 0.1f _METER * cosf(phase));
+			SVector3f rate = makeVector(0.05f * cosf(phase), 0.01f, 0.05f * sinf(phase + i));
+			filters[i].predict(force, rate, dt);
+		}
+		predictNs += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+		if (step % fixInterval == 0) {
+			start = Clock::now();
+			for (int i = 0; i < vehicles; ++i) {
+				filters[i].updatePosition(1, 15.f _METER, 0.09f _METER _METER);
+				filters[i].updatePosition(makeVector(i * 2.f _METER, 15.f _METER, 0.f), 2.25f _METER _METER);
+			}
+			updateNs += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+			++updates;
+		}
+	}
+	float height = 0;
+	for (int i = 0; i < vehicles; ++i)
+		height += filters[i].getPosition()[1];
+	printf("EKF, %d vehicles: %.0f ns per predict, %.0f ns per barometer and GPS update (mean height %.1f m)\n",
+		vehicles, predictNs / ((double)steps * vehicles), updateNs / ((double)updates * vehicles), height / vehicles / (1 _METER));
+}
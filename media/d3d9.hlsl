@@ -0,0 +1,59 @@
+
+float4x4 mWorldViewProj;
+float4x4 mInvWorld;
+float4x4 mTransWorld;
+float3 mLightPos;
+float4 mLightColor;
+
+struct VS_OUTPUT
+{
+	float4 Position : POSITION;
+	float4 Diffuse  : COLOR0;
+	float2 TexCoord : TEXCOORD0;
+};
+
+VS_OUTPUT vertexMain(in float4 vPosition : POSITION,
+                     in float3 vNormal   : NORMAL,
+                     float2 texCoord     : TEXCOORD0)
+{
+	VS_OUTPUT Output;
+
+	Output.Position = mul(vPosition, mWorldViewProj);
+
+	float3 normal = mul(float4(vNormal, 0.0), mInvWorld);
+	normal = normalize(normal);
+
+	float3 worldpos = mul(mTransWorld, vPosition);
+
+	float3 lightVector = worldpos - mLightPos;
+	lightVector = normalize(lightVector);
+
+	float3 tmp = dot(-lightVector, normal);
+	tmp = lit(tmp.x, tmp.y, 1.0);
+
+	tmp = mLightColor * tmp;
+	Output.Diffuse = float4(tmp.x, tmp.y, tmp.z, 0);
+	Output.TexCoord = texCoord;
+
+	return Output;
+}
+
+struct PS_OUTPUT
+{
+	float4 RGBColor : COLOR0;
+};
+
+sampler2D myTexture;
+
+PS_OUTPUT pixelMain(float2 TexCoord : TEXCOORD0,
+                    float4 Position : POSITION,
+                    float4 Diffuse  : COLOR0)
+{
+	PS_OUTPUT Output;
+
+	float4 col = tex2D(myTexture, TexCoord);
+	Output.RGBColor = Diffuse * col;
+	Output.RGBColor *= 4.0;
+
+	return Output;
+}